@@ -0,0 +1,137 @@
+/*
+ * augcc.c: generate lens plugins with precompiled DFAs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+#include <argz.h>
+#include <getopt.h>
+
+#include "list.h"
+#include "syntax.h"
+#include "augeas.h"
+#include <locale.h>
+
+const char *progname;
+
+__attribute__((noreturn))
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [OPTIONS] LENS...\n", progname);
+    fprintf(stderr, "Write the C source of a lens plugin for the lenses LENS, given by their\nqualified names like Hosts.lns\n");
+    fprintf(stderr, "\nOptions:\n\n");
+    fprintf(stderr, "  -I, --include DIR  search DIR for modules; can be given multiple times\n");
+    fprintf(stderr, "  -o, --output FILE  write the plugin source to FILE instead of stdout\n");
+    fprintf(stderr, "  --nostdinc         do not search the builtin default directories for modules\n");
+
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    struct augeas *aug;
+    char *loadpath = NULL;
+    size_t loadpathlen = 0;
+    const char *output = NULL;
+    FILE *out = stdout;
+    int r;
+    enum {
+        VAL_NO_STDINC = CHAR_MAX + 1
+    };
+    struct option options[] = {
+        { "help",      0, 0, 'h' },
+        { "include",   1, 0, 'I' },
+        { "output",    1, 0, 'o' },
+        { "nostdinc",  0, 0, VAL_NO_STDINC },
+        { 0, 0, 0, 0}
+    };
+    int idx;
+    unsigned int flags = AUG_NO_MODL_AUTOLOAD|AUG_NO_LOAD;
+    progname = argv[0];
+
+    setlocale(LC_ALL, "");
+    while ((opt = getopt_long(argc, argv, "hI:o:", options, &idx)) != -1) {
+        switch(opt) {
+        case 'I':
+            argz_add(&loadpath, &loadpathlen, optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'h':
+            usage();
+            break;
+        case VAL_NO_STDINC:
+            flags |= AUG_NO_STDINC;
+            break;
+        default:
+            usage();
+            break;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Expected at least one lens\n");
+        usage();
+    }
+
+    argz_stringify(loadpath, loadpathlen, PATH_SEP_CHAR);
+    aug = aug_init(NULL, loadpath, flags);
+    if (aug == NULL) {
+        fprintf(stderr, "Memory exhausted\n");
+        return 2;
+    }
+
+    if (output != NULL) {
+        out = fopen(output, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Failed to open %s: %s\n", output,
+                    strerror(errno));
+            aug_close(aug);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    r = __aug_write_lens_plugin(aug, out, argc - optind, argv + optind);
+    if (r == -1) {
+        fprintf(stderr, "%s\n", aug_error_message(aug));
+        const char *s = aug_error_details(aug);
+        if (s != NULL) {
+            fprintf(stderr, "%s\n", s);
+        }
+    }
+    if (output != NULL && fclose(out) != 0 && r == 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", output, strerror(errno));
+        r = -1;
+    }
+    if (r == -1) {
+        if (output != NULL)
+            unlink(output);
+        aug_close(aug);
+        exit(EXIT_FAILURE);
+    }
+
+    aug_close(aug);
+    free(loadpath);
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -0,0 +1,440 @@
+/*
+ * augcc.h: interface between libaugeas and lens plugins generated by augcc
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef AUGCC_H_
+#define AUGCC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+ * A lens plugin is a shared object, generated by augcc, that contains the
+ * DFAs for the regular expressions of some lenses, and the parsers for the
+ * recursive ones among them, so that they do not have to be built at
+ * runtime. For lenses that are not recursive, it also contains a get
+ * routine that matches a text against the lens with these DFAs compiled
+ * in, instead of going through the generic code in get.c. Plugins are
+ * listed in the AUGEAS_LENS_PLUGINS environment variable, and are only used
+ * for a lens if it has exactly the same fingerprint as the lens the plugin
+ * was generated from; even then, a DFA is only used for a regexp with
+ * exactly the same pattern, and the get routine only if the ctype of each
+ * of the sublenses has exactly the same pattern.
+ *
+ * Apart from the get routines, and the functions below that they use,
+ * plugins are plain data; all of it is read-only.
+ */
+
+/* Increased whenever the structures below change incompatibly */
+#define AUGCC_ABI_VERSION 3
+
+/* The name of the struct augcc_plugin that every plugin defines */
+#define AUGCC_PLUGIN_SYMBOL "augcc_plugin"
+
+/* A DFA as a transition table. Characters are mapped to one of NCLASSES
+ * classes by CLASSES, and TRANS[S * NCLASSES + C] is the state reached
+ * from state S on a character of class C, or -1 if no accepting state can
+ * be reached anymore. State 0 is the initial state.
+ */
+struct augcc_dfa {
+    unsigned int          nstates;
+    unsigned int          nclasses;
+    const unsigned char  *classes;  /* 256 entries */
+    const bool           *accept;   /* NSTATES entries */
+    const int            *trans;    /* NSTATES * NCLASSES entries */
+};
+
+/* The DFAs for one regular expression. RDFA recognizes the reverse of the
+ * language of PATTERN. Either can be NULL if it was not needed or too big
+ * to build.
+ */
+struct augcc_regexp {
+    const char               *pattern;
+    unsigned int              nocase;
+    const struct augcc_dfa   *dfa;
+    const struct augcc_dfa   *rdfa;
+};
+
+/* The transducer that recursive lenses are parsed with. Lenses are
+ * numbered in the order in which the parser visits them, and LENS is the
+ * number of the lens itself; NONTERMINAL[L] says whether lens L is a
+ * nonterminal. The transitions of state S are the pairs (TO, LENS) in
+ * TRANS[2 * TRANS_START[S]] up to TRANS[2 * TRANS_START[S + 1]], and the
+ * lenses it returns are RET[RET_START[S]] up to RET[RET_START[S + 1]].
+ * NUM[S] is the number the parser uses to refer to S. State 0 is the
+ * start state.
+ */
+struct augcc_jmt {
+    uint32_t                   lens;
+    unsigned int               nlenses;
+    const unsigned char       *nonterminal;
+    unsigned int               nstates;
+    const uint32_t            *num;
+    const uint32_t            *trans_start;
+    const uint32_t            *trans;
+    const uint32_t            *ret_start;
+    const uint32_t            *ret;
+};
+
+/* What the get routine of a plugin reports its match to. The get routine
+ * numbers the lens and its sublenses in preorder, starting with 0 for the
+ * lens itself, and passes that number as NODE to each callback, together
+ * with DATA. A callback returns 0 on success, and -1 to make the get
+ * routine give up.
+ *
+ * For each match of a L_SUBTREE, ENTER and LEAVE are called around the
+ * callbacks for the match of its child; OPEN and CLOSE do the same for each
+ * match of a L_CONCAT, L_STAR, L_MAYBE and L_SQUARE. DEL, STORE and KEY are called for
+ * a L_DEL, L_STORE and L_KEY that matched TEXT[START..END), and VALUE,
+ * LABEL, SEQ and COUNTER for a L_VALUE, L_LABEL, L_SEQ and L_COUNTER.
+ * EXPIRED is called before each iteration of a L_STAR, and makes the get
+ * routine give up if it returns nonzero. EXPIRED, OPEN, CLOSE and DEL may
+ * be NULL.
+ */
+struct augcc_get_ops {
+    int (*expired)(void *data);
+    int (*enter)(void *data, unsigned int node);
+    int (*leave)(void *data, unsigned int node);
+    int (*open)(void *data, unsigned int node);
+    int (*close)(void *data, unsigned int node);
+    int (*del)(void *data, unsigned int node,
+               unsigned int start, unsigned int end);
+    int (*store)(void *data, unsigned int node,
+                 unsigned int start, unsigned int end);
+    int (*key)(void *data, unsigned int node,
+               unsigned int start, unsigned int end);
+    int (*value)(void *data, unsigned int node);
+    int (*label)(void *data, unsigned int node);
+    int (*seq)(void *data, unsigned int node);
+    int (*counter)(void *data, unsigned int node);
+};
+
+/* Match the lens against TEXT, which is SIZE characters long, reporting
+ * the match through OPS. Return 0 if the lens matched all of TEXT, and -1
+ * if it did not, if a callback gave up, or if the match is one that only
+ * the generic code in get.c can take apart, e.g., because a concatenation
+ * can be split in more than one way. Callers then have to get TEXT with
+ * the generic code */
+typedef int (*augcc_get_fn)(const struct augcc_get_ops *ops, void *data,
+                            const char *text, unsigned int size);
+
+/* The regular expressions of one lens, sorted by PATTERN and then by
+ * NOCASE, and for recursive lenses, the transducer to parse with. For
+ * other lenses, GET is the get routine, or NULL if there is none, and
+ * CTYPES[N] is the index in REGEXPS of the ctype of node N, for each of
+ * the NNODES nodes the get routine numbers */
+struct augcc_lens {
+    const char                *name;         /* Qualified name of the lens */
+    uint64_t                   fingerprint;
+    unsigned int               nregexps;
+    const struct augcc_regexp *regexps;
+    const struct augcc_jmt    *jmt;
+    unsigned int               nnodes;
+    const unsigned int        *ctypes;
+    augcc_get_fn               get;
+};
+
+struct augcc_plugin {
+    unsigned int               abi_version;  /* AUGCC_ABI_VERSION */
+    unsigned int               nlenses;
+    const struct augcc_lens   *lenses;
+};
+
+/*
+ * Functions used by the generated get routines. They match the text the
+ * same way as the generic code in get.c when it splits the match of a
+ * lens among its sublenses, see FILL_REGS there, and give up in the same
+ * cases in which that falls back to a regexp match.
+ */
+
+/* The state of one run of a get routine */
+struct augcc_get {
+    const struct augcc_get_ops *ops;
+    void                       *data;
+    const char                 *text;
+    /* Scratch space for splitting concatenations, see AUGCC_CONCAT */
+    int                        *work;
+    size_t                      nwork;
+};
+
+static inline void augcc_get_done(struct augcc_get *g) {
+    free(g->work);
+}
+
+/* Return the length of the longest match of DFA at TEXT[START..END), or
+ * -1 if there is none */
+static inline int augcc_dfa_match(const struct augcc_dfa *dfa,
+                                  const char *text,
+                                  unsigned int start, unsigned int end) {
+    int s = 0;
+    int result = dfa->accept[0] ? 0 : -1;
+
+    for (unsigned int i = start; i < end; i++) {
+        s = dfa->trans[s * dfa->nclasses
+                       + dfa->classes[(unsigned char) text[i]]];
+        if (s < 0)
+            break;
+        if (dfa->accept[s])
+            result = i + 1 - start;
+    }
+    return result;
+}
+
+static inline bool augcc_dfa_accepts(const struct augcc_dfa *dfa,
+                                     const char *text,
+                                     unsigned int start, unsigned int end) {
+    int s = 0;
+
+    for (unsigned int i = start; i < end; i++) {
+        s = dfa->trans[s * dfa->nclasses
+                       + dfa->classes[(unsigned char) text[i]]];
+        if (s < 0)
+            return false;
+    }
+    return dfa->accept[s];
+}
+
+/* Where a match of the child of a L_STAR that only matches single lines
+ * can end at the latest when it starts at START */
+static inline unsigned int augcc_line_end(const char *text,
+                                          unsigned int start,
+                                          unsigned int end) {
+    const char *nl = memchr(text + start, '\n', end - start);
+    return (nl == NULL) ? start : (unsigned int) (nl - text) + 1;
+}
+
+/* Return the one child of a L_UNION with N children, whose ctypes have
+ * the DFAs DFAS, that matches TEXT[START..END), or -1 if there is none or
+ * more than one */
+static inline int augcc_union(struct augcc_get *g, int n,
+                              const struct augcc_dfa *const *dfas,
+                              unsigned int start, unsigned int end) {
+    int found = -1;
+
+    for (int i=0; i < n; i++) {
+        if (augcc_dfa_accepts(dfas[i], g->text, start, end)) {
+            if (found >= 0)
+                return -1;
+            found = i;
+        }
+    }
+    return found;
+}
+
+/*
+ * Splitting the match of a L_CONCAT
+ *
+ * We run the DFAs of the children over the text at the same time. A run
+ * of the DFA of child K + 1 is started wherever a run of child K accepts,
+ * and remembers that start; the start of the run of child K that started
+ * it is recorded for it, too, so that we can follow these starts back to
+ * get the split. Since runs of the same DFA that are in the same state at
+ * the same position behave the same from there on, we only keep one of
+ * them, and mark it as ambiguous if the others started somewhere else.
+ * The split is unique if exactly one run of the last child accepts at the
+ * end, and it is not ambiguous. That only needs the forward DFAs, and one
+ * pass over the text.
+ */
+
+/* Runs of the DFA of one child. Each run consists of its state, a flag
+ * whether it is ambiguous, and where it started. SLOT[S] is the index of
+ * the run in state S if STAMP[S] is the stamp of the position we are adding
+ * runs for; that is I - START + 1 for position I */
+struct augcc_runs {
+    int   nruns;
+    int  *state, *ambig, *from;
+    int  *stamp, *slot;
+};
+
+static inline void augcc_runs_add(struct augcc_runs *r, int stamp, int s,
+                                  int ambig, int from) {
+    int j;
+
+    if (r->stamp[s] == stamp) {
+        j = r->slot[s];
+        if (ambig || r->from[j] != from)
+            r->ambig[j] = 1;
+        return;
+    }
+    j = r->nruns++;
+    r->stamp[s] = stamp;
+    r->slot[s] = j;
+    r->state[j] = s;
+    r->ambig[j] = ambig;
+    r->from[j] = from;
+}
+
+/* Split TEXT[START..END) among the N children of a L_CONCAT, whose ctypes
+ * have the DFAS, so that child I matches TEXT[SPLIT[I]..SPLIT[I+1]).
+ * Return -1 if there is no split, or more than one. */
+static inline int augcc_concat(struct augcc_get *g, int n,
+                               const struct augcc_dfa *const *dfas,
+                               unsigned int start, unsigned int end,
+                               unsigned int *split) {
+    /* The current and the next runs of each child */
+    struct augcc_runs *cur, *next;
+    /* A run of child K + 1 that started at position I has the start
+     * K * LEN + I - START; FROM[K * LEN + I - START] is the start of the
+     * run of child K that started it. Runs of child 0 have start -1 */
+    int *from;
+    int len = end - start + 1;
+    size_t nhead = (2 * n * sizeof(*cur) + sizeof(int) - 1) / sizeof(int);
+    size_t nwork = nhead + (size_t) (n - 1) * len;
+    int *w, found = -1;
+    /* Only children LO up to HI have runs */
+    int lo = 0, hi = 0;
+
+    for (int k=0; k < n; k++)
+        nwork += (size_t) dfas[k]->nstates * 10;
+    if (nwork > g->nwork) {
+        int *work = realloc(g->work, nwork * sizeof(*work));
+        if (work == NULL)
+            return -1;
+        g->work = work;
+        g->nwork = nwork;
+    }
+
+    cur = (struct augcc_runs *) g->work;
+    next = cur + n;
+    from = g->work + nhead;
+    w = from + (n - 1) * len;
+    for (int k=0; k < 2 * n; k++) {
+        struct augcc_runs *r = (k < n) ? cur + k : next + k - n;
+        int m = dfas[k % n]->nstates;
+        r->nruns = 0;
+        r->state = w;
+        r->ambig = w + m;
+        r->from = w + 2 * m;
+        r->stamp = w + 3 * m;
+        r->slot = w + 4 * m;
+        memset(r->stamp, 0, m * sizeof(*r->stamp));
+        w += 5 * m;
+    }
+
+    augcc_runs_add(cur, 1, 0, 0, -1);
+    for (unsigned int i = start; ; i++) {
+        int stamp = i - start + 1;
+
+        /* Start runs of each child where the one before it accepts; a
+         * run started that way can accept right away, and start a run of
+         * the child after it, too */
+        for (int k=lo; k <= hi && k < n - 1; k++) {
+            struct augcc_runs *r = cur + k;
+            int at = k * len + i - start;
+            bool started = false;
+            for (int j=0; j < r->nruns; j++) {
+                if (! dfas[k]->accept[r->state[j]])
+                    continue;
+                if (! started) {
+                    from[at] = r->from[j];
+                    augcc_runs_add(r + 1, stamp, 0, r->ambig[j], at);
+                    started = true;
+                } else if (r->ambig[j] || r->from[j] != from[at]) {
+                    r[1].ambig[r[1].slot[0]] = 1;
+                }
+            }
+            if (started && hi == k)
+                hi = k + 1;
+        }
+        if (i == end)
+            break;
+
+        /* Move all runs over TEXT[I] */
+        for (int k=lo; k <= hi; k++) {
+            const struct augcc_dfa *dfa = dfas[k];
+            struct augcc_runs *r = cur + k, *t = next + k, tmp;
+            int cls = dfa->classes[(unsigned char) g->text[i]];
+
+            t->nruns = 0;
+            for (int j=0; j < r->nruns; j++) {
+                int s = dfa->trans[r->state[j] * dfa->nclasses + cls];
+                if (s >= 0)
+                    augcc_runs_add(t, stamp + 1, s, r->ambig[j], r->from[j]);
+            }
+            tmp = *r; *r = *t; *t = tmp;
+        }
+        /* Nothing starts runs of children before LO anymore */
+        while (lo <= hi && cur[lo].nruns == 0)
+            lo += 1;
+        if (lo > hi)
+            return -1;
+    }
+
+    if (hi < n - 1)
+        return -1;
+    for (int j=0; j < cur[n-1].nruns; j++) {
+        if (! dfas[n-1]->accept[cur[n-1].state[j]])
+            continue;
+        if (found >= 0 || cur[n-1].ambig[j])
+            return -1;
+        found = cur[n-1].from[j];
+    }
+    if (found < 0)
+        return -1;
+    split[0] = start;
+    split[n] = end;
+    for (int k = n - 2; k >= 0; k--) {
+        split[k + 1] = start + found - k * len;
+        found = from[found];
+    }
+    return 0;
+}
+
+/* Return true if the first and the last child of the L_CONCAT in a
+ * L_SQUARE, which matched TEXT[S1..E1) and TEXT[S2..E2), match the same
+ * string, ignoring case if NOCASE is true */
+static inline bool augcc_square(struct augcc_get *g, bool nocase,
+                                unsigned int s1, unsigned int e1,
+                                unsigned int s2, unsigned int e2) {
+    if (e1 - s1 != e2 - s2)
+        return false;
+    if (nocase)
+        return strncasecmp(g->text + s1, g->text + s2, e1 - s1) == 0;
+    return memcmp(g->text + s1, g->text + s2, e1 - s1) == 0;
+}
+
+static inline int augcc_open(struct augcc_get *g, unsigned int node) {
+    return (g->ops->open == NULL) ? 0 : g->ops->open(g->data, node);
+}
+
+static inline int augcc_close(struct augcc_get *g, unsigned int node) {
+    return (g->ops->close == NULL) ? 0 : g->ops->close(g->data, node);
+}
+
+static inline int augcc_del(struct augcc_get *g, unsigned int node,
+                            unsigned int start, unsigned int end) {
+    return (g->ops->del == NULL) ? 0 : g->ops->del(g->data, node, start, end);
+}
+
+static inline bool augcc_expired(struct augcc_get *g) {
+    return g->ops->expired != NULL && g->ops->expired(g->data);
+}
+
+#endif
+
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
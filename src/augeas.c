@@ -27,12 +27,15 @@
 #include "syntax.h"
 #include "transform.h"
 #include "errcode.h"
+#include "plugin.h"
 
 #include <fnmatch.h>
 #include <argz.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdarg.h>
 #include <locale.h>
+#include <unistd.h>
 
 /* Some popular labels that we use in /augeas */
 static const char *const s_augeas = "augeas";
@@ -82,7 +85,8 @@ static const char *const errcodes[] = {
     "Invalid argument in function call",                /* AUG_EBADARG */
     "Invalid label",                                    /* AUG_ELABEL */
     "Cannot copy node into its descendant",             /* AUG_ECPDESC */
-    "Cannot access file"                                /* AUG_EFILEACCESS */
+    "Cannot access file",                               /* AUG_EFILEACCESS */
+    "Parse error"                                       /* AUG_EPARSE */
 };
 
 static void tree_mark_dirty(struct tree *tree) {
@@ -224,9 +228,11 @@ void tree_store_value(struct tree *tree, char **value) {
         return;
     }
     if (tree->value != NULL) {
-        free(tree->value);
+        if (! tree->slab_value)
+            free(tree->value);
         tree->value = NULL;
     }
+    tree->slab_value = false;
     if (*value != NULL) {
         tree->value = *value;
         *value = NULL;
@@ -282,6 +288,60 @@ static void store_pathx_error(const struct augeas *aug) {
                 2, s_pos, aug->error->details);
 }
 
+/* Return true if PATH can only ever match nodes underneath /files. We
+ * err on the side of caution, and only accept absolute paths starting
+ * with /files that do not contain anything that could lead outside of
+ * that subtree, like variables, unions, axes, '..', or absolute paths in
+ * predicates. Inside a predicate, a '/' that follows whitespace, as in
+ * [a and /augeas], or a multiplication sign '*' is taken to start an
+ * absolute path */
+static bool path_within_files(const char *path) {
+    const size_t len = strlen(AUGEAS_FILES_TREE);
+    const char *last = NULL;
+    int depth = 0;
+
+    if (path == NULL || STRNEQLEN(path, AUGEAS_FILES_TREE, len))
+        return false;
+    if (path[len] != '\0' && path[len] != '/' && path[len] != '[')
+        return false;
+    if (strstr(path, "..") != NULL || strstr(path, "::") != NULL
+        || strpbrk(path, "$|") != NULL)
+        return false;
+    for (const char *p = path + len; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            last = ++p;
+            continue;
+        }
+        if (*p == '"' || *p == '\'') {
+            /* Skip string literals */
+            p = strchr(p + 1, *p);
+            if (p == NULL)
+                return false;
+            last = p;
+            continue;
+        }
+        if (isspace(*p))
+            continue;
+        if (*p == '[')
+            depth += 1;
+        else if (*p == ']')
+            depth -= 1;
+        else if (*p == '/') {
+            if (last != NULL && strchr("[(,=<>!+-", *last) != NULL)
+                return false;
+            if (depth > 0 && (isspace(p[-1]) || *last == '*'))
+                return false;
+        }
+        last = p;
+    }
+    return true;
+}
+
+void diagnose_deferred_errors(const struct augeas *aug, const char *path) {
+    if (aug->deferred_errors > 0 && ! path_within_files(path))
+        transform_diagnose((struct augeas *) aug);
+}
+
 struct pathx *pathx_aug_parse(const struct augeas *aug,
                               struct tree *tree,
                               struct tree *root_ctx,
@@ -549,6 +609,20 @@ static void init_save_mode(struct augeas *aug) {
     aug_set(aug, AUGEAS_META_SAVE_MODE, v);
 }
 
+/* Look up the env var NAME unless we run setuid or setgid. The lens
+ * plugins are native code, and the cache holds trees that are read back
+ * in and that may contain the contents of privileged files; a setuid or
+ * setgid program must not take either from whoever runs it */
+static const char *secure_env(const char *name) {
+#if HAVE_SECURE_GETENV
+    return secure_getenv(name);
+#else
+    if (getuid() != geteuid() || getgid() != getegid())
+        return NULL;
+    return getenv(name);
+#endif
+}
+
 struct augeas *aug_init(const char *root, const char *loadpath,
                         unsigned int flags) {
     struct augeas *result;
@@ -615,6 +689,16 @@ struct augeas *aug_init(const char *root, const char *loadpath,
     aug_set(result, AUGEAS_SPAN_OPTION, v);
     ERR_BAIL(result);
 
+    const char *cache = secure_env(AUGEAS_CACHE_ENV);
+    if (cache != NULL && cache[0] != '\0') {
+        aug_set(result, AUGEAS_CACHE_OPTION, cache);
+        ERR_BAIL(result);
+    }
+
+    const char *plugins = secure_env(AUGEAS_PLUGINS_ENV);
+    if (plugins != NULL && plugins[0] != '\0')
+        result->plugins = load_lens_plugins(plugins);
+
     if (interpreter_init(result) == -1)
         goto error;
 
@@ -649,9 +733,17 @@ static void free_tree_node(struct tree *tree) {
 
     if (tree->span != NULL)
         free_span(tree->span);
-    free(tree->label);
-    free(tree->value);
-    free(tree);
+    if (! tree->slab_label)
+        free(tree->label);
+    if (! tree->slab_value)
+        free(tree->value);
+    if (tree->slab != NULL) {
+        /* TREE itself is in the slab, and might be gone after this */
+        struct tree_slab *slab = tree->slab;
+        unref(slab, tree_slab);
+    } else {
+        free(tree);
+    }
 }
 
 /* Only unlink; assume we know TREE is not in the symtab */
@@ -819,6 +911,7 @@ int aug_get(const struct augeas *aug, const char *path, const char **value) {
         *value = NULL;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, path);
 
     p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
     ERR_BAIL(aug);
@@ -846,6 +939,7 @@ int aug_label(const struct augeas *aug, const char *path, const char **label) {
     int r;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, path);
 
     p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
     ERR_BAIL(aug);
@@ -891,6 +985,7 @@ int aug_defvar(augeas *aug, const char *name, const char *expr) {
     int result = -1;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, expr);
 
     if (expr == NULL) {
         result = pathx_symtab_undefine(&(aug->symtab), name);
@@ -917,6 +1012,7 @@ int aug_defnode(augeas *aug, const char *name, const char *expr,
     struct tree *tree;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, expr);
 
     if (expr == NULL)
         goto error;
@@ -977,6 +1073,7 @@ int aug_set(struct augeas *aug, const char *path, const char *value) {
     int result = -1;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, path);
 
     /* Get-out clause, in case context is broken */
     struct tree *root_ctx = NULL;
@@ -1000,6 +1097,8 @@ int aug_setm(struct augeas *aug, const char *base,
     int result, r;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, base);
+    diagnose_deferred_errors(aug, sub);
 
     bx = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), base, true);
     ERR_BAIL(aug);
@@ -1080,6 +1179,7 @@ int aug_insert(struct augeas *aug, const char *path, const char *label,
     int result = -1;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, path);
 
     p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
     ERR_BAIL(aug);
@@ -1110,6 +1210,79 @@ struct tree *make_tree(char *label, char *value, struct tree *parent,
     return tree;
 }
 
+struct tree_slab *make_tree_slab(void) {
+    struct tree_slab *slab = NULL;
+
+    if (make_ref(slab) < 0)
+        return NULL;
+    slab->arena = make_arena();
+    if (slab->arena == NULL) {
+        free(slab);
+        return NULL;
+    }
+    return slab;
+}
+
+void free_tree_slab(struct tree_slab *slab) {
+    if (slab == NULL)
+        return;
+    assert(slab->ref == 0);
+    free_arena(slab->arena);
+    free(slab);
+}
+
+char *tree_slab_strndup(struct tree_slab *slab, const char *str, size_t len) {
+    char *s = NULL;
+
+    if (ARENA_ALLOC_N(slab->arena, s, len + 1) < 0)
+        return NULL;
+    memcpy(s, str, len);
+    s[len] = '\0';
+    return s;
+}
+
+struct tree *make_tree_in(struct tree_slab *slab, char *label, char *value,
+                          struct tree *parent, struct tree *children) {
+    struct tree *tree;
+    if (ARENA_ALLOC(slab->arena, tree) < 0)
+        return NULL;
+
+    tree->slab = ref(slab);
+    tree->label = label;
+    tree->slab_label = (label != NULL);
+    tree->value = value;
+    tree->slab_value = (value != NULL);
+    tree->parent = parent;
+    tree->children = children;
+    list_for_each(c, tree->children)
+        c->parent = tree;
+    if (parent != NULL)
+        tree_mark_dirty(tree);
+    else
+        tree->dirty = 1;
+    return tree;
+}
+
+/* Copy *STR out of the slab if *IN_SLAB is set */
+static int unslab_string(char **str, bool *in_slab) {
+    if (*in_slab && *str != NULL) {
+        char *s = strdup(*str);
+        if (s == NULL)
+            return -1;
+        *str = s;
+    }
+    *in_slab = false;
+    return 0;
+}
+
+int tree_unslab_label(struct tree *tree) {
+    return unslab_string(&tree->label, &tree->slab_label);
+}
+
+int tree_unslab_value(struct tree *tree) {
+    return unslab_string(&tree->value, &tree->slab_value);
+}
+
 struct tree *make_tree_origin(struct tree *root) {
     struct tree *origin = NULL;
 
@@ -1194,6 +1367,7 @@ int aug_rm(struct augeas *aug, const char *path) {
     int result = -1;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, path);
 
     p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
     ERR_BAIL(aug);
@@ -1215,6 +1389,7 @@ int aug_span(struct augeas *aug, const char *path, char **filename,
     struct span *span;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, path);
 
     p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
     ERR_BAIL(aug);
@@ -1269,6 +1444,8 @@ int aug_mv(struct augeas *aug, const char *src, const char *dst) {
     int r, ret;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, src);
+    diagnose_deferred_errors(aug, dst);
 
     ret = -1;
     s = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), src, true);
@@ -1293,14 +1470,21 @@ int aug_mv(struct augeas *aug, const char *src, const char *dst) {
         t = t->parent;
     } while (t != aug->origin);
 
+    /* The value moves to another node, which might not keep the slab
+     * of TS alive */
+    r = tree_unslab_value(ts);
+    ERR_NOMEM(r < 0, aug);
+
     free_tree(td->children);
 
     td->children = ts->children;
     list_for_each(c, td->children) {
         c->parent = td;
     }
-    free(td->value);
+    if (! td->slab_value)
+        free(td->value);
     td->value = ts->value;
+    td->slab_value = false;
 
     ts->value = NULL;
     ts->children = NULL;
@@ -1333,6 +1517,8 @@ int aug_cp(struct augeas *aug, const char *src, const char *dst) {
     int r, ret;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, src);
+    diagnose_deferred_errors(aug, dst);
 
     ret = -1;
     s = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), src, true);
@@ -1378,6 +1564,7 @@ int aug_rename(struct augeas *aug, const char *src, const char *lbl) {
     int count = 0;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, src);
 
     ret = -1;
     ERR_THROW(strchr(lbl, '/') != NULL, aug, AUG_ELABEL,
@@ -1387,8 +1574,10 @@ int aug_rename(struct augeas *aug, const char *src, const char *lbl) {
     ERR_BAIL(aug);
 
     for (ts = pathx_first(s); ts != NULL; ts = pathx_next(s)) {
-        free(ts->label);
+        if (! ts->slab_label)
+            free(ts->label);
         ts->label = strdup(lbl);
+        ts->slab_label = false;
         tree_mark_dirty(ts);
         count ++;
     }
@@ -1408,6 +1597,7 @@ int aug_match(const struct augeas *aug, const char *pathin, char ***matches) {
     int cnt = 0;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, pathin);
 
     if (matches != NULL)
         *matches = NULL;
@@ -1486,12 +1676,11 @@ static int check_save_dup(struct augeas *aug, const char *path,
 static int tree_save(struct augeas *aug, struct tree *tree,
                      const char *path) {
     int result = 0;
-    struct tree *meta = tree_child_cr(aug->origin, s_augeas);
-    struct tree *load = tree_child_cr(meta, s_load);
+    struct xfm_cache *cache = aug->xfm_cache;
 
     // FIXME: We need to detect subtrees that aren't saved by anything
 
-    if (load == NULL)
+    if (cache == NULL)
         return -1;
 
     list_for_each(t, tree) {
@@ -1505,12 +1694,20 @@ static int tree_save(struct augeas *aug, struct tree *tree,
                 continue;
             }
             if ( t->dirty ) {
-                list_for_each(xfm, load->children) {
-                    if (transform_applies(xfm, tpath)) {
-                        if (transform == NULL || transform == xfm) {
-                            transform = xfm;
+                /* PATH is always underneath AUGEAS_FILES_TREE */
+                int ncands = xfm_cache_candidates(cache,
+                                    tpath + strlen(AUGEAS_FILES_TREE));
+                if (ncands < 0)
+                    result = -1;
+                for (int i=0; i < ncands; i++) {
+                    struct xfm_filter *f =
+                        cache->filters + cache->candidates[i];
+                    if (transform_applies(f, tpath)) {
+                        if (transform == NULL || transform == f->xfm) {
+                            transform = f->xfm;
                         } else {
-                            result = check_save_dup(aug, tpath, transform, xfm);
+                            result = check_save_dup(aug, tpath, transform,
+                                                    f->xfm);
                         }
                     }
                 }
@@ -1617,6 +1814,9 @@ int aug_save(struct augeas *aug) {
     list_for_each(xfm, load->children)
         transform_validate(aug, xfm);
 
+    if (xfm_cache_update(aug, load) < 0)
+        goto error;
+
     if (tree_save(aug, files->children, AUGEAS_FILES_TREE) == -1)
         ret = -1;
 
@@ -1752,6 +1952,22 @@ int aug_text_store(augeas *aug, const char *lens, const char *node,
     return result;
 }
 
+int aug_text_stream(augeas *aug, const char *lens, const char *text,
+                    const struct aug_text_callbacks *cb) {
+    int result = -1;
+
+    api_entry(aug);
+
+    ARG_CHECK(lens == NULL, aug, "aug_text_stream: LENS must not be NULL");
+    ARG_CHECK(text == NULL, aug, "aug_text_stream: TEXT must not be NULL");
+    ARG_CHECK(cb == NULL, aug, "aug_text_stream: CB must not be NULL");
+
+    result = text_stream(aug, lens, text, cb);
+ error:
+    api_exit(aug);
+    return result;
+}
+
 int aug_text_retrieve(struct augeas *aug, const char *lens,
                       const char *node_in, const char *path,
                       const char *node_out) {
@@ -1877,9 +2093,17 @@ int aug_load_file(struct augeas *aug, const char *file) {
 
     ERR_NOMEM(load == NULL, aug);
 
-    list_for_each(xfm, load->children)  {
-        if (filter_matches(xfm, file)) {
-            transform_load(aug, xfm, file);
+    if (xfm_cache_update(aug, load) < 0)
+        goto error;
+
+    r = xfm_cache_candidates(aug->xfm_cache, file);
+    ERR_NOMEM(r < 0, aug);
+
+    for (int i=0; i < r; i++) {
+        struct xfm_cache *cache = aug->xfm_cache;
+        struct xfm_filter *f = cache->filters + cache->candidates[i];
+        if (xfm_filter_matches(f, file)) {
+            transform_load(aug, f->xfm, file);
             found = true;
             break;
         }
@@ -1910,6 +2134,7 @@ int aug_print(const struct augeas *aug, FILE *out, const char *pathin) {
     int result = -1;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, pathin);
 
     if (pathin == NULL || strlen(pathin) == 0) {
         pathin = "/*";
@@ -1953,6 +2178,7 @@ int aug_source(const augeas *aug, const char *path, char **file_path) {
     struct tree *match;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, path);
 
     ARG_CHECK(file_path == NULL, aug,
               "aug_source_file: FILE_PATH must not be NULL");
@@ -1992,6 +2218,7 @@ int aug_preview(struct augeas *aug, const char *path, char **out) {
     *out = NULL;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, path);
 
     p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
     ERR_BAIL(aug);
@@ -2052,9 +2279,12 @@ void aug_close(struct augeas *aug) {
     free((void *) aug->root);
     free(aug->modpathz);
     free_symtab(aug->symtab);
+    free_xfm_cache(aug->xfm_cache);
     unref(aug->error->info, info);
     free(aug->error->details);
     free(aug->error);
+    /* Only now are all the lenses that might use a plugin gone */
+    free_lens_plugins(aug->plugins);
     free(aug);
 }
 
@@ -2065,6 +2295,14 @@ int __aug_load_module_file(struct augeas *aug, const char *filename) {
     return r;
 }
 
+int __aug_write_lens_plugin(struct augeas *aug, FILE *out,
+                            int nlenses, char *const *lenses) {
+    api_entry(aug);
+    int r = lens_plugin_write(aug, out, nlenses, lenses);
+    api_exit(aug);
+    return r;
+}
+
 int tree_equal(const struct tree *t1, const struct tree *t2) {
     while (t1 != NULL && t2 != NULL) {
         if (!streqv(t1->label, t2->label))
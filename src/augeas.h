@@ -52,7 +52,17 @@ enum aug_flags {
     AUG_ENABLE_SPAN  = (1 << 7),  /* Track the span in the input of nodes */
     AUG_NO_ERR_CLOSE = (1 << 8),  /* Do not close automatically when
                                      encountering error during aug_init */
-    AUG_TRACE_MODULE_LOADING = (1 << 9) /* For use by augparse -t */
+    AUG_TRACE_MODULE_LOADING = (1 << 9), /* For use by augparse -t */
+    AUG_DEFER_ERRORS = (1 << 10), /* When files fail to load, only record
+                                     where; the full error under
+                                     /augeas/files is worked out once it
+                                     might be looked at */
+    AUG_PREPARE_RECURSIVE = (1 << 11), /* Build the parsers for recursive
+                                          lenses when modules are loaded,
+                                          rather than on first use */
+    AUG_PARALLEL_LOAD = (1 << 12) /* Get big files that consist of one
+                                     record per line in chunks on
+                                     several threads */
 };
 
 #ifdef __cplusplus
@@ -371,6 +381,44 @@ int aug_text_retrieve(struct augeas *aug, const char *lens,
                       const char *node_in, const char *path,
                       const char *node_out);
 
+/* Callbacks for aug_text_stream. Any of them can be NULL. LABEL and VALUE
+ * are only valid for the duration of the call. Returning a non-zero value
+ * from a callback stops processing of the text.
+ */
+struct aug_text_callbacks {
+    /* A node with children starts; its children follow */
+    int (*enter)(void *data, const char *label, const char *value);
+    /* A node without children */
+    int (*leaf)(void *data, const char *label, const char *value);
+    /* The node from the last unmatched ENTER ends. VALUE is the final
+     * value of the node, which differs from the one passed to ENTER if the
+     * node's value comes after its first child in the text */
+    int (*exit)(void *data, const char *label, const char *value);
+    void *data;
+};
+
+/* Function: aug_text_stream
+ *
+ * Transform TEXT into a tree using the lens LENS, but rather than storing
+ * the tree, report its nodes in document order through the callbacks in
+ * CB, passing CB->DATA to each of them. Nodes are reported as soon as
+ * they are complete, without building the whole tree, so that memory use
+ * depends on how deeply the tree is nested, not on the size of TEXT.
+ * Recursive lenses are the exception, for them the whole tree is built
+ * before any callbacks are made.
+ *
+ * Since callbacks are made while TEXT is being parsed, they might have
+ * been made for some of TEXT even if it turns out that TEXT can not be
+ * parsed by LENS.
+ *
+ * Returns:
+ * 0 if all of TEXT was processed, 1 if a callback stopped processing
+ * early, and -1 on failure. If TEXT can not be parsed with LENS, the error
+ * code is AUG_EPARSE
+ */
+int aug_text_stream(augeas *aug, const char *lens, const char *text,
+                    const struct aug_text_callbacks *cb);
+
 /* Function: aug_escape_name
  *
  * Escape special characters in a string such that it can be used as part
@@ -600,7 +648,8 @@ typedef enum {
     AUG_EBADARG,        /* Invalid argument in function call */
     AUG_ELABEL,         /* Invalid label */
     AUG_ECPDESC,        /* Cannot copy node into its descendant */
-    AUG_EFILEACCESS     /* Cannot open or read a file */
+    AUG_EFILEACCESS,    /* Cannot open or read a file */
+    AUG_EPARSE          /* Text can not be parsed with the lens */
 } aug_errcode_t;
 
 /* Return the error code from the last API call */
@@ -206,7 +206,7 @@ static struct value *lens_get(struct info *info, struct value **argv) {
     struct value *v;
     const char *text = str->string->str;
 
-    struct tree *tree = lns_get(info, l->lens, text, 0, &err);
+    struct tree *tree = lns_get(info, l->lens, text, 0, 0, 0, 0, &err);
     if (err == NULL && ! HAS_ERR(info)) {
         v = make_value(V_TREE, ref(info));
         v->origin = make_tree_origin(tree);
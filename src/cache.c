@@ -0,0 +1,498 @@
+/*
+ * cache.c: persistent cache of parsed trees
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "internal.h"
+#include "memory.h"
+#include "info.h"
+#include "lens.h"
+#include "cache.h"
+
+/* Cache files start with this, followed by the key and the tree. All
+ * numbers are stored as uint64_t in native byte order, and strings as
+ * their length followed by their characters, without a terminating
+ * NUL. NULL strings have length NULL_LEN.
+ *
+ * Trees are stored as the number of siblings, followed by the label,
+ * value and children of each sibling.
+ */
+#define CACHE_MAGIC "AUGTREE2"
+#define CACHE_EXT   ".tree"
+#define NULL_LEN    UINT64_MAX
+
+/* Everything that needs to be the same for a cache entry to be current */
+struct cache_key {
+    const char *filename;
+    const char *lens_name;
+    char       *lens_info;
+    uint64_t    size;
+    uint64_t    mtime;
+    uint64_t    ino;
+    uint64_t    dev;
+    uint64_t    hash;
+    uint64_t    lens_fingerprint;
+    uint64_t    modules;
+};
+
+/* The contents of a cache file while we read it */
+struct cache_buf {
+    char   *data;
+    size_t  size;
+    size_t  pos;
+};
+
+/* 64 bit FNV-1a hash */
+static uint64_t cache_hash(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+
+    for (size_t i=0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static const char *cache_dir(struct augeas *aug) {
+    struct tree *dir = tree_fpath(aug, AUGEAS_CACHE_OPTION);
+
+    if (dir == NULL || dir->value == NULL || dir->value[0] == '\0')
+        return NULL;
+    return dir->value;
+}
+
+static char *cache_file(const char *dir, const char *filename) {
+    char *result = NULL;
+    uint64_t h = cache_hash(filename, strlen(filename));
+
+    if (xasprintf(&result, "%s/%016" PRIx64 CACHE_EXT, dir, h) < 0)
+        return NULL;
+    return result;
+}
+
+/* The module files that the lenses and regexps in a lens come from */
+struct cache_modules {
+    struct string **files;
+    size_t          nfiles;
+    size_t          size;
+};
+
+static int modules_add_info(struct cache_modules *mods, struct info *info) {
+    if (info == NULL || info->filename == NULL)
+        return 0;
+    for (size_t i=0; i < mods->nfiles; i++)
+        if (mods->files[i] == info->filename
+            || STREQ(mods->files[i]->str, info->filename->str))
+            return 0;
+    if (mods->nfiles == mods->size) {
+        size_t size = (mods->size == 0) ? 8 : 2 * mods->size;
+        if (REALLOC_N(mods->files, size) < 0)
+            return -1;
+        mods->size = size;
+    }
+    mods->files[mods->nfiles++] = info->filename;
+    return 0;
+}
+
+static int modules_add_regexp(struct cache_modules *mods, struct regexp *r) {
+    return (r == NULL) ? 0 : modules_add_info(mods, r->info);
+}
+
+static int modules_add(struct cache_modules *mods, struct lens *lens) {
+    if (modules_add_info(mods, lens->info) < 0)
+        return -1;
+    switch (lens->tag) {
+    case L_DEL:
+    case L_STORE:
+    case L_KEY:
+        return modules_add_regexp(mods, lens->regexp);
+    case L_SUBTREE:
+    case L_STAR:
+    case L_MAYBE:
+    case L_SQUARE:
+        return modules_add(mods, lens->child);
+    case L_CONCAT:
+    case L_UNION:
+        for (int i=0; i < lens->nchildren; i++)
+            if (modules_add(mods, lens->children[i]) < 0)
+                return -1;
+        return 0;
+    case L_REC:
+        return lens->rec_internal ? 0 : modules_add(mods, lens->body);
+    default:
+        return 0;
+    }
+}
+
+/* Hash the name, size and mtime of every module that LENS is built from,
+ * so that changing any of them, not just the one defining LENS,
+ * invalidates cache entries made with LENS. Return -1 if we run out of
+ * memory */
+static int cache_modules_hash(struct lens *lens, uint64_t *hash) {
+    struct cache_modules mods;
+    uint64_t h[3];
+
+    MEMZERO(&mods, 1);
+    if (modules_add(&mods, lens) < 0) {
+        free(mods.files);
+        return -1;
+    }
+    *hash = 0;
+    for (size_t i=0; i < mods.nfiles; i++) {
+        struct stat st;
+        const char *fname = mods.files[i]->str;
+
+        MEMZERO(h, 3);
+        h[0] = cache_hash(fname, strlen(fname));
+        if (stat(fname, &st) == 0) {
+            h[1] = st.st_size;
+            h[2] = st.st_mtime;
+        }
+        *hash = *hash * 31 + cache_hash((const char *) h, sizeof(h));
+    }
+    free(mods.files);
+    return 0;
+}
+
+static int cache_key_init(struct cache_key *key, struct lens *lens,
+                          const char *lens_name, const char *filename,
+                          const char *text, size_t text_len) {
+    struct stat st;
+
+    MEMZERO(key, 1);
+    if (lens_name == NULL || stat(filename, &st) < 0)
+        return -1;
+
+    key->filename = filename;
+    key->lens_name = lens_name;
+    key->size = st.st_size;
+    key->mtime = st.st_mtime;
+    key->ino = st.st_ino;
+    key->dev = st.st_dev;
+    key->hash = cache_hash(text, text_len);
+
+    key->lens_info = format_info(lens->info);
+    if (key->lens_info == NULL)
+        return -1;
+    key->lens_fingerprint = lns_fingerprint(lens);
+    return cache_modules_hash(lens, &key->modules);
+}
+
+/*
+ * Writing cache files
+ */
+static int write_u64(FILE *fp, uint64_t v) {
+    return (fwrite(&v, sizeof(v), 1, fp) == 1) ? 0 : -1;
+}
+
+static int write_str(FILE *fp, const char *s) {
+    size_t len;
+
+    if (s == NULL)
+        return write_u64(fp, NULL_LEN);
+    len = strlen(s);
+    if (write_u64(fp, len) < 0)
+        return -1;
+    return (fwrite(s, 1, len, fp) == len) ? 0 : -1;
+}
+
+static int write_key(FILE *fp, struct cache_key *key) {
+    if (fwrite(CACHE_MAGIC, 1, strlen(CACHE_MAGIC), fp) != strlen(CACHE_MAGIC))
+        return -1;
+    if (write_str(fp, PACKAGE_VERSION) < 0
+        || write_str(fp, key->filename) < 0
+        || write_str(fp, key->lens_name) < 0
+        || write_str(fp, key->lens_info) < 0)
+        return -1;
+    if (write_u64(fp, key->size) < 0
+        || write_u64(fp, key->mtime) < 0
+        || write_u64(fp, key->ino) < 0
+        || write_u64(fp, key->dev) < 0
+        || write_u64(fp, key->hash) < 0
+        || write_u64(fp, key->lens_fingerprint) < 0
+        || write_u64(fp, key->modules) < 0)
+        return -1;
+    return 0;
+}
+
+static int write_tree(FILE *fp, struct tree *tree) {
+    uint64_t count = 0;
+
+    list_for_each(t, tree)
+        count += 1;
+    if (write_u64(fp, count) < 0)
+        return -1;
+    list_for_each(t, tree) {
+        if (write_str(fp, t->label) < 0
+            || write_str(fp, t->value) < 0
+            || write_tree(fp, t->children) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reading cache files
+ */
+static int read_u64(struct cache_buf *buf, uint64_t *v) {
+    if (buf->size - buf->pos < sizeof(*v))
+        return -1;
+    memcpy(v, buf->data + buf->pos, sizeof(*v));
+    buf->pos += sizeof(*v);
+    return 0;
+}
+
+/* Read a string into *S; return -1 if the file is truncated or we run
+ * out of memory */
+static int read_str(struct cache_buf *buf, char **s) {
+    uint64_t len;
+
+    *s = NULL;
+    if (read_u64(buf, &len) < 0)
+        return -1;
+    if (len == NULL_LEN)
+        return 0;
+    if (buf->size - buf->pos < len)
+        return -1;
+    *s = strndup(buf->data + buf->pos, len);
+    if (*s == NULL)
+        return -1;
+    buf->pos += len;
+    return 0;
+}
+
+/* Return 1 if the next string in BUF is S, 0 if it is not, and -1 if the
+ * file is truncated */
+static int match_str(struct cache_buf *buf, const char *s) {
+    uint64_t len;
+
+    if (read_u64(buf, &len) < 0)
+        return -1;
+    if (len == NULL_LEN)
+        return s == NULL;
+    if (buf->size - buf->pos < len)
+        return -1;
+    buf->pos += len;
+    return s != NULL && strlen(s) == len
+        && memcmp(buf->data + buf->pos - len, s, len) == 0;
+}
+
+static int match_u64(struct cache_buf *buf, uint64_t v) {
+    uint64_t w;
+
+    if (read_u64(buf, &w) < 0)
+        return -1;
+    return v == w;
+}
+
+/* Return 1 if BUF starts with KEY, 0 otherwise */
+static int match_key(struct cache_buf *buf, struct cache_key *key) {
+    size_t len = strlen(CACHE_MAGIC);
+
+    if (buf->size < len || memcmp(buf->data, CACHE_MAGIC, len) != 0)
+        return 0;
+    buf->pos = len;
+
+    return match_str(buf, PACKAGE_VERSION) == 1
+        && match_str(buf, key->filename) == 1
+        && match_str(buf, key->lens_name) == 1
+        && match_str(buf, key->lens_info) == 1
+        && match_u64(buf, key->size) == 1
+        && match_u64(buf, key->mtime) == 1
+        && match_u64(buf, key->ino) == 1
+        && match_u64(buf, key->dev) == 1
+        && match_u64(buf, key->hash) == 1
+        && match_u64(buf, key->lens_fingerprint) == 1
+        && match_u64(buf, key->modules) == 1;
+}
+
+static int read_tree(struct cache_buf *buf, struct tree **tree);
+
+static struct tree *read_node(struct cache_buf *buf) {
+    char *label = NULL, *value = NULL;
+    struct tree *children = NULL, *result = NULL;
+
+    if (read_str(buf, &label) < 0
+        || read_str(buf, &value) < 0
+        || read_tree(buf, &children) < 0)
+        goto error;
+    result = make_tree(label, value, NULL, children);
+    if (result == NULL)
+        goto error;
+    return result;
+ error:
+    free(label);
+    free(value);
+    free_tree(children);
+    return NULL;
+}
+
+static int read_tree(struct cache_buf *buf, struct tree **tree) {
+    uint64_t count;
+
+    *tree = NULL;
+    if (read_u64(buf, &count) < 0)
+        return -1;
+    /* Each node takes up at least three numbers */
+    if (count > (buf->size - buf->pos) / (3 * sizeof(uint64_t)))
+        return -1;
+
+    for (uint64_t i=0; i < count; i++) {
+        struct tree *t = read_node(buf);
+        if (t == NULL) {
+            free_tree(*tree);
+            *tree = NULL;
+            return -1;
+        }
+        list_append(*tree, t);
+    }
+    return 0;
+}
+
+static int read_cache_file(const char *fname, struct cache_buf *buf) {
+    struct stat st;
+    FILE *fp = NULL;
+    int result = -1;
+
+    MEMZERO(buf, 1);
+    fp = fopen(fname, "r");
+    if (fp == NULL)
+        return -1;
+    if (fstat(fileno(fp), &st) < 0 || st.st_size <= 0)
+        goto done;
+    if (ALLOC_N(buf->data, st.st_size) < 0)
+        goto done;
+    buf->size = st.st_size;
+    if (fread(buf->data, 1, buf->size, fp) != buf->size) {
+        FREE(buf->data);
+        goto done;
+    }
+    result = 0;
+ done:
+    fclose(fp);
+    return result;
+}
+
+int tree_cache_lookup(struct augeas *aug, struct lens *lens,
+                      const char *lens_name, const char *filename,
+                      const char *text, size_t text_len,
+                      struct tree **tree) {
+    struct cache_key key;
+    struct cache_buf buf;
+    const char *dir = cache_dir(aug);
+    char *fname = NULL;
+    int result = 0;
+
+    *tree = NULL;
+    MEMZERO(&key, 1);
+    MEMZERO(&buf, 1);
+    if (dir == NULL || (aug->flags & AUG_ENABLE_SPAN))
+        return 0;
+
+    if (cache_key_init(&key, lens, lens_name, filename, text, text_len) < 0)
+        goto done;
+    fname = cache_file(dir, filename);
+    if (fname == NULL)
+        goto done;
+    if (read_cache_file(fname, &buf) < 0)
+        goto done;
+    if (! match_key(&buf, &key))
+        goto done;
+    if (read_tree(&buf, tree) < 0)
+        goto done;
+    if (buf.pos != buf.size) {
+        free_tree(*tree);
+        *tree = NULL;
+        goto done;
+    }
+    result = 1;
+ done:
+    free(key.lens_info);
+    free(buf.data);
+    free(fname);
+    return result;
+}
+
+void tree_cache_store(struct augeas *aug, struct lens *lens,
+                      const char *lens_name, const char *filename,
+                      const char *text, size_t text_len,
+                      struct tree *file) {
+    struct cache_key key;
+    const char *dir = cache_dir(aug);
+    char *fname = NULL, *tmp = NULL;
+    FILE *fp = NULL;
+    int fd, r;
+
+    MEMZERO(&key, 1);
+    if (dir == NULL || file == NULL)
+        return;
+
+    if (cache_key_init(&key, lens, lens_name, filename, text, text_len) < 0)
+        goto done;
+    fname = cache_file(dir, filename);
+    if (fname == NULL)
+        goto done;
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+        goto done;
+
+    /* Write to a temporary file and rename it so that readers never see
+     * a partially written entry */
+    r = xasprintf(&tmp, "%s.XXXXXX", fname);
+    if (r < 0)
+        goto done;
+    fd = mkstemp(tmp);
+    if (fd < 0)
+        goto done;
+    fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        goto unlink;
+    }
+
+    r = write_key(fp, &key);
+    if (r == 0)
+        r = write_tree(fp, file->children);
+    if (fclose(fp) != 0)
+        r = -1;
+    if (r < 0)
+        goto unlink;
+    if (rename(tmp, fname) < 0)
+        goto unlink;
+    goto done;
+ unlink:
+    unlink(tmp);
+ done:
+    free(key.lens_info);
+    free(fname);
+    free(tmp);
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
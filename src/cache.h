@@ -0,0 +1,65 @@
+/*
+ * cache.h: persistent cache of parsed trees
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+/*
+ * When AUGEAS_CACHE_OPTION names a directory, the tree that a lens
+ * produces for a file is written into that directory after a successful
+ * load, and read back instead of running the lens the next time the same
+ * file is loaded with the same lens.
+ *
+ * A cache entry is only used if the file still has the same size, mtime,
+ * inode and content hash, and the lens has the same name, was defined in
+ * the same place, has the same structure, and none of the module files it
+ * is built from, including the ones it imports lenses and regexps from,
+ * have changed. Entries are never
+ * used when spans are enabled, since they do not record spans.
+ *
+ * The cache is purely an optimization: any problem reading or writing it
+ * makes us fall back to running the lens, and is not reported as an error.
+ */
+
+/* Look up the tree for FILENAME in the cache. TEXT is the contents of
+ * FILENAME. Return 1 and the tree in *TREE if there is a current entry
+ * for FILENAME and LENS, and 0 otherwise.
+ */
+int tree_cache_lookup(struct augeas *aug, struct lens *lens,
+                      const char *lens_name, const char *filename,
+                      const char *text, size_t text_len,
+                      struct tree **tree);
+
+/* Store the children of FILE, the tree for FILENAME that LENS produced
+ * from TEXT, in the cache.
+ */
+void tree_cache_store(struct augeas *aug, struct lens *lens,
+                      const char *lens_name, const char *filename,
+                      const char *text, size_t text_len,
+                      struct tree *file);
+#endif
+
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
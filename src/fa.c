@@ -959,7 +959,7 @@ static int mark_live(struct fa *fa) {
  * Returns a list of the new initial states of the automaton. The list must
  * be freed by the caller.
  */
-static struct state_set *fa_reverse(struct fa *fa) {
+static struct state_set *reverse(struct fa *fa) {
     struct state_set *all = NULL;
     struct state_set *accept = NULL;
     int r;
@@ -1300,13 +1300,18 @@ static void swap_initial(struct fa *fa) {
  * Make a finite automaton deterministic using the given set of initial
  * states with the subset construction. This also eliminates dead states
  * and transitions and reduces and orders the transitions for each state
+ *
+ * If MAX_STATES is not 0, give up and return -1 once the result would
+ * have more than that many states.
  */
-static int determinize(struct fa *fa, struct state_set *ini) {
+static int determinize(struct fa *fa, struct state_set *ini,
+                       unsigned int max_states) {
     int npoints;
     int make_ini = (ini == NULL);
     const uchar *points = NULL;
     state_set_hash *newstate = NULL;
     struct state_set_list *worklist = NULL;
+    unsigned int nstates = 1;
     int ret = 0;
 
     if (fa->deterministic)
@@ -1343,6 +1348,10 @@ static int determinize(struct fa *fa, struct state_set *ini) {
                 }
             }
             if (!state_set_hash_contains(newstate, pset)) {
+                if (max_states > 0 && ++nstates > max_states) {
+                    state_set_free(pset);
+                    goto error;
+                }
                 F(state_set_list_add(&worklist, pset));
                 F(state_set_hash_add(&newstate, pset, fa));
             }
@@ -1360,6 +1369,9 @@ static int determinize(struct fa *fa, struct state_set *ini) {
     fa->deterministic = 1;
 
  done:
+    /* The sets on the worklist are owned by NEWSTATE */
+    while (worklist != NULL)
+        state_set_list_pop(&worklist);
     if (newstate)
         state_set_hash_free(newstate, make_ini ? NULL : ini);
     free((void *) points);
@@ -1465,7 +1477,7 @@ static int minimize_hopcroft(struct fa *fa) {
     unsigned int nstates = 0;
     int nsigma = 0;
 
-    F(determinize(fa, NULL));
+    F(determinize(fa, NULL, 0));
 
     /* Total automaton, nothing to do */
     if (fa->initial->tused == 1
@@ -1754,14 +1766,14 @@ static int minimize_brzozowski(struct fa *fa) {
     struct state_set *set;
 
     /* Minimize using Brzozowski's algorithm */
-    set = fa_reverse(fa);
+    set = reverse(fa);
     E(set == NULL);
-    F(determinize(fa, set));
+    F(determinize(fa, set, 0));
     state_set_free(set);
 
-    set = fa_reverse(fa);
+    set = reverse(fa);
     E(set == NULL);
-    F(determinize(fa, set));
+    F(determinize(fa, set, 0));
     state_set_free(set);
     return 0;
  error:
@@ -2011,6 +2023,24 @@ static int concat_in_place(struct fa *fa1, struct fa **fa2) {
     return 0;
 }
 
+struct fa *fa_reverse(struct fa *fa, unsigned int max_states) {
+    struct fa *result = NULL;
+    struct state_set *ini = NULL;
+
+    result = fa_clone(fa);
+    E(result == NULL);
+
+    ini = reverse(result);
+    E(ini == NULL);
+    F(determinize(result, ini, max_states));
+    state_set_free(ini);
+    return result;
+ error:
+    state_set_free(ini);
+    fa_free(result);
+    return NULL;
+}
+
 struct fa *fa_concat(struct fa *fa1, struct fa *fa2) {
     fa1 = fa_clone(fa1);
     fa2 = fa_clone(fa2);
@@ -2314,7 +2344,7 @@ int fa_contains(struct fa *fa1, struct fa *fa2) {
     if (fa1 == fa2)
         return 1;
 
-    F(determinize(fa2, NULL));
+    F(determinize(fa2, NULL, 0));
     sort_transition_intervals(fa1);
     sort_transition_intervals(fa2);
 
@@ -2433,7 +2463,7 @@ static int totalize(struct fa *fa) {
 struct fa *fa_complement(struct fa *fa) {
     fa = fa_clone(fa);
     E(fa == NULL);
-    F(determinize(fa, NULL));
+    F(determinize(fa, NULL, 0));
     F(totalize(fa));
     list_for_each(s, fa->initial)
         s->accept = ! s->accept;
@@ -2497,20 +2527,20 @@ struct fa *fa_overlap(struct fa *fa1, struct fa *fa2) {
     if (fa1 == NULL || fa2 == NULL)
         goto error;
 
-    if (determinize(fa1, NULL) < 0)
+    if (determinize(fa1, NULL, 0) < 0)
         goto error;
     if (accept_to_accept(fa1) < 0)
         goto error;
 
-    map = fa_reverse(fa2);
+    map = reverse(fa2);
     state_set_free(map);
-    if (determinize(fa2, NULL) < 0)
+    if (determinize(fa2, NULL, 0) < 0)
         goto error;
     if (accept_to_accept(fa2) < 0)
         goto error;
-    map = fa_reverse(fa2);
+    map = reverse(fa2);
     state_set_free(map);
-    if (determinize(fa2, NULL) < 0)
+    if (determinize(fa2, NULL, 0) < 0)
         goto error;
 
     fa = fa_intersect(fa1, fa2);
@@ -3954,6 +3984,60 @@ static int re_as_string(const struct re *re, struct re_str *str) {
     return -1;
 }
 
+/* Compare transitions by (to, min, reverse max) like TRANS_TO_CMP, but
+ * order the states they go to by the number NUMBER_STATES put into their
+ * HASH rather than by their address */
+static int trans_to_index_cmp(const void *v1, const void *v2) {
+    const struct trans *t1 = v1;
+    const struct trans *t2 = v2;
+
+    if (t1->to->hash != t2->to->hash)
+        return (t1->to->hash < t2->to->hash) ? -1 : 1;
+    return trans_to_cmp(v1, v2);
+}
+
+/* Put the states of FA into the order in which a breadth-first search
+ * from the initial state, taking the transitions of each state in the
+ * order of their character ranges, reaches them, and store that number in
+ * the HASH of each state. Unlike the addresses of the states, that order
+ * is the same every time for the same DFA, and so is the regexp that
+ * FA_AS_REGEXP builds from it */
+static int number_states(struct fa *fa) {
+    struct state **order = NULL;
+    size_t nstates = 0, n = 0;
+
+    list_for_each(s, fa->initial) {
+        s->visited = 0;
+        nstates += 1;
+    }
+    if (ALLOC_N(order, nstates) < 0)
+        return -1;
+
+    order[n++] = fa->initial;
+    fa->initial->visited = 1;
+    for (size_t i = 0; i < n; i++) {
+        struct state *s = order[i];
+        qsort(s->trans, s->tused, sizeof(*s->trans), trans_intv_cmp);
+        for_each_trans(t, s) {
+            if (! t->to->visited) {
+                t->to->visited = 1;
+                order[n++] = t->to;
+            }
+        }
+    }
+    list_for_each(s, fa->initial) {
+        if (! s->visited)
+            order[n++] = s;
+    }
+
+    for (size_t i = 0; i < nstates; i++) {
+        order[i]->hash = i;
+        order[i]->next = (i + 1 < nstates) ? order[i + 1] : NULL;
+    }
+    free(order);
+    return 0;
+}
+
 static int convert_trans_to_re(struct state *s) {
     struct re *re = NULL;
     size_t nto = 1;
@@ -3963,7 +4047,7 @@ static int convert_trans_to_re(struct state *s) {
     if (s->tused == 0)
         return 0;
 
-    qsort(s->trans, s->tused, sizeof(*s->trans), trans_to_cmp);
+    qsort(s->trans, s->tused, sizeof(*s->trans), trans_to_index_cmp);
     for (int i = 0; i < s->tused - 1; i++) {
         if (s->trans[i].to != s->trans[i+1].to)
             nto += 1;
@@ -4200,6 +4284,17 @@ int fa_as_regexp(struct fa *fa, char **regexp, size_t *regexp_len) {
     if (fa == NULL)
         goto error;
 
+    /* Only the minimal DFA is the same every time; minimize_hopcroft can
+     * not deal with case-insensitive automata though */
+    if (! fa->nocase) {
+        r = fa_minimize(fa);
+        if (r < 0)
+            goto error;
+    }
+    r = number_states(fa);
+    if (r < 0)
+        goto error;
+
     eps = make_re(EPSILON);
     if (eps == NULL)
         goto error;
@@ -147,6 +147,14 @@ struct fa *fa_minus(struct fa *fa1, struct fa *fa2);
  */
 struct fa *fa_iter(struct fa *fa, int min, int max);
 
+/* Return a deterministic finite automaton that accepts the reverse of
+ * every word in the language of FA. Since the result can be exponentially
+ * bigger than FA, give up and return NULL if it would have more than
+ * MAX_STATES states, unless MAX_STATES is 0. Also return NULL if
+ * allocation fails.
+ */
+struct fa *fa_reverse(struct fa *fa, unsigned int max_states);
+
 /* If successful, returns 1 if the language of FA1 is contained in the language
  * of FA2, 0 otherwise. Returns a negative number if an error occurred.
  */
@@ -24,6 +24,10 @@
 
 #include <regex.h>
 #include <stdarg.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #include "regexp.h"
 #include "list.h"
@@ -32,6 +36,8 @@
 #include "info.h"
 #include "lens.h"
 #include "errcode.h"
+#include "plugin.h"
+#include "augcc.h"
 
 /* Our favorite error message */
 static const char *const short_iteration =
@@ -43,6 +49,25 @@ struct seq {
     int value;
 };
 
+/* A tree whose label was produced by a seq while getting one chunk of a
+ * file; see GET_CHUNKED */
+struct seq_fixup {
+    struct seq_fixup *next;
+    struct tree      *tree;
+    const char       *name;
+};
+
+/* A subtree that is open while streaming. Events for the subtree's
+ * children can only be sent after we have sent an 'enter' event for the
+ * subtree itself, which needs its label. Children that are completed
+ * before we know the label are kept in PENDING until we do.
+ */
+struct stream_frame {
+    struct stream_frame *parent;
+    bool                 entered;
+    struct tree         *pending;
+};
+
 struct state {
     struct info      *info;
     struct span      *span;
@@ -52,6 +77,8 @@ struct state {
     char             *value;     /* GET_STORE leaves a value here */
     struct lns_error *error;
     int               enable_span;
+    /* Only record the lens and position of errors, see DEFERRED_ERROR */
+    int               defer_errors;
     /* We use the registers from a regular expression match to keep track
      * of the substring we are currently looking at. REGS are the registers
      * from the last regexp match; NREG is the number of the register
@@ -67,6 +94,41 @@ struct state {
      */
     struct re_registers *regs;
     uint                 nreg;
+    /* When STREAM is not NULL, subtrees are reported through its callbacks
+     * instead of being turned into trees */
+    const struct aug_text_callbacks *stream;
+    struct stream_frame             *sframe;
+    int                              stopped;  /* A callback asked to stop */
+    /* When DEADLINE is not NULL, give up once it has passed */
+    const struct timespec           *deadline;
+    /* Scratch space for splitting the match of a L_CONCAT among its
+     * children, see FILL_REGS */
+    struct dfa_marks                 marks;
+    struct dfa                     **rdfas;
+    uint                             nrdfas;
+    /* Transient objects that only live as long as the get are allocated
+     * from ARENA. That includes registers, which are recycled through
+     * FREE_SLOTS instead of being freed, see ALLOC_REGS */
+    struct arena                    *arena;
+    struct regs_slot                *slots;
+    struct regs_slot                *free_slots;
+    /* When SLAB is set, the trees we build, and all keys and values, are
+     * allocated from it; see TREE_STRING */
+    struct tree_slab                *slab;
+    /* Set when this is the get of one chunk of a file on its own thread;
+     * see GET_CHUNKED. Trees labelled by a seq are then recorded in
+     * FIXUPS, and KEY_SEQ is the seq that produced KEY, if any */
+    int                              chunked;
+    struct seq                      *key_seq;
+    struct seq_fixup                *fixups;
+};
+
+/* Registers from the arena. The arrays in REGS are allocated with
+ * malloc, since RE_MATCH reallocs them, and are freed by FREE_STATE */
+struct regs_slot {
+    struct re_registers  regs;        /* Must be first */
+    struct regs_slot    *next;        /* All slots */
+    struct regs_slot    *next_free;   /* Slots not in use */
 };
 
 /* Used by recursive lenses to stack intermediate results
@@ -76,15 +138,30 @@ struct state {
        combined by combinators like L_STAR and L_CONCAT
    (2) to preserve parse state when descending into a L_SUBTREE
    (3) as a marker to determine if a L_MAYBE had a match or not
+
+   Since the visitor goes through the children of a lens from last to
+   first, the result of the first child is on top of the stack. A
+   combinator turns the frame of its last child into its own result, with
+   the trees of all its children linked in place.
+
+   START and END are the part of the text, relative to the start of the
+   recursive parse, that the frame covers.
  */
 struct frame {
     struct lens     *lens;
     char            *key;
     struct span     *span;
+    uint             start;
+    uint             end;
     union {
         struct { /* MGET */
             char        *value;
             struct tree *tree;
+            struct tree *last;       /* The last tree in the list TREE */
+            /* The end of the first and the start of the last child that
+               were combined into this frame; used for L_SQUARE */
+            uint         first_end;
+            uint         last_start;
         };
         struct { /* M_PARSE */
             struct skel *skel;
@@ -112,10 +189,13 @@ struct rec_state {
     struct state        *state;
     uint                 fsize;
     uint                 fused;
-    struct frame        *frames;
+    /* The frames live in blocks of FRAME_BLOCK frames each, which are
+       never moved, so that growing the stack never copies it. FSIZE is
+       the number of frames in all of BLOCKS */
+    struct frame       **blocks;
     size_t               start;
     uint                 lvl;  /* Debug only */
-    struct ast          *ast;
+    struct ast          *ast;  /* Only built for debugging cf.get.ast */
     /* Will either be get_combine or parse_combine, depending on MODE, for
        the duration of the whole recursive parse */
     void (*combine)(struct rec_state *, struct lens *, uint);
@@ -152,33 +232,20 @@ struct rec_state {
 /*
  * AST utils
  */
-static struct ast *make_ast(struct lens *lens) {
+/* AST nodes are allocated from the arena of the get, and are freed along
+ * with it */
+static struct ast *make_ast(struct state *state, struct lens *lens) {
     struct ast *ast = NULL;
 
-    if (ALLOC(ast) < 0)
+    if (ARENA_ALLOC(state->arena, ast) < 0)
         return NULL;
     ast->lens = lens;
     ast->capacity = 4;
-    if (ALLOC_N(ast->children, ast->capacity) < 0) {
-        FREE(ast);
+    if (ARENA_ALLOC_N(state->arena, ast->children, ast->capacity) < 0)
         return NULL;
-    }
     return ast;
 }
 
-/* recursively free the node and all it's descendants */
-static void free_ast(struct ast *ast) {
-    int i;
-    if (ast == NULL)
-        return;
-    for (i = 0; i < ast->nchildren; i++) {
-        free_ast(ast->children[i]);
-    }
-    if (ast->children != NULL)
-        FREE(ast->children);
-    FREE(ast);
-}
-
 static struct ast *ast_root(struct ast *ast) {
     struct ast *root = ast;
     while(root != NULL && root->parent != NULL)
@@ -204,13 +271,17 @@ static struct ast *ast_append(struct rec_state *rec_state, struct lens *lens,
     if (parent == NULL)
        return NULL;
 
-    child = make_ast(lens);
+    child = make_ast(state, lens);
     ERR_NOMEM(child == NULL, state->info);
 
     ast_set(child, start, end);
     if (parent->nchildren >= parent->capacity) {
-       ret = REALLOC_N(parent->children, parent->capacity * 2);
+       struct ast **children = NULL;
+       ret = ARENA_ALLOC_N(state->arena, children, parent->capacity * 2);
        ERR_NOMEM(ret < 0, state->info);
+       memcpy(children, parent->children,
+              parent->nchildren * sizeof(*children));
+       parent->children = children;
        parent->capacity = parent->capacity * 2;
     }
     parent->children[parent->nchildren++] = child;
@@ -218,7 +289,6 @@ static struct ast *ast_append(struct rec_state *rec_state, struct lens *lens,
 
     return child;
  error:
-    free_ast(child);
     return NULL;
 }
 
@@ -265,7 +335,10 @@ static void vget_error(struct state *state, struct lens *lens,
         return;
     if (ALLOC(state->error) < 0)
         return;
-    state->error->lens = ref(lens);
+    /* Lenses are shared between the threads of a chunked get, and their
+     * reference counts must not change there. Errors from a chunk only
+     * make us get the whole file again, and are never shown */
+    state->error->lens = state->chunked ? NULL : ref(lens);
     if (REG_MATCHED(state))
         state->error->pos  = REG_END(state);
     else
@@ -285,6 +358,19 @@ static void get_error(struct state *state, struct lens *lens,
     va_end(ap);
 }
 
+/* Return 1 if STATE->DEADLINE has passed, and make sure that there is an
+ * error saying so */
+static int out_of_time(struct state *state, struct lens *lens) {
+    if (! deadline_passed(state->deadline))
+        return 0;
+    if (state->error == NULL) {
+        get_error(state, lens, "Parse time limit exceeded");
+        if (state->error != NULL)
+            state->error->timeout = true;
+    }
+    return 1;
+}
+
 static struct skel *make_skel(struct lens *lens) {
     struct skel *skel;
     enum lens_tag tag = lens->tag;
@@ -366,12 +452,31 @@ static void print_dict(struct dict *dict, int indent) {
 }
 #endif
 
+/* Record that LENS failed when STATE->DEFER_ERRORS is set, and return 1
+ * in that case. Describing why it failed can take a lot longer than
+ * getting to the failure, since it involves printing regexps that may be
+ * huge, or matching sublenses against the text again, and when many files
+ * fail to load, most of these descriptions are never looked at. Callers
+ * skip all that if we return 1 */
+static int deferred_error(struct state *state, struct lens *lens) {
+    if (! state->defer_errors)
+        return 0;
+    if (state->error == NULL) {
+        get_error(state, lens, "parse failed");
+        if (state->error != NULL)
+            state->error->deferred = true;
+    }
+    return 1;
+}
+
 static void get_expected_error(struct state *state, struct lens *l) {
     /* Size of the excerpt of the input text we'll show */
     static const int wordlen = 10;
     char word[wordlen+1];
     char *p, *pat;
 
+    if (deferred_error(state, l))
+        return;
     if (REG_MATCHED(state))
         strncpy(word, REG_POS(state), wordlen);
     else
@@ -394,6 +499,33 @@ static char *token(struct state *state) {
     return strndup(REG_POS(state), REG_SIZE(state));
 }
 
+/* Copy the first LEN characters of STR into a string that can be used as
+ * the label or value of a tree. Such strings must be freed with
+ * FREE_TREE_STRING */
+static char *tree_string(struct state *state, const char *str, size_t len) {
+    if (state->slab != NULL)
+        return tree_slab_strndup(state->slab, str, len);
+    return strndup(str, len);
+}
+
+static void free_tree_string(struct state *state, char *str) {
+    if (state->slab == NULL)
+        free(str);
+}
+
+/* The current match as a label or value */
+static char *tree_token(struct state *state) {
+    ensure0(REG_MATCHED(state), state->info);
+    return tree_string(state, REG_POS(state), REG_SIZE(state));
+}
+
+static struct tree *get_make_tree(struct state *state, char *key,
+                                  char *value, struct tree *children) {
+    if (state->slab != NULL)
+        return make_tree_in(state->slab, key, value, NULL, children);
+    return make_tree(key, value, NULL, children);
+}
+
 static char *token_range(const char *text, uint start, uint end) {
     return strndup(text + start, end - start);
 }
@@ -401,8 +533,12 @@ static char *token_range(const char *text, uint start, uint end) {
 static void regexp_match_error(struct state *state, struct lens *lens,
                                int count, struct regexp *r) {
     char *text = NULL;
-    char *pat = regexp_escape(r);
+    char *pat = NULL;
+
+    if (count == -1 && deferred_error(state, lens))
+        return;
 
+    pat = regexp_escape(r);
     if (state->regs != NULL)
         text = strndup(REG_POS(state), REG_SIZE(state));
     else
@@ -424,6 +560,8 @@ static void regexp_match_error(struct state *state, struct lens *lens,
 static void no_match_error(struct state *state, struct lens *lens) {
     ensure(lens->tag == L_KEY || lens->tag == L_DEL
            || lens->tag == L_STORE, state->info);
+    if (deferred_error(state, lens))
+        return;
     char *pat = regexp_escape(lens->ctype);
     const char *lname = "(lname)";
     if (lens->tag == L_KEY)
@@ -438,6 +576,202 @@ static void no_match_error(struct state *state, struct lens *lens) {
     return;
 }
 
+/* Return an unused set of registers, which may still contain the
+ * results of an earlier match */
+static struct re_registers *alloc_regs(struct state *state) {
+    struct regs_slot *slot = state->free_slots;
+
+    if (slot != NULL) {
+        state->free_slots = slot->next_free;
+        return &slot->regs;
+    }
+    if (ARENA_ALLOC(state->arena, slot) < 0)
+        return NULL;
+    slot->next = state->slots;
+    state->slots = slot;
+    return &slot->regs;
+}
+
+static void recycle_regs(struct state *state, struct re_registers *regs) {
+    struct regs_slot *slot = (struct regs_slot *) regs;
+
+    slot->next_free = state->free_slots;
+    state->free_slots = slot;
+}
+
+/*
+ * Registers from the structure of lenses
+ *
+ * When we match the ctype of a lens, we can work out the registers that
+ * get looks at from the structure of the lens instead of having
+ * RE_MATCH track POSIX submatches: the match of a L_UNION belongs to the
+ * child whose DFA accepts it, and the match of a L_CONCAT is split among
+ * its children by first running the reverse DFAs of the children backwards
+ * over it to find where each suffix of the concatenation matches, and then
+ * running the DFA of each child forwards up to the one position where the
+ * rest of the children match. That takes two passes over the text per
+ * level of the lens, and never backtracks.
+ *
+ * Registers are numbered exactly like the groups in the ctype. Only the
+ * registers for lenses are filled in; groups inside the regexp of a
+ * primitive lens, and inside a L_STAR or L_SQUARE, which match their
+ * child again, are left unmatched. Whenever the split is not unique, or a
+ * DFA can not be built, we fall back to RE_MATCH so that the registers
+ * are always the same as the ones it would produce.
+ */
+
+/* Fill in the registers for LENS, which matched TEXT[START..END), starting
+ * at register NREG. Return -1 if we need to fall back to RE_MATCH */
+static int fill_regs(struct state *state, struct lens *lens,
+                     struct re_registers *regs, uint nreg,
+                     uint start, uint end) {
+    regs->start[nreg] = start;
+    regs->end[nreg] = end;
+
+    switch (lens->tag) {
+    case L_DEL:
+    case L_STORE:
+    case L_VALUE:
+    case L_KEY:
+    case L_LABEL:
+    case L_SEQ:
+    case L_COUNTER:
+    case L_SQUARE:
+    case L_STAR:
+        return 0;
+    case L_SUBTREE:
+        return fill_regs(state, lens->child, regs, nreg, start, end);
+    case L_MAYBE:
+        if (start < end)
+            return fill_regs(state, lens->child, regs, nreg + 1, start, end);
+        /* Whether the child matched the empty word is up to RE_MATCH */
+        return lens->child->ctype_nullable ? -1 : 0;
+    case L_UNION: {
+        int found = -1;
+        for (int i=0; i < lens->nchildren; i++) {
+            struct dfa *dfa = regexp_dfa(lens->children[i]->ctype);
+            if (dfa == NULL)
+                return -1;
+            if (dfa_accepts(dfa, state->text + start, end - start)) {
+                if (found >= 0)
+                    return -1;
+                found = i;
+            }
+        }
+        if (found < 0)
+            return -1;
+        return fill_regs(state, lens->children[found], regs,
+                         nreg + lens->ctype_regs[found], start, end);
+    }
+    case L_CONCAT: {
+        int n = lens->nchildren;
+        uint len = end - start + 1, pos = start;
+        const bool *marks;
+
+        if (n - 1 > (int) state->nrdfas) {
+            if (REALLOC_N(state->rdfas, n - 1) < 0)
+                return -1;
+            state->nrdfas = n - 1;
+        }
+        for (int i=1; i < n; i++) {
+            state->rdfas[i-1] = regexp_reverse_dfa(lens->children[i]->ctype);
+            if (state->rdfas[i-1] == NULL)
+                return -1;
+        }
+        marks = dfa_mark_concat(&state->marks, n - 1, state->rdfas,
+                                state->text, start, end);
+        if (marks == NULL)
+            return -1;
+
+        /* Split the match among the children before filling in the
+         * registers for any of them, since that reuses the scratch space
+         * that MARKS lives in */
+        for (int i=0; i < n; i++) {
+            struct lens *child = lens->children[i];
+            uint r = nreg + lens->ctype_regs[i];
+            int split = end;
+            if (i < n - 1) {
+                struct dfa *dfa = regexp_dfa(child->ctype);
+                if (dfa == NULL)
+                    return -1;
+                split = dfa_match_marked(dfa, state->text, pos, end,
+                                         marks + i * len + pos - start);
+                if (split < 0)
+                    return -1;
+            }
+            regs->start[r] = pos;
+            regs->end[r] = split;
+            pos = split;
+        }
+        for (int i=0; i < n; i++) {
+            uint r = nreg + lens->ctype_regs[i];
+            if (fill_regs(state, lens->children[i], regs, r,
+                          regs->start[r], regs->end[r]) < 0)
+                return -1;
+        }
+        return 0;
+    }
+    default:
+        return -1;
+    }
+}
+
+/* Match the ctype of LENS against the text and fill REGS from the
+ * structure of LENS. Return the length of the match, -1 if there is no
+ * match, and -2 if we need to fall back to RE_MATCH */
+static int match_structure(struct state *state, struct lens *lens,
+                           uint size, uint start,
+                           struct re_registers *regs) {
+    struct dfa *dfa = regexp_dfa(lens->ctype);
+    int nsub, count;
+
+    if (dfa == NULL)
+        return -2;
+    nsub = regexp_nsub(lens->ctype);
+    if (nsub < 0)
+        return -2;
+    if (start > size)
+        return -1;
+    count = dfa_match(dfa, state->text, size, start);
+    if (count < 0)
+        return -1;
+
+    /* Grow REGS the same way RE_MATCH would */
+    if (regs->num_regs < nsub + 2) {
+        if (REALLOC_N(regs->start, nsub + 2) < 0
+            || REALLOC_N(regs->end, nsub + 2) < 0)
+            return -2;
+        regs->num_regs = nsub + 2;
+    }
+    for (int i=0; i < regs->num_regs; i++)
+        regs->start[i] = regs->end[i] = -1;
+    if (fill_regs(state, lens, regs, 0, start, start + count) < 0)
+        return -2;
+    return count;
+}
+
+/* Match RE against the text, putting the registers into REGS. The arrays
+ * in REGS are reused if they are big enough, and grown otherwise.
+ *
+ * Return the number of characters matched, -1 if there is no match, and
+ * -2 on error
+ */
+static int match_regs(struct state *state, struct lens *lens,
+                      struct regexp *re, uint size, uint start,
+                      struct re_registers *regs) {
+    int count = -2;
+
+    if (re == lens->ctype)
+        count = match_structure(state, lens, size, start, regs);
+    /* RE_MATCH is not safe to use on several threads at once; the error
+     * makes GET_CHUNKED get the whole file on one thread */
+    if (count == -2 && ! state->chunked)
+        count = regexp_match(re, state->text, size, start, regs);
+    if (count < -1)
+        regexp_match_error(state, lens, count, re);
+    return count;
+}
+
 /* Modifies STATE->REGS and STATE->NREG. The caller must save these
  * if they are still needed
  *
@@ -448,25 +782,74 @@ static int match(struct state *state, struct lens *lens,
     struct re_registers *regs;
     int count;
 
-    if (ALLOC(regs) < 0)
+    regs = alloc_regs(state);
+    if (regs == NULL)
         return -1;
 
-    count = regexp_match(re, state->text, size, start, regs);
+    count = match_regs(state, lens, re, size, start, regs);
     if (count < -1) {
-        regexp_match_error(state, lens, count, re);
-        FREE(regs);
+        recycle_regs(state, regs);
         return -1;
     }
+    if (count == -1) {
+        /* Look the same as a fresh set of registers would after a failed
+         * match */
+        regs->num_regs = 0;
+    }
     state->regs = regs;
     state->nreg = 0;
     return count;
 }
 
+/* Like MATCH, but reuse REGS, which must have been allocated by the
+ * caller, instead of allocating new registers. This is what iterating
+ * lenses use, so that they only need to allocate registers once, rather
+ * than once per iteration.
+ */
+static int match_again(struct state *state, struct lens *lens,
+                       struct re_registers *regs, uint size, uint start) {
+    int count;
+
+    count = match_regs(state, lens, lens->ctype, size, start, regs);
+    state->regs = regs;
+    state->nreg = 0;
+    return count < -1 ? -1 : count;
+}
+
+/* Return true if every match of the child of the L_STAR LENS is a single
+ * line, ending in a newline */
+static bool star_lines(struct lens *lens) {
+    if (! lens->lines_checked) {
+        lens->lines = regexp_is_line(lens->child->ctype) == 1;
+        lens->lines_checked = 1;
+    }
+    return lens->lines;
+}
+
+/* Return where a match of the child of the L_STAR LENS that starts at
+ * START can end at the latest, given that the star matched up to END.
+ *
+ * Most lenses are an iteration over lines. When every match of the child
+ * is a single line, ending in a newline, the match can only end right
+ * after the next newline. Finding that with MEMCHR, and only matching the
+ * child against that line, is a lot cheaper than having the matcher find
+ * the end of the line
+ */
+static uint star_match_end(struct state *state, struct lens *lens,
+                           uint start, uint end) {
+    const char *nl;
+
+    if (! star_lines(lens))
+        return end;
+
+    nl = memchr(state->text + start, '\n', end - start);
+    return (nl == NULL) ? start : nl - state->text + 1;
+}
+
 static void free_regs(struct state *state) {
     if (state->regs != NULL) {
-        free(state->regs->start);
-        free(state->regs->end);
-        FREE(state->regs);
+        recycle_regs(state, state->regs);
+        state->regs = NULL;
     }
 }
 
@@ -474,9 +857,19 @@ static struct tree *get_lens(struct lens *lens, struct state *state);
 static struct skel *parse_lens(struct lens *lens, struct state *state,
                                struct dict **dict);
 
-static void free_seqs(struct seq *seqs) {
-    /* Do not free seq->name; it's not owned by the seq, but by some lens */
-    list_free(seqs);
+/* Free everything allocated from STATE->ARENA, together with the arrays of
+ * all registers that were ever handed out by ALLOC_REGS */
+static void free_state_arena(struct state *state) {
+    for (struct regs_slot *slot = state->slots; slot != NULL;
+         slot = slot->next) {
+        free(slot->regs.start);
+        free(slot->regs.end);
+    }
+    state->slots = NULL;
+    state->free_slots = NULL;
+    state->regs = NULL;
+    free_arena(state->arena);
+    state->arena = NULL;
 }
 
 static struct seq *find_seq(const char *name, struct state *state) {
@@ -488,7 +881,8 @@ static struct seq *find_seq(const char *name, struct state *state) {
          seq = seq->next);
 
     if (seq == NULL) {
-        if (ALLOC(seq) < 0)
+        /* seq->name is not owned by the seq, but by some lens */
+        if (ARENA_ALLOC(state->arena, seq) < 0)
             return NULL;
         seq->name = name;
         seq->value = 1;
@@ -501,10 +895,14 @@ static struct seq *find_seq(const char *name, struct state *state) {
 static struct tree *get_seq(struct lens *lens, struct state *state) {
     ensure0(lens->tag == L_SEQ, state->info);
     struct seq *seq = find_seq(lens->string->str, state);
+    char buf[3 * sizeof(seq->value) + 2];
     int r;
 
-    r = asprintf((char **) &(state->key), "%d", seq->value);
-    ERR_NOMEM(r < 0, state->info);
+    r = snprintf(buf, sizeof(buf), "%d", seq->value);
+    state->key = tree_string(state, buf, r);
+    ERR_NOMEM(state->key == NULL, state->info);
+    if (state->chunked)
+        state->key_seq = seq;
 
     seq->value += 1;
  error:
@@ -562,7 +960,7 @@ static struct tree *get_store(struct lens *lens, struct state *state) {
     else if (! REG_MATCHED(state))
         no_match_error(state, lens);
     else {
-        state->value = token(state);
+        state->value = tree_token(state);
         if (state->span) {
             state->span->value_start = REG_START(state);
             state->span->value_end = REG_END(state);
@@ -580,7 +978,8 @@ static struct skel *parse_store(struct lens *lens,
 
 static struct tree *get_value(struct lens *lens, struct state *state) {
     ensure0(lens->tag == L_VALUE, state->info);
-    state->value = strdup(lens->string->str);
+    state->value = tree_string(state, lens->string->str,
+                               strlen(lens->string->str));
     return NULL;
 }
 
@@ -595,7 +994,7 @@ static struct tree *get_key(struct lens *lens, struct state *state) {
     if (! REG_MATCHED(state))
         no_match_error(state, lens);
     else {
-        state->key = token(state);
+        state->key = tree_token(state);
         if (state->span) {
             state->span->label_start = REG_START(state);
             state->span->label_end = REG_END(state);
@@ -612,7 +1011,8 @@ static struct skel *parse_key(struct lens *lens, struct state *state) {
 
 static struct tree *get_label(struct lens *lens, struct state *state) {
     ensure0(lens->tag == L_LABEL, state->info);
-    state->key = strdup(lens->string->str);
+    state->key = tree_string(state, lens->string->str,
+                             strlen(lens->string->str));
     return NULL;
 }
 
@@ -621,21 +1021,32 @@ static struct skel *parse_label(struct lens *lens, struct state *state) {
     return make_skel(lens);
 }
 
+/* The first character of the match in the current register, or -1 if it
+ * is empty, to look up candidates with LNS_UNION_CANDIDATES */
+static int reg_first_char(struct state *state) {
+    if (! REG_MATCHED(state) || REG_SIZE(state) == 0)
+        return -1;
+    return (unsigned char) *REG_POS(state);
+}
+
 static struct tree *get_union(struct lens *lens, struct state *state) {
     ensure0(lens->tag == L_UNION, state->info);
 
     struct tree *tree = NULL;
     int applied = 0;
     uint old_nreg = state->nreg;
+    const unsigned int *cand;
+    unsigned int ncand;
 
-    state->nreg += 1;
-    for (int i=0; i < lens->nchildren; i++) {
+    ncand = lns_union_candidates(lens, false, reg_first_char(state), &cand);
+    for (int k=0; k < ncand; k++) {
+        int i = (cand == NULL) ? k : cand[k];
+        state->nreg = old_nreg + lens->ctype_regs[i];
         if (REG_MATCHED(state)) {
             tree = get_lens(lens->children[i], state);
             applied = 1;
             break;
         }
-        state->nreg += 1 + regexp_nsub(lens->children[i]->ctype);
     }
     state->nreg = old_nreg;
     if (!applied)
@@ -650,16 +1061,19 @@ static struct skel *parse_union(struct lens *lens, struct state *state,
     struct skel *skel = NULL;
     int applied = 0;
     uint old_nreg = state->nreg;
+    const unsigned int *cand;
+    unsigned int ncand;
 
-    state->nreg += 1;
-    for (int i=0; i < lens->nchildren; i++) {
+    ncand = lns_union_candidates(lens, false, reg_first_char(state), &cand);
+    for (int k=0; k < ncand; k++) {
+        int i = (cand == NULL) ? k : cand[k];
         struct lens *l = lens->children[i];
+        state->nreg = old_nreg + lens->ctype_regs[i];
         if (REG_MATCHED(state)) {
             skel = parse_lens(l, state, dict);
             applied = 1;
             break;
         }
-        state->nreg += 1 + regexp_nsub(lens->children[i]->ctype);
     }
     state->nreg = old_nreg;
     if (! applied)
@@ -674,9 +1088,9 @@ static struct tree *get_concat(struct lens *lens, struct state *state) {
     struct tree *tree = NULL;
     uint old_nreg = state->nreg;
 
-    state->nreg += 1;
     for (int i=0; i < lens->nchildren; i++) {
         struct tree *t = NULL;
+        state->nreg = old_nreg + lens->ctype_regs[i];
         if (! REG_VALID(state)) {
             get_error(state, lens->children[i],
                       "Not enough components in concat");
@@ -687,7 +1101,6 @@ static struct tree *get_concat(struct lens *lens, struct state *state) {
 
         t = get_lens(lens->children[i], state);
         list_append(tree, t);
-        state->nreg += 1 + regexp_nsub(lens->children[i]->ctype);
     }
     state->nreg = old_nreg;
 
@@ -700,10 +1113,10 @@ static struct skel *parse_concat(struct lens *lens, struct state *state,
     struct skel *skel = make_skel(lens);
     uint old_nreg = state->nreg;
 
-    state->nreg += 1;
     for (int i=0; i < lens->nchildren; i++) {
         struct skel *sk = NULL;
         struct dict *di = NULL;
+        state->nreg = old_nreg + lens->ctype_regs[i];
         if (! REG_VALID(state)) {
             get_error(state, lens->children[i],
                       "Not enough components in concat");
@@ -714,7 +1127,6 @@ static struct skel *parse_concat(struct lens *lens, struct state *state,
         sk = parse_lens(lens->children[i], state, &di);
         list_append(skel->skels, sk);
         dict_append(dict, di);
-        state->nreg += 1 + regexp_nsub(lens->children[i]->ctype);
     }
     state->nreg = old_nreg;
 
@@ -771,15 +1183,29 @@ static int try_match(struct lens *lens, struct state *state,
         }
         return result;
         break;
-    case L_UNION:
-        for (int i=0; i < lens->nchildren; i++) {
-            struct lens *child = lens->children[i];
-            result = try_match(child, state, start, end, last, next);
+    case L_UNION: {
+        const unsigned int *cand;
+        unsigned int ncand;
+        int c = (start < end) ? (unsigned char) state->text[start] : -1;
+
+        /* Only the candidates for C can match anything */
+        ncand = lns_union_candidates(lens, false, c, &cand);
+        for (int k=0; k < ncand; k++) {
+            int i = (cand == NULL) ? k : cand[k];
+            result = try_match(lens->children[i], state, start, end,
+                               last, next);
             if (result > 0)
                 return result;
         }
+        /* None of them did; go through all children so that LAST ends up
+         * the same as if we had never skipped any */
+        if (cand != NULL) {
+            for (int i=0; i < lens->nchildren; i++)
+                try_match(lens->children[i], state, start, end, last, next);
+        }
         return 0;
         break;
+    }
     case L_SUBTREE:
     case L_STAR:
     case L_MAYBE:
@@ -798,6 +1224,11 @@ static void short_iteration_error(struct lens *lens, struct state *state,
                                     uint start, uint end) {
     int match_count;
 
+    if (deferred_error(state, lens)) {
+        if (state->error != NULL && state->error->lens == lens)
+            state->error->pos = start;
+        return;
+    }
     get_error(state, lens, "%s", short_iteration);
 
     match_count = try_match(lens->child, state, start, end,
@@ -812,9 +1243,19 @@ static struct tree *get_quant_star(struct lens *lens, struct state *state) {
     uint end = REG_END(state);
     uint start = REG_START(state);
     uint size = end - start;
+    struct re_registers *regs = NULL;
 
     SAVE_REGS(state);
-    while (size > 0 && match(state, child, child->ctype, end, start) > 0) {
+    regs = alloc_regs(state);
+    if (regs == NULL) {
+        RESTORE_REGS(state);
+        return NULL;
+    }
+    state->regs = regs;
+    while (size > 0 && !state->stopped && !out_of_time(state, lens)
+           && match_again(state, child, regs,
+                          star_match_end(state, lens, start, end),
+                          start) > 0) {
         struct tree *t = NULL;
 
         t = get_lens(lens->child, state);
@@ -822,10 +1263,9 @@ static struct tree *get_quant_star(struct lens *lens, struct state *state) {
 
         start += REG_SIZE(state);
         size -= REG_SIZE(state);
-        free_regs(state);
     }
     RESTORE_REGS(state);
-    if (size != 0) {
+    if (size != 0 && !state->stopped) {
         short_iteration_error(lens, state, start, end);
     }
     return tree;
@@ -839,10 +1279,20 @@ static struct skel *parse_quant_star(struct lens *lens, struct state *state,
     uint end = REG_END(state);
     uint start = REG_START(state);
     uint size = end - start;
+    struct re_registers *regs = NULL;
 
     *dict = NULL;
     SAVE_REGS(state);
-    while (size > 0 && match(state, child, child->ctype, end, start) > 0) {
+    regs = alloc_regs(state);
+    if (regs == NULL) {
+        RESTORE_REGS(state);
+        return skel;
+    }
+    state->regs = regs;
+    while (size > 0
+           && match_again(state, child, regs,
+                          star_match_end(state, lens, start, end),
+                          start) > 0) {
         struct skel *sk;
         struct dict *di = NULL;
 
@@ -852,7 +1302,6 @@ static struct skel *parse_quant_star(struct lens *lens, struct state *state,
 
         start += REG_SIZE(state);
         size -= REG_SIZE(state);
-        free_regs(state);
     }
     RESTORE_REGS(state);
     if (size != 0) {
@@ -893,15 +1342,113 @@ static struct skel *parse_quant_maybe(struct lens *lens, struct state *state,
     return skel;
 }
 
+/*
+ * Streaming
+ */
+static void stream_event(struct state *state,
+                         int (*cb)(void *, const char *, const char *),
+                         const char *label, const char *value) {
+    if (cb == NULL || state->stopped)
+        return;
+    if (cb(state->stream->data, label, value) != 0)
+        state->stopped = 1;
+}
+
+/* Send the events for the trees TREE and free them */
+static void stream_trees(struct state *state, struct tree *tree) {
+    const struct aug_text_callbacks *cb = state->stream;
+
+    list_for_each(t, tree) {
+        if (t->children == NULL) {
+            stream_event(state, cb->leaf, t->label, t->value);
+        } else {
+            stream_event(state, cb->enter, t->label, t->value);
+            stream_trees(state, t->children);
+            t->children = NULL;
+            stream_event(state, cb->exit, t->label, t->value);
+        }
+    }
+    free_tree(tree);
+}
+
+/* Make sure FRAME has been entered, using LABEL and VALUE, the label and
+ * value it has right now. Return false if that is not possible because
+ * we do not know FRAME's label yet.
+ */
+static bool stream_open(struct state *state, struct stream_frame *frame,
+                        const char *label, const char *value) {
+    if (frame == NULL || frame->entered)
+        return true;
+    if (label == NULL)
+        return false;
+    stream_event(state, state->stream->enter, label, value);
+    frame->entered = true;
+    stream_trees(state, frame->pending);
+    frame->pending = NULL;
+    return true;
+}
+
+static struct tree *get_subtree(struct lens *lens, struct state *state);
+
+static struct tree *stream_subtree(struct lens *lens, struct state *state) {
+    const struct aug_text_callbacks *cb = state->stream;
+    struct stream_frame *parent = state->sframe;
+    struct stream_frame frame;
+    char *key = state->key;
+    char *value = state->value;
+    struct tree *tree;
+
+    if (! stream_open(state, parent, key, value)) {
+        /* Build this subtree and send it along once we know the label
+         * of our parent */
+        state->stream = NULL;
+        state->sframe = NULL;
+        tree = get_subtree(lens, state);
+        state->stream = cb;
+        state->sframe = parent;
+        list_append(parent->pending, tree);
+        return NULL;
+    }
+
+    MEMZERO(&frame, 1);
+    frame.parent = parent;
+    state->sframe = &frame;
+    state->key = NULL;
+    state->value = NULL;
+
+    tree = get_lens(lens->child, state);
+    /* Only subtrees produce trees, and we stream all of them */
+    list_append(frame.pending, tree);
+
+    if (frame.entered) {
+        stream_event(state, cb->exit, state->key, state->value);
+    } else if (frame.pending != NULL) {
+        stream_event(state, cb->enter, state->key, state->value);
+        stream_trees(state, frame.pending);
+        stream_event(state, cb->exit, state->key, state->value);
+    } else {
+        stream_event(state, cb->leaf, state->key, state->value);
+    }
+
+    free_tree_string(state, state->key);
+    free_tree_string(state, state->value);
+    state->key = key;
+    state->value = value;
+    state->sframe = parent;
+    return NULL;
+}
+
 static struct tree *get_subtree(struct lens *lens, struct state *state) {
     char *key = state->key;
     char *value = state->value;
+    struct seq *key_seq = state->key_seq;
     struct span *span = move(state->span);
 
     struct tree *tree = NULL, *children;
 
     state->key = NULL;
     state->value = NULL;
+    state->key_seq = NULL;
     if (state->enable_span) {
         state->span = make_span(state->info);
         ERR_NOMEM(state->span == NULL, state->info);
@@ -909,7 +1456,7 @@ static struct tree *get_subtree(struct lens *lens, struct state *state) {
 
     children = get_lens(lens->child, state);
 
-    tree = make_tree(state->key, state->value, NULL, children);
+    tree = get_make_tree(state, state->key, state->value, children);
     ERR_NOMEM(tree == NULL, state->info);
     tree->span = move(state->span);
 
@@ -917,13 +1464,27 @@ static struct tree *get_subtree(struct lens *lens, struct state *state) {
         update_span(span, tree->span->span_start, tree->span->span_end);
     }
 
+    if (state->key_seq != NULL) {
+        struct seq_fixup *fixup;
+        if (ARENA_ALLOC(state->arena, fixup) < 0) {
+            /* The label is wrong now, and we'll fall back to a plain get */
+            get_error(state, lens, "out of memory");
+        } else {
+            fixup->tree = tree;
+            fixup->name = state->key_seq->name;
+            list_cons(state->fixups, fixup);
+        }
+    }
+
     state->key = key;
     state->value = value;
+    state->key_seq = key_seq;
     state->span = span;
     return tree;
  error:
     free_span(state->span);
     state->span = span;
+    state->key_seq = key_seq;
     return NULL;
 }
 
@@ -991,9 +1552,7 @@ static struct tree *get_square(struct lens *lens, struct state *state) {
     lsqr = token_range(state->text, start, end);
 
     /* retrieve right component */
-    /* compute nreg for the last children */
-    for (int i = 0; i < concat->nchildren - 1; i++)
-        state->nreg += 1 + regexp_nsub(concat->children[i]->ctype);
+    state->nreg = concat->ctype_regs[concat->nchildren - 1];
 
     start = REG_START(state);
     end = REG_END(state);
@@ -1045,10 +1604,19 @@ static struct skel *parse_square(struct lens *lens, struct state *state,
  * Helpers for recursive lenses
  */
 
+/* The number of frames in one block of the frame stack */
+#define FRAME_BLOCK 256
+
+/* The frame at index IDX from the bottom of the stack */
+ATTRIBUTE_PURE
+static struct frame *frame_at(struct rec_state *state, uint idx) {
+    return state->blocks[idx / FRAME_BLOCK] + idx % FRAME_BLOCK;
+}
+
 ATTRIBUTE_UNUSED
 static void print_frames(struct rec_state *state) {
     for (int j = state->fused - 1; j >=0; j--) {
-        struct frame *f = state->frames + j;
+        struct frame *f = frame_at(state, j);
         for (int i=0; i < state->lvl; i++) fputc(' ', stderr);
         fprintf(stderr, "%2d %s %s", j, f->key, f->value);
         if (f->tree == NULL) {
@@ -1066,27 +1634,27 @@ static void print_frames(struct rec_state *state) {
 
 ATTRIBUTE_PURE
 static struct frame *top_frame(struct rec_state *state) {
-    ensure0(state->fsize > 0, state->state->info);
-    return state->frames + state->fused - 1;
+    ensure0(state->fused > 0, state->state->info);
+    return frame_at(state, state->fused - 1);
 }
 
 /* The nth frame from the top of the stack, where 0th frame is the top */
 ATTRIBUTE_PURE
 static struct frame *nth_frame(struct rec_state *state, uint n) {
-    ensure0(state->fsize > n, state->state->info);
-    return state->frames + state->fused - (n+1);
+    ensure0(state->fused > n, state->state->info);
+    return frame_at(state, state->fused - (n+1));
 }
 
 static struct frame *push_frame(struct rec_state *state, struct lens *lens) {
     int r;
 
     if (state->fused >= state->fsize) {
-        uint expand = state->fsize;
-        if (expand < 8)
-            expand = 8;
-        r = REALLOC_N(state->frames, state->fsize + expand);
+        uint nblocks = state->fsize / FRAME_BLOCK;
+        r = REALLOC_N(state->blocks, nblocks + 1);
         ERR_NOMEM(r < 0, state->state->info);
-        state->fsize += expand;
+        r = ALLOC_N(state->blocks[nblocks], FRAME_BLOCK);
+        ERR_NOMEM(r < 0, state->state->info);
+        state->fsize += FRAME_BLOCK;
     }
 
     state->fused += 1;
@@ -1128,6 +1696,10 @@ static void dbg_visit(struct lens *lens, char action, size_t start, size_t end,
 static void get_terminal(struct frame *top, struct lens *lens,
                          struct state *state) {
     top->tree = get_lens(lens, state);
+    top->last = top->tree;
+    if (top->last != NULL)
+        while (top->last->next != NULL)
+            top->last = top->last->next;
     top->key = state->key;
     top->value = state->value;
     state->key = NULL;
@@ -1157,12 +1729,16 @@ static void visit_terminal(struct lens *lens, size_t start, size_t end,
     match(state, lens, lens->ctype, end, start);
     struct frame *top = push_frame(rec_state, lens);
     ERR_BAIL(state->info);
+    top->start = start;
+    top->end = end;
     if (rec_state->mode == M_GET)
         get_terminal(top, lens, state);
     else
         parse_terminal(top, lens, state);
-    child = ast_append(rec_state, lens, start, end);
-    ERR_NOMEM(child == NULL, state->info);
+    if (rec_state->ast != NULL) {
+        child = ast_append(rec_state, lens, start, end);
+        ERR_NOMEM(child == NULL, state->info);
+    }
  error:
     RESTORE_REGS(state);
 }
@@ -1206,42 +1782,59 @@ static void visit_enter(struct lens *lens,
         push_frame(rec_state, lens);
         ERR_BAIL(state->info);
     }
-    child = ast_append(rec_state, lens, start, end);
-    if (child != NULL)
+    if (rec_state->ast != NULL) {
+        child = ast_append(rec_state, lens, start, end);
+        ERR_NOMEM(child == NULL, state->info);
         rec_state->ast = child;
+    }
  error:
     return;
 }
 
-/* Combine n frames from the stack into one new frame for M_GET */
+/* Combine n frames from the stack into one frame for M_GET. The
+ * combined frame is the lowest of them, i.e. the result of the last
+ * child, so that nothing needs to be pushed unless N is 0 */
 static void get_combine(struct rec_state *rec_state,
                         struct lens *lens, uint n) {
     struct tree *tree = NULL, *tail = NULL;
     char *key = NULL, *value = NULL;
-    struct frame *top = NULL;
+    struct frame *first = NULL, *last = NULL;
 
-    for (int i=0; i < n; i++) {
-        top = pop_frame(rec_state);
-        ERR_BAIL(lens->info);
-        list_tail_cons(tree, tail, top->tree);
-        /* top->tree might have more than one node, update tail */
-        if (tail != NULL)
-            while (tail->next != NULL) tail = tail->next;
+    if (n == 0) {
+        push_frame(rec_state, lens);
+        return;
+    }
 
-        if (top->key != NULL) {
+    first = nth_frame(rec_state, 0);
+    last = nth_frame(rec_state, n - 1);
+    ERR_BAIL(lens->info);
+    for (uint i=0; i < n; i++) {
+        struct frame *f = nth_frame(rec_state, i);
+        if (f->tree != NULL) {
+            if (tree == NULL)
+                tree = f->tree;
+            else
+                tail->next = f->tree;
+            tail = f->last;
+        }
+        if (f->key != NULL) {
             ensure(key == NULL, rec_state->state->info);
-            key = top->key;
+            key = f->key;
         }
-        if (top->value != NULL) {
+        if (f->value != NULL) {
             ensure(value == NULL, rec_state->state->info);
-            value = top->value;
+            value = f->value;
         }
     }
-    top = push_frame(rec_state, lens);
-    ERR_BAIL(lens->info);
-    top->tree = tree;
-    top->key = key;
-    top->value = value;
+    last->first_end = first->end;
+    last->last_start = last->start;
+    last->start = first->start;
+    last->lens = lens;
+    last->tree = tree;
+    last->last = tail;
+    last->key = key;
+    last->value = value;
+    rec_state->fused -= n - 1;
  error:
     return;
 }
@@ -1325,20 +1918,23 @@ static void visit_exit(struct lens *lens,
         struct frame *top = pop_frame(rec_state);
         ERR_BAIL(state->info);
         if (rec_state->mode == M_GET) {
-            tree = make_tree(top->key, top->value, NULL, top->tree);
+            tree = get_make_tree(state, top->key, top->value, top->tree);
             ERR_NOMEM(tree == NULL, lens->info);
             tree->span = state->span;
-            /* Restore the parse state from before entering this subtree */
-            top = pop_frame(rec_state);
+            /* Restore the parse state from before entering this
+               subtree, and make its frame our result */
+            top = top_frame(rec_state);
             ERR_BAIL(state->info);
             ensure(lens == top->lens, state->info);
             state->key = top->key;
             state->value = top->value;
             state->span = top->span;
-            /* Push the result of parsing this subtree */
-            top = push_frame(rec_state, lens);
-            ERR_BAIL(state->info);
-            top->tree = move(tree);
+            top->key = NULL;
+            top->value = NULL;
+            top->span = NULL;
+            top->tree = tree;
+            top->last = tree;
+            tree = NULL;
         } else {
             visit_exit_put_subtree(lens, rec_state, top);
         }
@@ -1376,16 +1972,16 @@ static void visit_exit(struct lens *lens,
         rec_state->combine(rec_state, lens, n);
     } else if (lens->tag == L_SQUARE) {
         if (rec_state->mode == M_GET) {
-            struct ast *square, *concat, *right, *left;
+            /* The top frame is the result of our concat */
+            struct frame *concat = top_frame(rec_state);
+            const char *text = state->text + rec_state->start;
             char *rsqr, *lsqr;
             int ret;
 
-            square = rec_state->ast;
-            concat = child_first(square);
-            right = child_first(concat);
-            left = child_last(concat);
-            lsqr = token_range(state->text, left->start, left->end);
-            rsqr = token_range(state->text, right->start, right->end);
+            ERR_BAIL(state->info);
+            ensure(concat->lens == lens->child, state->info);
+            lsqr = token_range(text, concat->start, concat->first_end);
+            rsqr = token_range(text, concat->last_start, concat->end);
             ret = square_match(lens, lsqr, rsqr);
             if (! ret) {
                 get_error(state, lens, "%s \"%s\" %s \"%s\"",
@@ -1404,7 +2000,13 @@ static void visit_exit(struct lens *lens,
         top_frame(rec_state)->lens = lens;
         ERR_BAIL(state->info);
     }
-    ast_pop(rec_state);
+    /* Whatever is on top of the stack now is our result */
+    struct frame *result = top_frame(rec_state);
+    ERR_BAIL(state->info);
+    result->start = start;
+    result->end = end;
+    if (rec_state->ast != NULL)
+        ast_pop(rec_state);
  error:
     free_tree(tree);
     return;
@@ -1421,8 +2023,10 @@ static void visit_error(struct lens *lens, void *data, size_t pos,
     rec_state->state->error->pos = rec_state->start + pos;
 }
 
-static struct frame *rec_process(enum mode_t mode, struct lens *lens,
-                                 struct state *state) {
+/* Parse the current match with the recursive LENS, and put the frame
+ * with the result into *RESULT. Return false if that failed */
+static bool rec_process(enum mode_t mode, struct lens *lens,
+                        struct state *state, struct frame *result) {
     uint end = REG_END(state);
     uint start = REG_START(state);
     size_t len = 0;
@@ -1431,27 +2035,32 @@ static struct frame *rec_process(enum mode_t mode, struct lens *lens,
     struct rec_state rec_state;
     int i;
     struct frame *f = NULL;
+    bool ok = false;
 
     MEMZERO(&rec_state, 1);
     MEMZERO(&visitor, 1);
     SAVE_REGS(state);
 
-    if (lens->jmt == NULL) {
-        lens->jmt = jmt_build(lens);
-        ERR_BAIL(lens->info);
-    }
+    lns_build_jmt(lens);
+    ERR_BAIL(lens->info);
 
     rec_state.mode  = mode;
     rec_state.state = state;
     rec_state.fused = 0;
     rec_state.lvl   = 0;
     rec_state.start = start;
-    rec_state.ast = make_ast(lens);
     rec_state.combine = (mode == M_GET) ? get_combine : parse_combine;
-    ERR_NOMEM(rec_state.ast == NULL, state->info);
+    if (debugging("cf.get.ast")) {
+        rec_state.ast = make_ast(state, lens);
+        ERR_NOMEM(rec_state.ast == NULL, state->info);
+    }
 
-    visitor.parse = jmt_parse(lens->jmt, state->text + start, end - start);
+    visitor.parse = jmt_parse(lens->jmt, state->info->error,
+                              state->text + start, end - start,
+                              state->deadline);
     ERR_BAIL(lens->info);
+    if (out_of_time(state, lens))
+        goto error;
     visitor.terminal = visit_terminal;
     visitor.enter = visit_enter;
     visitor.exit = visit_exit;
@@ -1473,43 +2082,48 @@ static struct frame *rec_process(enum mode_t mode, struct lens *lens,
         goto error;
     }
 
-    rec_state.ast = ast_root(rec_state.ast);
-    ensure(rec_state.ast->parent == NULL, state->info);
+    if (rec_state.ast != NULL) {
+        rec_state.ast = ast_root(rec_state.ast);
+        ensure(rec_state.ast->parent == NULL, state->info);
+    }
+    *result = *frame_at(&rec_state, 0);
+    ok = true;
  done:
-    if (debugging("cf.get.ast"))
+    if (rec_state.ast != NULL)
         print_ast(ast_root(rec_state.ast), 0);
     RESTORE_REGS(state);
     jmt_free_parse(visitor.parse);
-    free_ast(ast_root(rec_state.ast));
-    return rec_state.frames;
+    for (i = 0; i < rec_state.fsize / FRAME_BLOCK; i++)
+        free(rec_state.blocks[i]);
+    free(rec_state.blocks);
+    return ok;
  error:
 
     for(i = 0; i < rec_state.fused; i++) {
         f = nth_frame(&rec_state, i);
-        FREE(f->key);
+        free_tree_string(state, f->key);
+        f->key = NULL;
         free_span(f->span);
         if (mode == M_GET) {
-            FREE(f->value);
+            free_tree_string(state, f->value);
+            f->value = NULL;
             free_tree(f->tree);
         } else if (mode == M_PARSE) {
             free_skel(f->skel);
             free_dict(f->dict);
         }
     }
-    FREE(rec_state.frames);
     goto done;
 }
 
 static struct tree *get_rec(struct lens *lens, struct state *state) {
-    struct frame *fr;
+    struct frame fr;
     struct tree *tree = NULL;
 
-    fr = rec_process(M_GET, lens, state);
-    if (fr != NULL) {
-        tree = fr->tree;
-        state->key = fr->key;
-        state->value = fr->value;
-        FREE(fr);
+    if (rec_process(M_GET, lens, state, &fr)) {
+        tree = fr.tree;
+        state->key = fr.key;
+        state->value = fr.value;
     }
     return tree;
 }
@@ -1517,14 +2131,12 @@ static struct tree *get_rec(struct lens *lens, struct state *state) {
 static struct skel *parse_rec(struct lens *lens, struct state *state,
                               struct dict **dict) {
     struct skel *skel = NULL;
-    struct frame *fr;
+    struct frame fr;
 
-    fr = rec_process(M_PARSE, lens, state);
-    if (fr != NULL) {
-        skel = fr->skel;
-        *dict = fr->dict;
-        state->key = fr->key;
-        FREE(fr);
+    if (rec_process(M_PARSE, lens, state, &fr)) {
+        skel = fr.skel;
+        *dict = fr.dict;
+        state->key = fr.key;
     }
     return skel;
 }
@@ -1561,7 +2173,10 @@ static struct tree *get_lens(struct lens *lens, struct state *state) {
         tree = get_union(lens, state);
         break;
     case L_SUBTREE:
-        tree = get_subtree(lens, state);
+        if (state->stream != NULL)
+            tree = stream_subtree(lens, state);
+        else
+            tree = get_subtree(lens, state);
         break;
     case L_STAR:
         tree = get_quant_star(lens, state);
@@ -1598,7 +2213,8 @@ static int init_regs(struct state *state, struct lens *lens, uint size) {
      * We can avoid matching the entire text in that case - that
      * match can be very expensive
      */
-    if (ALLOC(state->regs) < 0)
+    state->regs = alloc_regs(state);
+    if (state->regs == NULL)
         return -1;
     state->regs->num_regs = 1;
     if (ALLOC(state->regs->start) < 0 || ALLOC(state->regs->end) < 0)
@@ -1608,16 +2224,683 @@ static int init_regs(struct state *state, struct lens *lens, uint size) {
     return 0;
 }
 
+/* Use a lens plugin for LENS if there is one for it */
+static void use_plugins(struct info *info, struct lens *lens) {
+    if (info->error != NULL && info->error->aug != NULL)
+        lens_plugins_attach(info->error->aug->plugins, lens);
+}
+
+/*
+ * Get routines from lens plugins
+ *
+ * The get routine of a plugin matches the text against the lens, and
+ * reports the match through the callbacks below. They build the same
+ * trees from it that GET_LENS would, or for LNS_PARSE, the same skeleton
+ * and dictionary as PARSE_LENS. The routine gives up in every case in
+ * which the generic code would report an error, or would have to fall
+ * back to RE_MATCH to split the text among sublenses; we then throw away
+ * what it built so far, and get the text with the generic code.
+ */
+
+/* What we build for a L_SUBTREE, and when parsing, also for a L_CONCAT,
+ * L_STAR or L_MAYBE, while the get routine is inside of it */
+struct plugin_frame {
+    char        *key;        /* The key and value of the enclosing */
+    char        *value;      /* subtree, for a L_SUBTREE */
+    struct tree *trees;
+    struct tree *tail;
+    struct skel *skels;
+    struct skel *skel_tail;
+    struct dict *dict;
+};
+
+struct plugin_get {
+    struct state        *state;
+    struct lens        **nodes;
+    struct plugin_frame *frames;
+    uint                 nframes;
+    uint                 size;
+};
+
+static struct plugin_frame *plugin_push(struct plugin_get *pg) {
+    struct plugin_frame *frame;
+
+    if (pg->nframes >= pg->size) {
+        uint size = (pg->size == 0) ? 8 : 2 * pg->size;
+        if (REALLOC_N(pg->frames, size) < 0)
+            return NULL;
+        pg->size = size;
+    }
+    frame = pg->frames + pg->nframes;
+    MEMZERO(frame, 1);
+    pg->nframes += 1;
+    return frame;
+}
+
+static struct plugin_frame *plugin_top(struct plugin_get *pg) {
+    return pg->frames + pg->nframes - 1;
+}
+
+static int plugin_expired(void *data) {
+    struct plugin_get *pg = data;
+    return deadline_passed(pg->state->deadline);
+}
+
+static int plugin_get_enter(void *data, ATTRIBUTE_UNUSED unsigned int node) {
+    struct plugin_get *pg = data;
+    struct state *state = pg->state;
+    struct plugin_frame *frame = plugin_push(pg);
+
+    if (frame == NULL)
+        return -1;
+    frame->key = state->key;
+    frame->value = state->value;
+    state->key = NULL;
+    state->value = NULL;
+    return 0;
+}
+
+static int plugin_get_leave(void *data, ATTRIBUTE_UNUSED unsigned int node) {
+    struct plugin_get *pg = data;
+    struct state *state = pg->state;
+    struct plugin_frame *frame = plugin_top(pg), *parent = frame - 1;
+    struct tree *tree;
+
+    tree = get_make_tree(state, state->key, state->value, frame->trees);
+    if (tree == NULL)
+        return -1;
+    state->key = frame->key;
+    state->value = frame->value;
+    pg->nframes -= 1;
+    list_tail_cons(parent->trees, parent->tail, tree);
+    return 0;
+}
+
+static int plugin_get_store(void *data, ATTRIBUTE_UNUSED unsigned int node,
+                            unsigned int start, unsigned int end) {
+    struct plugin_get *pg = data;
+    struct state *state = pg->state;
+
+    /* GET_STORE reports more than one store in a subtree */
+    if (state->value != NULL)
+        return -1;
+    state->value = tree_string(state, state->text + start, end - start);
+    return (state->value == NULL) ? -1 : 0;
+}
+
+static int plugin_get_key(void *data, ATTRIBUTE_UNUSED unsigned int node,
+                          unsigned int start, unsigned int end) {
+    struct plugin_get *pg = data;
+    struct state *state = pg->state;
+
+    state->key = tree_string(state, state->text + start, end - start);
+    return (state->key == NULL) ? -1 : 0;
+}
+
+static int plugin_get_value(void *data, unsigned int node) {
+    struct plugin_get *pg = data;
+
+    get_value(pg->nodes[node], pg->state);
+    return (pg->state->value == NULL) ? -1 : 0;
+}
+
+static int plugin_get_label(void *data, unsigned int node) {
+    struct plugin_get *pg = data;
+
+    get_label(pg->nodes[node], pg->state);
+    return (pg->state->key == NULL) ? -1 : 0;
+}
+
+static int plugin_get_seq(void *data, unsigned int node) {
+    struct plugin_get *pg = data;
+
+    get_seq(pg->nodes[node], pg->state);
+    return (pg->state->key == NULL) ? -1 : 0;
+}
+
+static int plugin_get_counter(void *data, unsigned int node) {
+    struct plugin_get *pg = data;
+
+    get_counter(pg->nodes[node], pg->state);
+    return 0;
+}
+
+static const struct augcc_get_ops plugin_get_ops = {
+    .expired = plugin_expired,
+    .enter = plugin_get_enter,
+    .leave = plugin_get_leave,
+    .store = plugin_get_store,
+    .key = plugin_get_key,
+    .value = plugin_get_value,
+    .label = plugin_get_label,
+    .seq = plugin_get_seq,
+    .counter = plugin_get_counter
+};
+
+/* Add SKEL and DICT to what we are parsing for the innermost frame */
+static int plugin_parsed(struct plugin_get *pg, struct skel *skel,
+                         struct dict *dict) {
+    struct plugin_frame *frame = plugin_top(pg);
+
+    if (skel == NULL) {
+        free_dict(dict);
+        return -1;
+    }
+    list_tail_cons(frame->skels, frame->skel_tail, skel);
+    return dict_append(&frame->dict, dict);
+}
+
+static int plugin_parse_enter(void *data, unsigned int node) {
+    struct plugin_get *pg = data;
+    struct plugin_frame *frame = plugin_push(pg);
+
+    if (frame == NULL)
+        return -1;
+    /* Only a L_SUBTREE starts a new key */
+    if (pg->nodes[node]->tag == L_SUBTREE) {
+        frame->key = pg->state->key;
+        pg->state->key = NULL;
+    }
+    return 0;
+}
+
+static int plugin_parse_leave(void *data, unsigned int node) {
+    struct plugin_get *pg = data;
+    struct state *state = pg->state;
+    struct lens *lens = pg->nodes[node];
+    struct plugin_frame *frame = plugin_top(pg);
+    struct skel *skel = NULL;
+    struct dict *dict = NULL;
+
+    if (lens->tag == L_SUBTREE) {
+        dict = make_dict(state->key, frame->skels, frame->dict);
+        if (dict == NULL)
+            return -1;
+        state->key = frame->key;
+        skel = make_skel(lens);
+    } else if (lens->tag == L_MAYBE && frame->skels != NULL) {
+        skel = frame->skels;
+        dict = frame->dict;
+    } else {
+        skel = make_skel(lens);
+        if (skel == NULL)
+            return -1;
+        skel->skels = frame->skels;
+        dict = frame->dict;
+    }
+    pg->nframes -= 1;
+    return plugin_parsed(pg, skel, dict);
+}
+
+static int plugin_parse_del(void *data, unsigned int node,
+                            unsigned int start, unsigned int end) {
+    struct plugin_get *pg = data;
+    struct skel *skel = make_skel(pg->nodes[node]);
+
+    if (skel != NULL) {
+        skel->text = token_range(pg->state->text, start, end);
+        if (skel->text == NULL) {
+            free_skel(skel);
+            skel = NULL;
+        }
+    }
+    return plugin_parsed(pg, skel, NULL);
+}
+
+static int plugin_parse_store(void *data, unsigned int node,
+                              ATTRIBUTE_UNUSED unsigned int start,
+                              ATTRIBUTE_UNUSED unsigned int end) {
+    struct plugin_get *pg = data;
+
+    return plugin_parsed(pg, make_skel(pg->nodes[node]), NULL);
+}
+
+static int plugin_parse_key(void *data, unsigned int node,
+                            unsigned int start, unsigned int end) {
+    struct plugin_get *pg = data;
+
+    if (plugin_get_key(data, node, start, end) < 0)
+        return -1;
+    return plugin_parsed(pg, make_skel(pg->nodes[node]), NULL);
+}
+
+static int plugin_parse_value(void *data, unsigned int node) {
+    struct plugin_get *pg = data;
+
+    return plugin_parsed(pg, make_skel(pg->nodes[node]), NULL);
+}
+
+static int plugin_parse_label(void *data, unsigned int node) {
+    struct plugin_get *pg = data;
+
+    if (plugin_get_label(data, node) < 0)
+        return -1;
+    return plugin_parsed(pg, make_skel(pg->nodes[node]), NULL);
+}
+
+static int plugin_parse_seq(void *data, unsigned int node) {
+    struct plugin_get *pg = data;
+
+    if (plugin_get_seq(data, node) < 0)
+        return -1;
+    return plugin_parsed(pg, make_skel(pg->nodes[node]), NULL);
+}
+
+static int plugin_parse_counter(void *data, unsigned int node) {
+    struct plugin_get *pg = data;
+
+    get_counter(pg->nodes[node], pg->state);
+    return plugin_parsed(pg, make_skel(pg->nodes[node]), NULL);
+}
+
+static const struct augcc_get_ops plugin_parse_ops = {
+    .enter = plugin_parse_enter,
+    .leave = plugin_parse_leave,
+    .open = plugin_parse_enter,
+    .close = plugin_parse_leave,
+    .del = plugin_parse_del,
+    .store = plugin_parse_store,
+    .key = plugin_parse_key,
+    .value = plugin_parse_value,
+    .label = plugin_parse_label,
+    .seq = plugin_parse_seq,
+    .counter = plugin_parse_counter
+};
+
+/* Free everything in the frames of PG, and the key and value of its
+ * state */
+static void plugin_discard(struct plugin_get *pg) {
+    struct state *state = pg->state;
+
+    for (uint i=0; i < pg->nframes; i++) {
+        struct plugin_frame *frame = pg->frames + i;
+        free_tree(frame->trees);
+        while (frame->skels != NULL) {
+            struct skel *del = frame->skels;
+            frame->skels = del->next;
+            free_skel(del);
+        }
+        free_dict(frame->dict);
+        free_tree_string(state, frame->key);
+        free_tree_string(state, frame->value);
+    }
+    free_tree_string(state, state->key);
+    free_tree_string(state, state->value);
+    state->key = NULL;
+    state->value = NULL;
+    state->seqs = NULL;
+}
+
+/* Get the text of STATE, which is SIZE characters long, with the get
+ * routine from the lens plugin for LENS, if there is one. Put the trees
+ * into *TREE, or if SKEL is not NULL, parse the text, and put the skeleton
+ * and dictionary into *SKEL and *DICT. Return true if the routine matched
+ * all of the text; STATE->KEY and STATE->VALUE are then whatever GET_LENS
+ * or PARSE_LENS would have left there. Return false if there is no
+ * routine, or if it gave up, with STATE as it was before */
+static bool plugin_get(struct lens *lens, struct state *state, uint size,
+                       struct tree **tree, struct skel **skel,
+                       struct dict **dict) {
+    const struct augcc_get_ops *ops = (skel == NULL) ? &plugin_get_ops
+                                                     : &plugin_parse_ops;
+    struct plugin_get pg;
+    bool ok = false;
+
+    if (lens->plugin == NULL || state->enable_span || state->stream != NULL)
+        return false;
+
+    MEMZERO(&pg, 1);
+    pg.state = state;
+    pg.nodes = lens->plugin_nodes;
+    if (plugin_push(&pg) == NULL)
+        return false;
+
+    if (lens->plugin->get(ops, &pg, state->text, size) == 0
+        && pg.nframes == 1) {
+        if (skel == NULL) {
+            *tree = pg.frames[0].trees;
+        } else {
+            *skel = pg.frames[0].skels;
+            *dict = pg.frames[0].dict;
+        }
+        ok = true;
+    } else {
+        if (debugging("plugins"))
+            fprintf(stderr, "plugins: falling back to the generic get "
+                    "for %s\n", lens->plugin->name);
+        plugin_discard(&pg);
+        /* Get rid of the memory the trees we threw away used */
+        if (state->slab != NULL) {
+            unref(state->slab, tree_slab);
+            state->slab = make_tree_slab();
+        }
+    }
+    free(pg.frames);
+    return ok;
+}
+
+#if HAVE_PTHREAD
+/*
+ * Chunked get
+ *
+ * Big files are mostly handled by a lens (l)* where every match of l is a
+ * single line, like the ones for /etc/hosts or /etc/fstab. Every newline
+ * in such a file ends a record, and we can split the file after any
+ * newline into chunks, get each of them on its own thread, and
+ * concatenate the trees we get from them.
+ *
+ * The only state that is carried from one record to the next are seqs.
+ * Each chunk numbers its seqs starting from 1, and records which trees it
+ * labelled that way; once all chunks are done, the labels from a chunk
+ * are shifted by how often each seq was used in the chunks before it.
+ * Lenses that reset seqs with a counter are never gotten in chunks.
+ *
+ * Any error in a chunk makes us get the whole file again on one thread,
+ * so that errors are reported exactly as they would be otherwise. Chunks
+ * only ever match with DFAs; where getting a chunk would need RE_MATCH to
+ * fill in registers, that is an error, too. Since that costs about as
+ * much as the chunked get itself, it is counted in the chunk_stats of the
+ * augeas handle and reported with the debug category cf.get.chunks.
+ *
+ * Chunked gets are only done when AUG_PARALLEL_LOAD is set.
+ */
+
+/* Only split a file when every chunk is at least that big; for smaller
+ * chunks, starting threads costs more than it saves */
+#define GET_CHUNK_MIN_SIZE (1024 * 1024)
+/* Never use more threads than that for one file */
+#define GET_CHUNK_MAX 64
+
+struct get_chunk {
+    struct lens  *lens;
+    struct state  state;
+    struct info   info;
+    struct error  error;  /* Out of memory errors from this chunk */
+    struct tree  *tree;
+    pthread_t     thread;
+    bool          started;
+};
+
+/* Return false if the records that LENS matches can not be gotten
+ * independently of each other, or if a regexp in LENS has no DFA.
+ * Otherwise, do all the work that getting LENS would do lazily and that
+ * would modify it, so that LENS can be gotten from several threads at
+ * once, and return true */
+static bool chunk_prepare(struct lens *lens) {
+    const unsigned int *cand;
+
+    if (lens->recursive)
+        return false;
+    if (lens->ctype != NULL
+        && (regexp_prepare(lens->ctype) < 0
+            || regexp_dfa(lens->ctype) == NULL))
+        return false;
+
+    switch (lens->tag) {
+    case L_COUNTER:
+        return false;
+    case L_STAR:
+        star_lines(lens);
+        return chunk_prepare(lens->child);
+    case L_SUBTREE:
+    case L_MAYBE:
+    case L_SQUARE:
+        return chunk_prepare(lens->child);
+    case L_UNION:
+        /* Build the dispatch table now rather than on one of the threads */
+        lns_union_candidates(lens, false, -1, &cand);
+        ATTRIBUTE_FALLTHROUGH;
+    case L_CONCAT:
+        for (int i=0; i < lens->nchildren; i++)
+            if (! chunk_prepare(lens->children[i]))
+                return false;
+        return true;
+    default:
+        return true;
+    }
+}
+
+static int init_chunk(struct get_chunk *chunk, struct lens *lens,
+                      struct state *state, uint start, uint end) {
+    struct state *cs = &chunk->state;
+
+    chunk->lens = lens;
+    chunk->info = *state->info;
+    chunk->info.error = &chunk->error;
+
+    cs->info = &chunk->info;
+    cs->text = state->text;
+    cs->defer_errors = 1;
+    cs->deadline = state->deadline;
+    cs->chunked = 1;
+    cs->arena = make_arena();
+    if (cs->arena == NULL)
+        return -1;
+    cs->slab = make_tree_slab();
+    if (cs->slab == NULL)
+        return -1;
+
+    cs->regs = alloc_regs(cs);
+    if (cs->regs == NULL)
+        return -1;
+    cs->regs->num_regs = 1;
+    if (ALLOC(cs->regs->start) < 0 || ALLOC(cs->regs->end) < 0)
+        return -1;
+    cs->regs->start[0] = start;
+    cs->regs->end[0] = end;
+    return 0;
+}
+
+static void free_chunk(struct get_chunk *chunk) {
+    struct state *cs = &chunk->state;
+
+    free_tree(chunk->tree);
+    free_state_arena(cs);
+    unref(cs->slab, tree_slab);
+    free_dfa_marks(&cs->marks);
+    free(cs->rdfas);
+    free_lns_error(cs->error);
+    free(chunk->error.details);
+}
+
+static void *get_chunk(void *data) {
+    struct get_chunk *chunk = data;
+
+    chunk->tree = get_lens(chunk->lens, &chunk->state);
+    return NULL;
+}
+
+/* Add OFFSET to the number that TREE is labelled with */
+static int seq_relabel(struct tree *tree, int offset) {
+    char buf[3 * sizeof(int) + 2];
+    char *label;
+    int r;
+
+    r = snprintf(buf, sizeof(buf), "%d", atoi(tree->label) + offset);
+    label = tree_slab_strndup(tree->slab, buf, r);
+    if (label == NULL)
+        return -1;
+    tree->label = label;
+    return 0;
+}
+
+static const char *state_filename(struct state *state) {
+    if (state->info->filename == NULL)
+        return "(text)";
+    return state->info->filename->str;
+}
+
+/* Get the L_STAR LENS, which matches all SIZE characters of STATE->TEXT,
+ * in chunks on several threads. Return 1 and the trees in *TREE if that
+ * worked, and 0 if the text needs to be gotten on one thread */
+static int get_chunked(struct lens *lens, struct state *state, uint size,
+                       struct tree **tree) {
+    struct augeas *aug = (struct augeas *) state->info->error->aug;
+    struct get_chunk *chunks = NULL;
+    struct tree *tail = NULL;
+    long ncpus;
+    uint nchunks, start = 0;
+    int result = 0;
+
+    if (lens->tag != L_STAR || lens->recursive
+        || state->enable_span || state->stream != NULL)
+        return 0;
+    if (size < 2 * GET_CHUNK_MIN_SIZE)
+        return 0;
+    if (aug != NULL && aug->chunk_threads > 0)
+        ncpus = aug->chunk_threads;
+    else
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 2)
+        return 0;
+    nchunks = size / GET_CHUNK_MIN_SIZE;
+    if (nchunks > ncpus)
+        nchunks = ncpus;
+    if (nchunks > GET_CHUNK_MAX)
+        nchunks = GET_CHUNK_MAX;
+    if (! star_lines(lens) || ! chunk_prepare(lens->child)) {
+        if (debugging("cf.get.chunks"))
+            fprintf(stderr, "get.chunks: %s: lens can not be gotten "
+                    "in chunks\n", state_filename(state));
+        return 0;
+    }
+
+    if (ALLOC_N(chunks, nchunks) < 0)
+        return 0;
+    for (uint i=0; i < nchunks; i++) {
+        uint end = size;
+        if (i < nchunks - 1) {
+            uint split = (uint64_t) size * (i + 1) / nchunks;
+            const char *nl;
+            if (split < start)
+                split = start;
+            nl = memchr(state->text + split, '\n', size - split);
+            if (nl != NULL)
+                end = nl - state->text + 1;
+        }
+        if (init_chunk(chunks + i, lens, state, start, end) < 0)
+            goto done;
+        start = end;
+    }
+
+    for (uint i=1; i < nchunks; i++)
+        chunks[i].started =
+            pthread_create(&chunks[i].thread, NULL, get_chunk, chunks + i) == 0;
+    get_chunk(chunks);
+    for (uint i=1; i < nchunks; i++) {
+        if (chunks[i].started)
+            pthread_join(chunks[i].thread, NULL);
+        else
+            get_chunk(chunks + i);
+    }
+
+    for (uint i=0; i < nchunks; i++) {
+        struct state *cs = &chunks[i].state;
+        if (cs->error != NULL || chunks[i].error.code != AUG_NOERROR
+            || cs->key != NULL || cs->value != NULL) {
+            if (aug != NULL)
+                aug->chunk_stats.fallbacks += 1;
+            if (debugging("cf.get.chunks"))
+                fprintf(stderr, "get.chunks: %s: chunk %u of %u failed at "
+                        "%d, getting the file on one thread\n",
+                        state_filename(state), i + 1, nchunks,
+                        cs->error != NULL ? cs->error->pos : -1);
+            goto done;
+        }
+    }
+
+    /* Renumber seqs in each chunk after the ones in earlier chunks */
+    for (uint i=0; i < nchunks; i++) {
+        struct state *cs = &chunks[i].state;
+        list_for_each(fixup, cs->fixups) {
+            struct seq *seq = find_seq(fixup->name, state);
+            if (seq == NULL)
+                goto done;
+            if (seq->value > 1 && seq_relabel(fixup->tree, seq->value - 1) < 0)
+                goto done;
+        }
+        list_for_each(s, cs->seqs) {
+            struct seq *seq = find_seq(s->name, state);
+            if (seq == NULL)
+                goto done;
+            seq->value += s->value - 1;
+        }
+    }
+
+    for (uint i=0; i < nchunks; i++) {
+        if (chunks[i].tree != NULL)
+            list_tail_cons(*tree, tail, chunks[i].tree);
+        chunks[i].tree = NULL;
+    }
+    if (aug != NULL) {
+        aug->chunk_stats.files += 1;
+        aug->chunk_stats.chunks += nchunks;
+    }
+    result = 1;
+ done:
+    for (uint i=0; i < nchunks; i++)
+        free_chunk(chunks + i);
+    free(chunks);
+    return result;
+}
+#else
+static int get_chunked(ATTRIBUTE_UNUSED struct lens *lens,
+                       ATTRIBUTE_UNUSED struct state *state,
+                       ATTRIBUTE_UNUSED uint size,
+                       ATTRIBUTE_UNUSED struct tree **tree) {
+    return 0;
+}
+#endif
+
+/* Return false if the trees for a match of LENS might depend on what LENS
+ * or other lenses matched before it, through a seq or a counter */
+static bool get_independent(struct lens *lens) {
+    if (lens->recursive)
+        return false;
+
+    switch (lens->tag) {
+    case L_SEQ:
+    case L_COUNTER:
+        return false;
+    case L_STAR:
+    case L_SUBTREE:
+    case L_MAYBE:
+    case L_SQUARE:
+        return get_independent(lens->child);
+    case L_CONCAT:
+    case L_UNION:
+        for (int i=0; i < lens->nchildren; i++)
+            if (! get_independent(lens->children[i]))
+                return false;
+        return true;
+    default:
+        return true;
+    }
+}
+
+bool lns_get_lines(struct lens *lens) {
+    return lens->tag == L_STAR && ! lens->recursive && star_lines(lens)
+        && get_independent(lens->child);
+}
+
 struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
-                     int enable_span, struct lns_error **err) {
+                     int enable_span, int defer_errors, int parallel,
+                     unsigned int max_time, struct lns_error **err) {
     struct state state;
+    struct timespec deadline;
     struct tree *tree = NULL;
     uint size = strlen(text);
     int partial, r;
 
+    use_plugins(info, lens);
+
     MEMZERO(&state, 1);
     r = ALLOC(state.info);
     ERR_NOMEM(r < 0, info);
+    state.arena = make_arena();
+    ERR_NOMEM(state.arena == NULL, info);
+    state.slab = make_tree_slab();
+    ERR_NOMEM(state.slab == NULL, info);
 
     *state.info = *info;
     state.info->ref = UINT_MAX;
@@ -1625,6 +2908,12 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
     state.text = text;
 
     state.enable_span = enable_span;
+    state.defer_errors = defer_errors;
+
+    if (max_time > 0) {
+        deadline_init(&deadline, max_time);
+        state.deadline = &deadline;
+    }
 
     /* We are probably being overly cautious here: if the lens can't process
      * all of TEXT, we should really fail somewhere in one of the sublenses.
@@ -1632,29 +2921,42 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
      * try to process, hoping we'll get a more specific error, and if that
      * fails, we throw our arms in the air and say 'something went wrong'
      */
-    partial = init_regs(&state, lens, size);
-    if (partial >= 0) {
-        if (lens->recursive)
-            tree = get_rec(lens, &state);
-        else
-            tree = get_lens(lens, &state);
+    /* For lenses other than a L_STAR, INIT_REGS matches all of TEXT, which
+     * the get routine of a plugin does not need, and is not cheap */
+    if (lens->tag != L_STAR
+        && plugin_get(lens, &state, size, &tree, NULL, NULL)) {
+        partial = 0;
+    } else {
+        partial = init_regs(&state, lens, size);
+        if (partial >= 0) {
+            if (lens->recursive)
+                tree = get_rec(lens, &state);
+            else if ((! parallel || ! get_chunked(lens, &state, size, &tree))
+                     && (lens->tag != L_STAR
+                         || ! plugin_get(lens, &state, size, &tree,
+                                         NULL, NULL)))
+                tree = get_lens(lens, &state);
+        }
     }
 
-    free_seqs(state.seqs);
     if (state.key != NULL) {
         get_error(&state, lens, "get left unused key %s", state.key);
-        free(state.key);
+        free_tree_string(&state, state.key);
     }
     if (state.value != NULL) {
         get_error(&state, lens, "get left unused value %s", state.value);
-        free(state.value);
+        free_tree_string(&state, state.value);
     }
     if (partial && state.error == NULL) {
         get_error(&state, lens, "Get did not match entire input");
     }
 
  error:
-    free_regs(&state);
+    free_state_arena(&state);
+    /* The slab lives on as long as any of the nodes in TREE */
+    unref(state.slab, tree_slab);
+    free_dfa_marks(&state.marks);
+    free(state.rdfas);
     FREE(state.info);
 
     if (err != NULL) {
@@ -1669,6 +2971,83 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
     return tree;
 }
 
+int lns_get_stream(struct info *info, struct lens *lens, const char *text,
+                   const struct aug_text_callbacks *cb,
+                   struct lns_error **err) {
+    struct state state;
+    struct tree *tree = NULL;
+    uint size = strlen(text);
+    int partial, r, result = -1;
+
+    use_plugins(info, lens);
+
+    MEMZERO(&state, 1);
+    r = ALLOC(state.info);
+    ERR_NOMEM(r < 0, info);
+    state.arena = make_arena();
+    ERR_NOMEM(state.arena == NULL, info);
+
+    *state.info = *info;
+    state.info->ref = UINT_MAX;
+
+    state.text = text;
+    state.stream = cb;
+
+    partial = init_regs(&state, lens, size);
+    if (partial >= 0) {
+        if (lens->recursive) {
+            /* Recursive lenses are processed by the jmt parser, which
+             * builds the whole tree anyway */
+            state.stream = NULL;
+            tree = get_rec(lens, &state);
+            state.stream = cb;
+            if (state.error == NULL)
+                stream_trees(&state, tree);
+            else
+                free_tree(tree);
+        } else {
+            tree = get_lens(lens, &state);
+            /* Subtrees at the top level are streamed right away, but the
+             * lens might not produce any subtrees */
+            stream_trees(&state, tree);
+        }
+        tree = NULL;
+    }
+
+    if (state.stopped) {
+        free_lns_error(state.error);
+        state.error = NULL;
+    }
+    if (state.key != NULL) {
+        if (! state.stopped)
+            get_error(&state, lens, "get left unused key %s", state.key);
+        free_tree_string(&state, state.key);
+    }
+    if (state.value != NULL) {
+        if (! state.stopped)
+            get_error(&state, lens, "get left unused value %s", state.value);
+        free_tree_string(&state, state.value);
+    }
+    if (partial && state.error == NULL && ! state.stopped) {
+        get_error(&state, lens, "Get did not match entire input");
+    }
+
+    if (state.error == NULL)
+        result = state.stopped;
+ error:
+    free_state_arena(&state);
+    free_dfa_marks(&state.marks);
+    free(state.rdfas);
+    FREE(state.info);
+
+    if (err != NULL) {
+        *err = state.error;
+    } else {
+        free_lns_error(state.error);
+    }
+    return result;
+}
+
 static struct skel *parse_lens(struct lens *lens, struct state *state,
                                struct dict **dict) {
     struct skel *skel = NULL;
@@ -1728,24 +3107,32 @@ struct skel *lns_parse(struct lens *lens, const char *text, struct dict **dict,
     uint size = strlen(text);
     int partial, r;
 
+    use_plugins(lens->info, lens);
+
     MEMZERO(&state, 1);
     r = ALLOC(state.info);
     ERR_NOMEM(r< 0, lens->info);
+    state.arena = make_arena();
+    ERR_NOMEM(state.arena == NULL, lens->info);
     state.info->ref = UINT_MAX;
     state.info->error = lens->info->error;
     state.text = text;
 
     state.text = text;
 
-    partial = init_regs(&state, lens, size);
+    *dict = NULL;
+    if (plugin_get(lens, &state, size, NULL, &skel, dict)) {
+        partial = 0;
+    } else {
+        partial = init_regs(&state, lens, size);
+        if (! partial) {
+            if (lens->recursive)
+                skel = parse_rec(lens, &state, dict);
+            else
+                skel = parse_lens(lens, &state, dict);
+        }
+    }
     if (! partial) {
-        *dict = NULL;
-        if (lens->recursive)
-            skel = parse_rec(lens, &state, dict);
-        else
-            skel = parse_lens(lens, &state, dict);
-
-        free_seqs(state.seqs);
         if (state.error != NULL) {
             free_skel(skel);
             skel = NULL;
@@ -1754,11 +3141,11 @@ struct skel *lns_parse(struct lens *lens, const char *text, struct dict **dict,
         }
         if (state.key != NULL) {
             get_error(&state, lens, "parse left unused key %s", state.key);
-            free(state.key);
+            free_tree_string(&state, state.key);
         }
         if (state.value != NULL) {
             get_error(&state, lens, "parse left unused value %s", state.value);
-            free(state.value);
+            free_tree_string(&state, state.value);
         }
     } else {
         // This should never happen during lns_parse
@@ -1766,7 +3153,9 @@ struct skel *lns_parse(struct lens *lens, const char *text, struct dict **dict,
     }
 
  error:
-    free_regs(&state);
+    free_state_arena(&state);
+    free_dfa_marks(&state.marks);
+    free(state.rdfas);
     FREE(state.info);
     if (err != NULL) {
         *err = state.error;
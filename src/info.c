@@ -141,6 +141,7 @@ void free_span(struct span *span) {
     if (span == NULL)
         return;
     unref(span->filename, string);
+    free(span->text);
     free(span);
 }
 
@@ -168,6 +169,23 @@ void update_span(struct span *node_info, int x, int y) {
     }
 }
 
+/* Move all positions in NODE_INFO by DELTA. The label and value have
+ * positions (0, 0) when the node has none, and those are left alone */
+void shift_span(struct span *node_info, int delta) {
+    if (node_info == NULL || node_info->span_start == UINT_MAX)
+        return;
+    if (node_info->label_start != 0 || node_info->label_end != 0) {
+        node_info->label_start += delta;
+        node_info->label_end += delta;
+    }
+    if (node_info->value_start != 0 || node_info->value_end != 0) {
+        node_info->value_start += delta;
+        node_info->value_end += delta;
+    }
+    node_info->span_start += delta;
+    node_info->span_end += delta;
+}
+
 /*
  * Local variables:
  *  indent-tabs-mode: nil
@@ -62,6 +62,10 @@ struct span {
     uint value_end;
     uint span_start;
     uint span_end;
+    /* Only for the span of a file node: the text of the file that its
+     * tree was gotten from, so that reloading the file only needs to get
+     * what changed */
+    char *text;
 };
 
 char *format_info(struct info *info);
@@ -78,6 +82,7 @@ void free_info(struct info *info);
 struct span *make_span(struct info *info);
 void free_span(struct span *node_info);
 void update_span(struct span *node_info, int x, int y);
+void shift_span(struct span *node_info, int delta);
 void print_span(struct span *node_info);
 #endif
 
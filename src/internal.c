@@ -470,6 +470,26 @@ int xstrtoint64(char const *s, int base, int64_t *result) {
     return 0;
 }
 
+void deadline_init(struct timespec *deadline, unsigned int msec) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += msec / 1000;
+    deadline->tv_nsec += (msec % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec += 1;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+bool deadline_passed(const struct timespec *deadline) {
+    struct timespec now;
+
+    if (deadline == NULL)
+        return false;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > deadline->tv_sec
+        || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
 void calc_line_ofs(const char *text, size_t pos, size_t *line, size_t *ofs) {
     *line = 1;
     *ofs = 0;
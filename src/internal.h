@@ -24,6 +24,7 @@
 #define INTERNAL_H_
 
 #include "list.h"
+#include "ref.h"
 #include "datadir.h"
 #include "augeas.h"
 
@@ -37,6 +38,7 @@
 #include <assert.h>
 #include <locale.h>
 #include <stdint.h>
+#include <time.h>
 
 /*
  * Various parameters about env vars, special tree nodes etc.
@@ -103,11 +105,42 @@
  * Enable or disable node indexes */
 #define AUGEAS_SPAN_OPTION AUGEAS_META_TREE "/span"
 
+/* Define: AUGEAS_CACHE_OPTION
+ * Directory for the persistent cache of parsed trees; the cache is
+ * disabled if this is not set */
+#define AUGEAS_CACHE_OPTION AUGEAS_META_TREE "/cache"
+
+/* Define: AUGEAS_CACHE_ENV
+ * Name of env var that contains the initial value of AUGEAS_CACHE_OPTION.
+ * It is ignored in setuid and setgid programs */
+#define AUGEAS_CACHE_ENV "AUGEAS_CACHE_DIR"
+
+/* Define: AUGEAS_LIMITS
+ * Budgets for loading individual files. Files that exceed them are
+ * skipped and an error is recorded for them under /augeas/files. Limits
+ * that are not a nonnegative number get an error child and are ignored */
+#define AUGEAS_LIMITS AUGEAS_META_TREE "/limits"
+
+/* Define: AUGEAS_LIMIT_SIZE
+ * The largest file, in bytes, that aug_load will read */
+#define AUGEAS_LIMIT_SIZE AUGEAS_LIMITS "/size"
+
+/* Define: AUGEAS_LIMIT_TIME
+ * The longest time, in milliseconds, that aug_load will spend parsing
+ * one file */
+#define AUGEAS_LIMIT_TIME AUGEAS_LIMITS "/time"
+
 /* Define: AUGEAS_LENS_ENV
  * Name of env var that contains list of paths to search for additional
    spec files */
 #define AUGEAS_LENS_ENV "AUGEAS_LENS_LIB"
 
+/* Define: AUGEAS_PLUGINS_ENV
+ * Name of env var that contains the list of lens plugins generated by
+ * augcc to load, separated by ':'. It is ignored in setuid and setgid
+ * programs */
+#define AUGEAS_PLUGINS_ENV "AUGEAS_LENS_PLUGINS"
+
 /* Define: MAX_ENV_SIZE
  * Fairly arbitrary bound on the length of the path we
  *  accept from AUGEAS_SPEC_ENV */
@@ -340,6 +373,12 @@ int xasprintf(char **strp, const char *format, ...);
 /* Convert S to RESULT with error checking */
 int xstrtoint64(char const *s, int base, int64_t *result);
 
+/* Set DEADLINE to MSEC milliseconds from now */
+void deadline_init(struct timespec *deadline, unsigned int msec);
+
+/* Return true if DEADLINE has passed. A NULL DEADLINE never passes */
+bool deadline_passed(const struct timespec *deadline);
+
 /* Calculate line and column number of character POS in TEXT */
 void calc_line_ofs(const char *text, size_t pos, size_t *line, size_t *ofs);
 
@@ -356,6 +395,26 @@ char *cleanpath(char *path);
  */
 int regexp_c_locale(char **u, size_t *len);
 
+/* Counts of the work done by the jmt parser for recursive lenses, summed
+ * over all parses with one augeas handle. Only test-perf looks at them,
+ * by reading the jmt_stats of a handle directly */
+struct jmt_stats {
+    unsigned long parses;
+    unsigned long items;        /* Earley items added to item sets */
+    unsigned long links;        /* Reasons recorded for the items */
+    unsigned long compactions;  /* Times a chart was compacted */
+    size_t        max_bytes;    /* Most memory used by a single parse */
+};
+
+/* Counts of the files that were gotten in chunks on several threads with
+ * AUG_PARALLEL_LOAD, summed over all loads with one augeas handle */
+struct chunk_stats {
+    unsigned long files;        /* Files gotten in chunks */
+    unsigned long chunks;       /* Chunks those files were split into */
+    unsigned long fallbacks;    /* Files gotten again on one thread
+                                 * because a chunk failed */
+};
+
 /* Struct: augeas
  * The data structure representing a connection to Augeas. */
 struct augeas {
@@ -371,6 +430,21 @@ struct augeas {
     struct error        *error;
     uint                api_entries;  /* Number of entries through a public
                                        * API, 0 when called from outside */
+    struct xfm_cache    *xfm_cache;   /* Compiled filters for the
+                                       * transforms in /augeas/load */
+    struct lens_plugins *plugins;     /* Loaded lens plugins */
+    uint                deferred_errors;  /* Number of errors recorded
+                                           * with AUG_DEFER_ERRORS that
+                                           * still need to be diagnosed */
+    struct jmt_stats    jmt_stats;
+    unsigned long       jmt_compact_min;  /* Compaction threshold for the
+                                           * jmt parser, 0 for the
+                                           * default; only test-perf
+                                           * changes it */
+    struct chunk_stats  chunk_stats;
+    long                chunk_threads;    /* Most threads for a chunked
+                                           * get, 0 for one per CPU;
+                                           * only test-load changes it */
 #if HAVE_USELOCALE
     /* On systems that have a uselocale call, we switch to the C locale
      * on entry into API functions, and back to the old user locale
@@ -387,9 +461,19 @@ static inline struct error *err_of_aug(const struct augeas *aug) {
     return ((struct augeas *) aug)->error;
 }
 
+/* Diagnose the errors from loading files with AUG_DEFER_ERRORS fully
+ * unless PATH can only refer to nodes underneath /files. Every public API
+ * function that takes a path calls this first */
+void diagnose_deferred_errors(const struct augeas *aug, const char *path);
+
 /* Used by augparse for loading tests */
 int __aug_load_module_file(struct augeas *aug, const char *filename);
 
+/* Used by augcc to write the C source of a lens plugin for the NLENSES
+ * lenses in LENSES to OUT */
+int __aug_write_lens_plugin(struct augeas *aug, FILE *out,
+                            int nlenses, char *const *lenses);
+
 /* Called at beginning and end of every _public_ API function */
 void api_entry(const struct augeas *aug);
 void api_exit(const struct augeas *aug);
@@ -414,6 +498,12 @@ void api_exit(const struct augeas *aug);
  * underneath /files for the toplevel node corresponding to a file by
  * TREE_FREPLACE and is used by AUG_SOURCE to find the file to which a node
  * belongs.
+ *
+ * Nodes made by MAKE_TREE_IN live in a SLAB, shared with all the other
+ * nodes that one LNS_GET produced. The SLAB_LABEL and SLAB_VALUE flags
+ * indicate that LABEL and VALUE are also in that slab, and must not be
+ * freed; code that changes them should use TREE_UNSLAB_LABEL and
+ * TREE_UNSLAB_VALUE first.
  */
 struct tree {
     struct tree *next;
@@ -422,12 +512,17 @@ struct tree {
     struct tree *children;   /* List of children through NEXT */
     char        *value;
     struct span *span;
+    struct tree_slab *slab;  /* NULL if the node was made with MAKE_TREE */
 
     /* Flags */
     bool         dirty;
     bool         file;
     bool         added;      /* only used by ns_add and tree_rm to dedupe
                                 nodesets */
+    bool         slab_label;
+    bool         slab_value;
+    bool         deferred;   /* only used for error nodes underneath
+                                /augeas/files, see TRANSFORM_DIAGNOSE */
 };
 
 /* The opaque structure used to represent path expressions. API's
@@ -446,6 +541,37 @@ struct pathx;
 struct tree *make_tree(char *label, char *value,
                        struct tree *parent, struct tree *children);
 
+/* Struct: tree_slab
+ * Bulk storage for the nodes, labels and values of the trees made by one
+ * LNS_GET. The slab is freed when the last node in it is freed.
+ */
+struct tree_slab {
+    ref_t         ref;
+    struct arena *arena;
+};
+
+struct tree_slab *make_tree_slab(void);
+void free_tree_slab(struct tree_slab *slab);
+
+/* Copy the first LEN characters of STR into SLAB as a nul terminated
+ * string, suitable as the label or value of a node made with
+ * MAKE_TREE_IN */
+char *tree_slab_strndup(struct tree_slab *slab, const char *str, size_t len);
+
+/* Function: make_tree_in
+ * Like MAKE_TREE, but allocate the node from SLAB. LABEL and VALUE must
+ * either be NULL or have been allocated with TREE_SLAB_STRNDUP from
+ * SLAB.
+ */
+struct tree *make_tree_in(struct tree_slab *slab, char *label, char *value,
+                          struct tree *parent, struct tree *children);
+
+/* Make sure the label and value of TREE are malloc'd strings that TREE
+ * owns, by copying them out of TREE's slab if needed. Return -1 if
+ * allocation fails, 0 otherwise */
+int tree_unslab_label(struct tree *tree);
+int tree_unslab_value(struct tree *tree);
+
 /* Mark a tree as a standalone tree; this creates a fake parent for ROOT,
  * so that even ROOT has a parent. A new node with only child ROOT is
  * returned on success, and NULL on failure.
@@ -23,6 +23,7 @@
 #include <config.h>
 
 #include "jmt.h"
+#include "augcc.h"
 #include "internal.h"
 #include "memory.h"
 #include "errcode.h"
@@ -181,15 +182,19 @@ struct nfa_state {
 
 /* For recursive lenses (nonterminals), the mapping of nonterminal to
  * state. We also store nonrecursive lenses here; in that case, the state
- * will be NULL */
+ * will be NULL. STATE is only used while building the transducer, and
+ * might be gone afterwards; NONTERMINAL says whether there was one */
 struct jmt_lens {
     struct lens  *lens;
     struct state *state;
+    bool          nonterminal;
 };
 
-/* A Jim/Mandelbaum transducer */
+/* A Jim/Mandelbaum transducer. Once built, it is never modified, and
+ * parsing with it does not modify it either, so that one transducer can be
+ * used for any number of parses, even at the same time */
 struct jmt {
-    struct error *error;
+    struct error *error;       /* Only used while building */
     struct array lenses;       /* Array of struct jmt_lens */
     struct state *start;
     ind_t  lens;               /* The start symbol of the grammar */
@@ -200,11 +205,18 @@ enum item_reason {
     R_ROOT = 1,
     R_COMPLETE = R_ROOT << 1,
     R_PREDICT = R_COMPLETE << 1,
-    R_SCAN = R_PREDICT << 1
+    R_SCAN = R_PREDICT << 1,
+    R_LEO = R_SCAN << 1
 };
 
 /* The reason an item was added for parse reconstruction; can be R_SCAN,
- * R_COMPLETE, R_PREDICT or R_COMPLETE|R_PREDICT */
+ * R_COMPLETE, R_PREDICT or R_COMPLETE|R_PREDICT.
+ *
+ * R_COMPLETE|R_LEO marks the topmost item of a chain of deterministic
+ * completions (see LEO_TOP) that we did not add to the parse. Such a link
+ * only records how the chain started, and is turned into an ordinary
+ * R_COMPLETE link by LEO_EXPAND before the parse tree is built: LENS was
+ * completed by item TO_ITEM, starting in E_{FROM_SET}. FROM_ITEM is EPS */
 struct link {
     enum item_reason reason;
     ind_t            lens;       /* R_COMPLETE, R_SCAN */
@@ -218,13 +230,77 @@ struct item {
     /* The 'classical' Earley item (state, parent) */
     struct state    *state;
     ind_t            parent;
-    /* Backlinks to why item was added */
+    /* Backlinks to why item was added. Allocated from the arena of the
+     * parse, see ITEM_ADD_LINK */
     ind_t            nlinks;
     struct link     *links;
 };
 
+/* A link in ITEMS of a struct item_set, as found through its LINKS
+ * index */
+struct link_ref {
+    ind_t item;
+    ind_t link;
+};
+
+/* An item in an item set that has a transition on the nonterminal LENS
+ * to state TO. Completing LENS from the item set adds (TO, p) where p is
+ * the parent of ITEM */
+struct waiting {
+    ind_t         lens;
+    ind_t         item;
+    struct state *to;
+};
+
+/* The COUNT items in an item set that wait for the nonterminal LENS,
+ * starting at FIRST in its WAITING.
+ *
+ * When there is only one such item, and its transition on LENS leads to a
+ * state without any transitions, completing LENS is a deterministic step
+ * in the sense of Leo's "A general context-free parsing algorithm running
+ * in linear time on every LR(k) grammar without using lookahead": the new
+ * item can not do anything but complete in turn. A right-recursive lens
+ * produces long chains of such steps, one for each level of nesting, that
+ * all have to be taken again in each item set in which the innermost
+ * nonterminal completes, making parsing quadratic in the nesting
+ * depth. Instead, we only add the topmost item TOP and TOP_PARENT of the
+ * chain, which we compute once per group. TOP is NULL until then, and
+ * LEO_BUSY while we are computing it.
+ */
+struct waiting_group {
+    ind_t         lens;
+    ind_t         first;
+    ind_t         count;
+    struct state *top;
+    ind_t         top_parent;
+};
+
+/* ITEMS is indexed by (state, parent) in the hash table ITEM_INDEX, and
+ * the links of all items in ITEMS by all their fields in LINK_INDEX, so
+ * that adding an item or a link does not need to look at all the items
+ * and links that are already in the set. Both tables use open addressing
+ * with linear probing; their sizes are powers of 2, and they are grown so
+ * that they are never more than half full. Empty slots in ITEM_INDEX
+ * are IND_MAX, and in LINK_INDEX have ITEM == IND_MAX.
+ */
 struct item_set {
-    struct array items;
+    struct array     items;         /* Allocated from the arena of the parse */
+    ind_t           *item_index;
+    ind_t            item_index_size;
+    struct link_ref *link_index;
+    ind_t            link_index_size;
+    ind_t            nlinks;       /* Links in all items */
+    /* The items waiting for a nonterminal, sorted by nonterminal, and
+     * grouped by nonterminal in GROUPS. Built when the set is complete,
+     * the first time a nonterminal that started in it completes */
+    bool                  waiting_indexed;
+    struct waiting       *waiting;
+    struct waiting_group *groups;
+    ind_t                 ngroups;
+    /* Used by PARSE_COMPACT while it marks the items that are still
+     * needed, see there */
+    ind_t                *map;
+    bool                  waiting_marked;
 };
 
 struct jmt_parse {
@@ -233,6 +309,25 @@ struct jmt_parse {
     const char       *text;
     ind_t             nsets;
     struct item_set **sets;
+    ind_t             last_set;     /* No set after this one has items */
+    bool              all_matches;  /* SCAN every match, not the longest */
+    unsigned long     nitems;       /* Items and links added, and how */
+    unsigned long     nlinks;       /* often we compacted, for the */
+    unsigned long     ncompactions; /* jmt_stats of the augeas handle */
+    /* PARSE_COMPACT has dealt with the sets before COMPACTED for good;
+     * they hold KEPT items and links, and KEPT_SETS sets. LIVE counts the
+     * items and links in all other sets */
+    ind_t             compacted;
+    unsigned long     kept;
+    unsigned long     kept_sets;
+    unsigned long     live;
+    unsigned long     compact_min;  /* Compact once LIVE reaches this */
+    size_t            max_bytes;    /* Most memory used at any one time */
+    /* New items and links are allocated from ARENA. PARSE_COMPACT copies
+     * the ones that it keeps into KEPT_ARENA, and the ones in the sets
+     * it has not dealt with yet into a new ARENA */
+    struct arena     *arena;
+    struct arena     *kept_arena;
 };
 
 #define for_each_item(it, set)                                  \
@@ -274,6 +369,193 @@ static struct lens *lens_of_parse(struct jmt_parse *parse, ind_t lens) {
     return array_elem(parse->jmt->lenses, lens, struct jmt_lens)->lens;
 }
 
+static bool is_nonterminal(struct jmt *jmt, ind_t lens) {
+    return array_elem(jmt->lenses, lens, struct jmt_lens)->nonterminal;
+}
+
+/*
+ * Hash tables for item sets
+ */
+
+static uint32_t hash_add(uint32_t h, uint32_t v) {
+    h ^= v;
+    h *= 0x9e3779b1;
+    return h ^ (h >> 16);
+}
+
+static uint32_t item_hash(const struct state *s, ind_t parent) {
+    uintptr_t p = (uintptr_t) s;
+    uint32_t h = hash_add(0, (uint32_t) p);
+
+    if (sizeof(p) > sizeof(uint32_t))
+        h = hash_add(h, (uint32_t) (p >> 31 >> 1));
+    return hash_add(h, parent);
+}
+
+static uint32_t link_hash(ind_t item, const struct link *lnk) {
+    uint32_t h = hash_add(0, item);
+
+    h = hash_add(h, lnk->reason);
+    h = hash_add(h, lnk->lens);
+    h = hash_add(h, lnk->from_set);
+    h = hash_add(h, lnk->from_item);
+    h = hash_add(h, lnk->to_item);
+    return hash_add(h, lnk->caller);
+}
+
+static bool link_equal(const struct link *l1, const struct link *l2) {
+    return l1->reason == l2->reason && l1->lens == l2->lens
+        && l1->from_set == l2->from_set && l1->from_item == l2->from_item
+        && l1->to_item == l2->to_item && l1->caller == l2->caller;
+}
+
+/* Return the index of item (s, parent) in SET, or IND_MAX if there is no
+ * such item */
+static ind_t set_find_item(struct item_set *set,
+                           const struct state *s, ind_t parent) {
+    ind_t mask = set->item_index_size - 1;
+
+    if (set->item_index_size == 0)
+        return IND_MAX;
+    for (ind_t h = item_hash(s, parent) & mask;
+         set->item_index[h] != IND_MAX; h = (h + 1) & mask) {
+        struct item *x = array_elem(set->items, set->item_index[h],
+                                    struct item);
+        if (x->state == s && x->parent == parent)
+            return set->item_index[h];
+    }
+    return IND_MAX;
+}
+
+static void set_put_item(struct item_set *set, ind_t item) {
+    struct item *x = array_elem(set->items, item, struct item);
+    ind_t mask = set->item_index_size - 1;
+    ind_t h = item_hash(x->state, x->parent) & mask;
+
+    while (set->item_index[h] != IND_MAX)
+        h = (h + 1) & mask;
+    set->item_index[h] = item;
+}
+
+/* Add the item with index ITEM in SET to the index of items */
+ATTRIBUTE_RETURN_CHECK
+static int set_index_item(struct item_set *set, ind_t item) {
+    if (2 * set->items.used > set->item_index_size) {
+        ind_t size = set->item_index_size == 0 ? 16
+            : 2 * set->item_index_size;
+        if (REALLOC_N(set->item_index, size) < 0)
+            return -1;
+        set->item_index_size = size;
+        for (ind_t h = 0; h < size; h++)
+            set->item_index[h] = IND_MAX;
+        /* ITEM itself is among the items that we put back here */
+        for (ind_t i = 0; i < set->items.used; i++)
+            set_put_item(set, i);
+        return 0;
+    }
+    set_put_item(set, item);
+    return 0;
+}
+
+/* Return true if the item with index ITEM in SET has a link equal to LNK */
+static bool set_find_link(struct item_set *set, ind_t item,
+                          const struct link *lnk) {
+    ind_t mask = set->link_index_size - 1;
+
+    if (set->link_index_size == 0)
+        return false;
+    for (ind_t h = link_hash(item, lnk) & mask;
+         set->link_index[h].item != IND_MAX; h = (h + 1) & mask) {
+        struct link_ref *ref = set->link_index + h;
+        if (ref->item == item) {
+            struct item *x = array_elem(set->items, item, struct item);
+            if (link_equal(x->links + ref->link, lnk))
+                return true;
+        }
+    }
+    return false;
+}
+
+static void set_put_link(struct item_set *set, ind_t item, ind_t link) {
+    struct item *x = array_elem(set->items, item, struct item);
+    ind_t mask = set->link_index_size - 1;
+    ind_t h = link_hash(item, x->links + link) & mask;
+
+    while (set->link_index[h].item != IND_MAX)
+        h = (h + 1) & mask;
+    set->link_index[h].item = item;
+    set->link_index[h].link = link;
+}
+
+/* Add the link with index LINK of the item with index ITEM in SET to the
+ * index of links */
+ATTRIBUTE_RETURN_CHECK
+static int set_index_link(struct item_set *set, ind_t item, ind_t link) {
+    set->nlinks += 1;
+    if (2 * set->nlinks > set->link_index_size) {
+        ind_t size = set->link_index_size == 0 ? 16
+            : 2 * set->link_index_size;
+        if (REALLOC_N(set->link_index, size) < 0)
+            return -1;
+        set->link_index_size = size;
+        for (ind_t h = 0; h < size; h++)
+            set->link_index[h].item = IND_MAX;
+        for (ind_t i = 0; i < set->items.used; i++) {
+            struct item *x = array_elem(set->items, i, struct item);
+            for (ind_t l = 0; l < x->nlinks; l++)
+                set_put_link(set, i, l);
+        }
+        return 0;
+    }
+    set_put_link(set, item, link);
+    return 0;
+}
+
+/* Build the indexes of items and links of SET from scratch; used when
+ * they were dropped by SET_DROP_INDEX */
+ATTRIBUTE_RETURN_CHECK
+static int set_build_index(struct item_set *set) {
+    ind_t size = 16;
+
+    while (size < 2 * set->items.used)
+        size *= 2;
+    if (REALLOC_N(set->item_index, size) < 0)
+        return -1;
+    set->item_index_size = size;
+    for (ind_t h = 0; h < size; h++)
+        set->item_index[h] = IND_MAX;
+    for (ind_t i = 0; i < set->items.used; i++)
+        set_put_item(set, i);
+
+    set->nlinks = 0;
+    for_each_item(x, set)
+        set->nlinks += x->nlinks;
+    size = 16;
+    while (size < 2 * set->nlinks)
+        size *= 2;
+    if (REALLOC_N(set->link_index, size) < 0)
+        return -1;
+    set->link_index_size = size;
+    for (ind_t h = 0; h < size; h++)
+        set->link_index[h].item = IND_MAX;
+    for (ind_t i = 0; i < set->items.used; i++) {
+        struct item *x = array_elem(set->items, i, struct item);
+        for (ind_t l = 0; l < x->nlinks; l++)
+            set_put_link(set, i, l);
+    }
+    return 0;
+}
+
+/* Drop the indexes of SET after its items or links were moved around;
+ * PARSE_ADD_ITEM rebuilds them when it next needs them */
+static void set_drop_index(struct item_set *set) {
+    FREE(set->item_index);
+    FREE(set->link_index);
+    set->item_index_size = 0;
+    set->link_index_size = 0;
+    set->nlinks = 0;
+}
+
 /*
  * The parser
  */
@@ -286,6 +568,53 @@ static struct lens *lens_of_parse(struct jmt_parse *parse, ind_t lens) {
  * item_l in E_l.
  */
 
+/* Add a new item to SET and store its index in IND. The items of a set
+ * are allocated from the arena of the parse, and doubled in number when
+ * they run out; the old items are only freed with the arena */
+ATTRIBUTE_RETURN_CHECK
+static int set_add_item(struct jmt_parse *parse, struct item_set *set,
+                        ind_t *ind) {
+    struct array *items = &set->items;
+
+    if (items->used >= items->size) {
+        ind_t size = items->size < 8 ? 8 : 2 * items->size;
+        struct item *data = NULL;
+
+        if (ARENA_ALLOC_N(parse->arena, data, size) < 0)
+            return -1;
+        if (items->used > 0)
+            memcpy(data, items->data, items->used * sizeof(*data));
+        items->data = data;
+        items->size = size;
+    }
+    *ind = items->used;
+    items->used += 1;
+    return 0;
+}
+
+/* Append LNK to the links of ITEM. The links are allocated from the arena
+ * of the parse, and their number is doubled whenever NLINKS reaches a
+ * power of 2. LEO_EXPAND may remove links, which only leaves more room
+ * than that. */
+ATTRIBUTE_RETURN_CHECK
+static int item_add_link(struct jmt_parse *parse, struct item *item,
+                         const struct link *lnk) {
+    ind_t n = item->nlinks;
+
+    if ((n & (n - 1)) == 0) {
+        struct link *links = NULL;
+
+        if (ARENA_ALLOC_N(parse->arena, links, n == 0 ? 1 : 2 * n) < 0)
+            return -1;
+        if (n > 0)
+            memcpy(links, item->links, n * sizeof(*links));
+        item->links = links;
+    }
+    item->links[n] = *lnk;
+    item->nlinks = n + 1;
+    return 0;
+}
+
 /* Add item (s, k) to E_j. Note that the item was caused by action reason
  * using lens starting at from_item in E_{from_set}
  *
@@ -302,6 +631,10 @@ static ind_t parse_add_item(struct jmt_parse *parse, ind_t j,
     struct item_set *set = parse->sets[j];
     struct item *item = NULL;
     ind_t result = IND_MAX;
+    struct link new_link = {
+        .reason = reason, .lens = lens, .from_set = from_set,
+        .from_item = from_item, .to_item = to_item, .caller = caller
+    };
 
     ensure(from_item == EPS || from_item < parse->sets[from_set]->items.used,
            parse);
@@ -313,46 +646,38 @@ static ind_t parse_add_item(struct jmt_parse *parse, ind_t j,
         ERR_NOMEM(r < 0, parse);
         array_init(&parse->sets[j]->items, sizeof(struct item));
         set = parse->sets[j];
+        if (j > parse->last_set)
+            parse->last_set = j;
+    } else if (set->item_index_size == 0) {
+        r = set_build_index(set);
+        ERR_NOMEM(r < 0, parse);
     }
 
-    for (ind_t i=0; i < set->items.used; i++) {
-        if (item_state(parse, j, i) == s
-            && item_parent(parse, j, i) == k) {
-            result = i;
-            item = set_item(parse, j, i);
-            break;
-        }
-    }
-
+    result = set_find_item(set, s, k);
     if (result == IND_MAX) {
-        r = array_add(&set->items, &result);
+        r = set_add_item(parse, set, &result);
         ERR_NOMEM(r < 0, parse);
 
         item = set_item(parse, j, result);
         item->state = s;
         item->parent = k;
-    }
-
-    for (ind_t i = 0; i < item->nlinks; i++) {
-        struct link *lnk = item->links + i;
-        if (lnk->reason == reason && lnk->lens == lens
-            && lnk->from_set == from_set && lnk->from_item == from_item
-            && lnk->to_item == to_item && lnk->caller == caller)
+        r = set_index_item(set, result);
+        ERR_NOMEM(r < 0, parse);
+        parse->nitems += 1;
+        parse->live += 1;
+    } else {
+        item = set_item(parse, j, result);
+        if (set_find_link(set, result, &new_link))
             return result;
     }
 
-    r = REALLOC_N(item->links, item->nlinks + 1);
+    r = item_add_link(parse, item, &new_link);
     ERR_NOMEM(r < 0, parse);
+    parse->nlinks += 1;
+    parse->live += 1;
 
-    struct link *lnk = item->links+ item->nlinks;
-    item->nlinks += 1;
-
-    lnk->reason = reason;
-    lnk->lens = lens;
-    lnk->from_set = from_set;
-    lnk->from_item = from_item;
-    lnk->to_item = to_item;
-    lnk->caller = caller;
+    r = set_index_link(set, result, item->nlinks - 1);
+    ERR_NOMEM(r < 0, parse);
  error:
     return result;
 }
@@ -464,20 +789,283 @@ static void state_merge_returns(struct jmt *jmt, struct state *dst,
         state_add_return(jmt, dst, src->ret[l]);
 }
 
+static int waiting_cmp(const void *p1, const void *p2) {
+    const struct waiting *w1 = p1;
+    const struct waiting *w2 = p2;
+
+    if (w1->lens != w2->lens)
+        return w1->lens < w2->lens ? -1 : 1;
+    if (w1->item != w2->item)
+        return w1->item < w2->item ? -1 : 1;
+    return 0;
+}
+
+/* Build the index of items waiting for a nonterminal in E_k. E_k must be
+ * complete */
+static void set_index_waiting(struct jmt_parse *parse, ind_t k) {
+    struct item_set *set = parse->sets[k];
+    ind_t nwaiting = 0;
+    int r;
+
+    set->waiting_indexed = true;
+    for_each_item(x, set) {
+        for_each_trans(y, x->state) {
+            if (y->lens <= LENS_MAX && is_nonterminal(parse->jmt, y->lens))
+                nwaiting += 1;
+        }
+    }
+    if (nwaiting == 0)
+        return;
+
+    r = ALLOC_N(set->waiting, nwaiting);
+    ERR_NOMEM(r < 0, parse);
+    nwaiting = 0;
+    array_for_each(i, set->items) {
+        struct item *x = array_elem(set->items, i, struct item);
+        for_each_trans(y, x->state) {
+            if (y->lens <= LENS_MAX && is_nonterminal(parse->jmt, y->lens)) {
+                set->waiting[nwaiting].lens = y->lens;
+                set->waiting[nwaiting].item = i;
+                set->waiting[nwaiting].to = y->to;
+                nwaiting += 1;
+            }
+        }
+    }
+    /* Transducers are deterministic, so (lens, item) is unique */
+    qsort(set->waiting, nwaiting, sizeof(*set->waiting), waiting_cmp);
+
+    for (ind_t i=0; i < nwaiting; i++)
+        if (i == 0 || set->waiting[i].lens != set->waiting[i-1].lens)
+            set->ngroups += 1;
+    r = ALLOC_N(set->groups, set->ngroups);
+    ERR_NOMEM(r < 0, parse);
+    set->ngroups = 0;
+    for (ind_t i=0; i < nwaiting; i++) {
+        if (i == 0 || set->waiting[i].lens != set->waiting[i-1].lens) {
+            set->groups[set->ngroups].lens = set->waiting[i].lens;
+            set->groups[set->ngroups].first = i;
+            set->ngroups += 1;
+        }
+        set->groups[set->ngroups - 1].count += 1;
+    }
+ error:
+    return;
+}
+
+/* Return the items in E_k that wait for the nonterminal LENS, or NULL if
+ * there are none */
+static struct waiting_group *set_waiting(struct jmt_parse *parse,
+                                         ind_t k, ind_t lens) {
+    struct item_set *set = parse->sets[k];
+    ind_t lo = 0, hi;
+
+    if (! set->waiting_indexed) {
+        set_index_waiting(parse, k);
+        if (HAS_ERR(parse))
+            return NULL;
+    }
+
+    hi = set->ngroups;
+    while (lo < hi) {
+        ind_t mid = lo + (hi - lo) / 2;
+        if (set->groups[mid].lens == lens)
+            return set->groups + mid;
+        if (set->groups[mid].lens < lens)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+/* Return true if completing the nonterminal for G is a deterministic
+ * step */
+static bool is_leo_step(struct jmt_parse *parse, ind_t k,
+                        struct waiting_group *g) {
+    return g != NULL && g->count == 1
+        && parse->sets[k]->waiting[g->first].to->trans.used == 0;
+}
+
+/* Take the deterministic step for G in E_k: the item it adds is
+ * (*TO, *PARENT) */
+static void leo_step(struct jmt_parse *parse, ind_t k,
+                     struct waiting_group *g,
+                     struct state **to, ind_t *parent) {
+    struct waiting *w = parse->sets[k]->waiting + g->first;
+
+    *to = w->to;
+    *parent = item_parent(parse, k, w->item);
+}
+
+static struct state leo_busy;
+#define LEO_BUSY (&leo_busy)
+
+/* Return the group of the next deterministic step after the one for G in
+ * E_k, or NULL if the item that G adds is the topmost one of its chain;
+ * set *NEXT to the item set the next step is in, which is E_k itself when
+ * the nonterminal for G was called from E_k.
+ *
+ * The chain stops at items with parent 0, since they might accept the
+ * whole text, and at items that complete more than one nonterminal */
+static struct waiting_group *leo_next(struct jmt_parse *parse, ind_t k,
+                                      struct waiting_group *g,
+                                      ind_t *next) {
+    struct state *to;
+    ind_t parent;
+    struct waiting_group *h;
+
+    leo_step(parse, k, g, &to, &parent);
+    if (parent == 0 || to->nret != 1)
+        return NULL;
+    h = set_waiting(parse, parent, to->ret[0]);
+    if (! is_leo_step(parse, parent, h))
+        return NULL;
+    *next = parent;
+    return h;
+}
+
+/* Compute the topmost item of the chain of deterministic steps starting
+ * with G in E_k, and remember it in G and every group along the way. If
+ * the chain runs into a cycle, which only a grammar with a cycle of
+ * nonterminals that just call each other can cause, we stop before going
+ * around it again */
+static void leo_top(struct jmt_parse *parse, ind_t k,
+                    struct waiting_group *g) {
+    struct waiting_group *h = g, *n;
+    ind_t i = k, next;
+    struct state *top;
+    ind_t top_parent;
+
+    while (h->top == NULL) {
+        h->top = LEO_BUSY;
+        n = leo_next(parse, i, h, &next);
+        ERR_BAIL(parse);
+        if (n == NULL || n->top == LEO_BUSY) {
+            leo_step(parse, i, h, &top, &top_parent);
+            break;
+        }
+        h = n;
+        i = next;
+    }
+    if (h->top != LEO_BUSY) {
+        top = h->top;
+        top_parent = h->top_parent;
+    }
+
+    for (h = g, i = k; h != NULL && h->top == LEO_BUSY;
+         h = leo_next(parse, i, h, &i)) {
+        h->top = top;
+        h->top_parent = top_parent;
+    }
+ error:
+    return;
+}
+
+/* NNCOMPLETE for (t, k) in E_j, which has index ITEM in E_j. For every
+ * nonterminal that t returns, add the items waiting for it in E_k to E_j,
+ * or only the topmost item of a chain of deterministic steps */
 static void nncomplete(struct jmt_parse *parse, ind_t j,
                        struct state *t, ind_t k, ind_t item) {
 
-    for (ind_t itemk = 0; itemk < parse->sets[k]->items.used; itemk++) {
-        struct state *u = item_state(parse, k, itemk);
-        for_each_trans(y, u) {
-            if (returns(t, y->lens)) {
-                ind_t parent = item_parent(parse, k, itemk);
-                parse_add_complete(parse, j,
-                                   y->to, parent,
-                                   k, itemk, y->lens, item);
+    for (ind_t r = 0; r < t->nret; r++) {
+        ind_t lens = t->ret[r];
+        struct waiting_group *g = set_waiting(parse, k, lens);
+        ERR_BAIL(parse);
+
+        if (g == NULL)
+            continue;
+        if (is_leo_step(parse, k, g)) {
+            if (g->top == NULL) {
+                leo_top(parse, k, g);
+                ERR_BAIL(parse);
             }
+            parse_add_item(parse, j, g->top, g->top_parent,
+                           R_COMPLETE|R_LEO, lens, k, EPS, item, IND_MAX);
+            ERR_BAIL(parse);
+            continue;
+        }
+        for (ind_t w = g->first; w < g->first + g->count; w++) {
+            struct waiting *x = parse->sets[k]->waiting + w;
+            ind_t parent = item_parent(parse, k, x->item);
+            parse_add_complete(parse, j, x->to, parent,
+                               k, x->item, lens, item);
+            ERR_BAIL(parse);
         }
     }
+ error:
+    return;
+}
+
+/* Turn the R_LEO links of item ITEM in E_k into ordinary R_COMPLETE links,
+ * adding the items along the chain of deterministic steps that we skipped
+ * while parsing. Afterwards, ITEM might have moved in memory */
+static void leo_expand(struct jmt_parse *parse, ind_t k, ind_t item) {
+    struct item *x = set_item(parse, k, item);
+    ind_t nlinks = x->nlinks;
+    bool expanded = false;
+
+    for (ind_t l = 0; l < nlinks; l++) {
+        x = set_item(parse, k, item);
+        if (! (x->links[l].reason & R_LEO))
+            continue;
+        expanded = true;
+
+        struct state *top = x->state;
+        ind_t top_parent = x->parent;
+        ind_t lens = x->links[l].lens;
+        ind_t i = x->links[l].from_set;
+        ind_t child = x->links[l].to_item;
+        struct link lnk;
+
+        while (true) {
+            struct waiting_group *g = set_waiting(parse, i, lens);
+            struct state *to;
+            ind_t parent;
+
+            ERR_BAIL(parse);
+            ensure(is_leo_step(parse, i, g), parse);
+            leo_step(parse, i, g, &to, &parent);
+            lnk.reason = R_COMPLETE;
+            lnk.lens = lens;
+            lnk.from_set = i;
+            lnk.from_item = parse->sets[i]->waiting[g->first].item;
+            lnk.to_item = child;
+            lnk.caller = IND_MAX;
+            if (to == top && parent == top_parent)
+                break;
+            ensure(to->nret == 1, parse);
+            child = parse_add_item(parse, k, to, parent, lnk.reason,
+                                   lnk.lens, lnk.from_set, lnk.from_item,
+                                   lnk.to_item, lnk.caller);
+            ERR_BAIL(parse);
+            i = parent;
+            lens = to->ret[0];
+        }
+        x = set_item(parse, k, item);
+        x->links[l] = lnk;
+    }
+
+    if (! expanded)
+        return;
+
+    /* Different R_LEO links might have turned into the same link, and
+     * the links that we changed are not in the index of links in E_k
+     * under their new content */
+    x = set_item(parse, k, item);
+    for (ind_t l = 1; l < x->nlinks; l++) {
+        for (ind_t m = 0; m < l; m++) {
+            if (link_equal(x->links + l, x->links + m)) {
+                memmove(x->links + l, x->links + l + 1,
+                        (x->nlinks - l - 1) * sizeof(*x->links));
+                x->nlinks -= 1;
+                l -= 1;
+                break;
+            }
+        }
+    }
+    set_drop_index(parse->sets[k]);
+ error:
+    return;
 }
 
 /* NCALLER for (t, i) in E_j, which has index item in E_j, and t -> s a
@@ -514,24 +1102,54 @@ static void ncallee(struct jmt_parse *parse, ind_t j, ATTRIBUTE_UNUSED ind_t ite
     }
 }
 
-static struct jmt_parse *parse_init(struct jmt *jmt,
+/* Update the most memory PARSE has used with what it uses now */
+static void parse_count_bytes(struct jmt_parse *parse) {
+    size_t bytes = arena_size(parse->arena)
+        + arena_size(parse->kept_arena)
+        + parse->nsets * sizeof(*parse->sets)
+        + parse->kept_sets * sizeof(struct item_set);
+
+    /* Sets before COMPACTED have no indexes */
+    for (int i=parse->compacted; i <= parse->last_set; i++) {
+        struct item_set *set = parse->sets[i];
+        if (set != NULL)
+            bytes += sizeof(*set)
+                + set->item_index_size * sizeof(*set->item_index)
+                + set->link_index_size * sizeof(*set->link_index);
+    }
+    if (bytes > parse->max_bytes)
+        parse->max_bytes = bytes;
+}
+
+static struct jmt_parse *parse_init(struct jmt *jmt, struct error *error,
                                     const char *text, size_t text_len) {
     int r;
     struct jmt_parse *parse;
 
     r = ALLOC(parse);
-    ERR_NOMEM(r < 0, jmt);
+    if (r < 0)
+        goto error;
 
     parse->jmt = jmt;
-    parse->error = jmt->error;
+    parse->error = error;
     parse->text = text;
     parse->nsets = text_len + 1;
     r = ALLOC_N(parse->sets, parse->nsets);
-    ERR_NOMEM(r < 0, jmt);
+    if (r < 0)
+        goto error;
+    parse->arena = make_arena();
+    if (parse->arena == NULL)
+        goto error;
+    parse->kept_arena = make_arena();
+    if (parse->kept_arena == NULL)
+        goto error;
     return parse;
  error:
-    if (parse != NULL)
+    report_error(error, AUG_ENOMEM, NULL);
+    if (parse != NULL) {
         free(parse->sets);
+        free_arena(parse->arena);
+    }
     free(parse);
     return NULL;
 }
@@ -539,21 +1157,33 @@ static struct jmt_parse *parse_init(struct jmt *jmt,
 void jmt_free_parse(struct jmt_parse *parse) {
     if (parse == NULL)
         return;
+    if (parse->error->aug != NULL) {
+        struct jmt_stats *stats =
+            &((struct augeas *) parse->error->aug)->jmt_stats;
+        parse_count_bytes(parse);
+        stats->parses += 1;
+        stats->items += parse->nitems;
+        stats->links += parse->nlinks;
+        stats->compactions += parse->ncompactions;
+        if (parse->max_bytes > stats->max_bytes)
+            stats->max_bytes = parse->max_bytes;
+    }
     for (int i=0; i < parse->nsets; i++) {
         struct item_set *set = parse->sets[i];
         if (set != NULL) {
-            array_each_elem(x, set->items, struct item)
-                free(x->links);
-            array_release(&set->items);
+            free(set->item_index);
+            free(set->link_index);
+            free(set->waiting);
+            free(set->groups);
             free(set);
         }
     }
+    free_arena(parse->arena);
+    free_arena(parse->kept_arena);
     free(parse->sets);
     free(parse);
 }
 
-static struct state *lens_state(struct jmt *jmt, ind_t l);
-
 static void flens(FILE *fp, ind_t l) {
     if (l == 0)
         fprintf(fp, "%c", 'S');
@@ -569,10 +1199,9 @@ static void parse_dot_link(FILE *fp, struct jmt_parse *parse,
                            ind_t k, struct item *x, struct link *lnk) {
     char *lens_label = NULL;
     if (is_complete(lnk) || is_scan(lnk)) {
-        struct state *sA = lens_state(parse->jmt, lnk->lens);
         int r;
 
-        if (sA == NULL)
+        if (! is_nonterminal(parse->jmt, lnk->lens))
             r = xasprintf(&lens_label, "<%d>", lnk->lens);
         else
             r = xasprintf(&lens_label, "%d", lnk->lens);
@@ -583,7 +1212,12 @@ static void parse_dot_link(FILE *fp, struct jmt_parse *parse,
     }
     fprintf(fp, "    n%d_%d_%d [ label = \"(%d, %d)\"];\n",
             k, x->state->num, x->parent, x->state->num, x->parent);
-    if (is_complete(lnk)) {
+    if (lnk->reason & R_LEO) {
+        struct item *y = set_item(parse, k, lnk->to_item);
+        fprintf(fp, "    n%d_%d_%d -> n%d_%d_%d [ style = dotted ];\n",
+                k, x->state->num, x->parent,
+                k, y->state->num, y->parent);
+    } else if (is_complete(lnk)) {
         struct item *y = set_item(parse, k, lnk->to_item);
         const char *pred = is_predict(lnk) ? "p" : "";
         fprintf(fp, "    n%d_%d_%d -> n%s%d_%d_%d [ style = dashed ];\n",
@@ -654,13 +1288,333 @@ static void parse_dot(struct jmt_parse *parse, const char *fname) {
     fclose(fp);
 }
 
-struct jmt_parse *
-jmt_parse(struct jmt *jmt, const char *text, size_t text_len)
-{
-    struct jmt_parse *parse = NULL;
+/* The SCAN we are doing while looking for matches of a terminal; see
+ * SCAN_FOUND */
+struct scan {
+    struct jmt_parse *parse;
+    ind_t             j;       /* Scan starts at position j */
+    ind_t             item;    /* ... from this item in E_j */
+    ind_t             parent;  /* ... whose parent is in E_parent */
+    struct trans     *trans;   /* ... along this transition */
+};
 
-    parse = parse_init(jmt, text, text_len);
-    ERR_BAIL(jmt);
+/* SCAN for every match of the terminal in SCAN->TRANS, which is COUNT
+ * characters long */
+static void scan_found(int count, void *data) {
+    struct scan *scan = data;
+
+    parse_add_scan(scan->parse, scan->j + count, scan->trans->to,
+                   scan->parent, scan->trans->lens, scan->j, scan->item);
+}
+
+/* Return the index of an item in the last set of PARSE that accepts the
+ * whole text, or IND_MAX if there is none */
+static ind_t parse_accepting_item(struct jmt_parse *parse) {
+    ind_t k = parse->nsets - 1;
+    struct item_set *set = parse->sets[k];
+
+    if (set == NULL)
+        return IND_MAX;
+
+    for (ind_t item = 0; item < set->items.used; item++) {
+        struct item *x = set_item(parse, k, item);
+        if (x->parent == 0 && returns(x->state, parse->jmt->lens)) {
+            for (ind_t i = 0; i < x->nlinks; i++) {
+                if (is_complete(x->links + i) || is_scan(x->links + i))
+                    return item;
+            }
+        }
+    }
+    return IND_MAX;
+}
+
+/*
+ * Reclaiming items
+ *
+ * Most items in a chart are predictions and partial matches that never
+ * become part of a complete parse, but we keep them around until the
+ * parse is freed. PARSE_COMPACT drops them from time to time, so that
+ * memory use follows the parse forest of the text parsed so far, and not
+ * every alternative the parser ever considered.
+ *
+ * Before processing E_j, the items in E_j and later sets are all still
+ * needed. An item that is needed keeps alive
+ *   - the items its links point to, for building the parse tree,
+ *   - for an R_LEO link, every item waiting for a nonterminal in E_i,
+ *     where i is FROM_SET of the link, which LEO_EXPAND needs to walk
+ *     the chain of deterministic steps later, and
+ *   - if the item might still complete, every item waiting for a
+ *     nonterminal in the set of its parent, since NNCOMPLETE will look at
+ *     them then.
+ * Items that might still complete are the ones in E_j and later sets, and
+ * the waiting items that they keep alive in turn. Items that only a link
+ * points to are done. Everything else in the sets before E_j can never be
+ * reached again.
+ *
+ * All of these point from an item in E_k to items in E_k or earlier sets.
+ * Once PARSE_COMPACT has run for E_j, nothing in the sets before E_j can
+ * therefore keep an item in a later set alive, and the next run only
+ * needs to look at the sets from E_j on; the items that the earlier run
+ * kept stay around until the parse is freed. That makes the work for
+ * compacting proportional to the number of new items, and we compact
+ * whenever there are more new items and links than kept ones.
+ *
+ * Compacting still makes a parse a good deal slower, and only pays off
+ * when the chart would otherwise take a lot of memory; small texts are
+ * never compacted.
+ */
+
+/* Start compacting when there are at least this many items and links,
+ * which take about 250MB, unless the jmt_compact_min of the augeas handle
+ * asks for a different threshold */
+#define COMPACT_MIN (1UL << 22)
+
+struct mark_ref {
+    ind_t set;
+    ind_t item;
+};
+
+struct mark {
+    struct jmt_parse *parse;
+    ind_t             lo;           /* Only mark items in E_lo .. E_(j-1) */
+    ind_t             j;
+    struct mark_ref  *stack;
+    size_t            used;
+    size_t            size;
+};
+
+/* Push item ITEM in E_k onto the stack of items whose links we still
+ * need to follow */
+static void mark_push(struct mark *mark, ind_t k, ind_t item) {
+    if (mark->used >= mark->size) {
+        size_t size = mark->size < 64 ? 64 : 2 * mark->size;
+        int r = REALLOC_N(mark->stack, size);
+        ERR_NOMEM(r < 0, mark->parse);
+        mark->size = size;
+    }
+    mark->stack[mark->used].set = k;
+    mark->stack[mark->used].item = item;
+    mark->used += 1;
+ error:
+    return;
+}
+
+/* Values in the MAP of an item set while marking */
+enum mark_state {
+    M_UNMARKED = 0,
+    M_DONE,                     /* Needed for the parse tree */
+    M_PENDING                   /* Might still complete */
+};
+
+/* Mark the item ITEM in E_k as needed in STATE. Items in E_j and later
+ * sets are on the stack from the start, items before E_lo are kept
+ * anyway */
+static void mark_item(struct mark *mark, ind_t k, ind_t item,
+                      enum mark_state state) {
+    struct item_set *set;
+
+    if (k < mark->lo || k >= mark->j || item == EPS)
+        return;
+    set = mark->parse->sets[k];
+    if (set->map[item] >= state)
+        return;
+    set->map[item] = state;
+    mark_push(mark, k, item);
+}
+
+/* Mark all items in E_k that wait for a nonterminal */
+static void mark_waiting(struct mark *mark, ind_t k) {
+    struct item_set *set = mark->parse->sets[k];
+
+    if (k < mark->lo || k >= mark->j || set->waiting_marked)
+        return;
+    set->waiting_marked = true;
+    for (ind_t i = 0; i < set->items.used; i++) {
+        struct item *x = array_elem(set->items, i, struct item);
+        for_each_trans(y, x->state) {
+            if (y->lens <= LENS_MAX
+                && is_nonterminal(mark->parse->jmt, y->lens)) {
+                mark_item(mark, k, i, M_PENDING);
+                break;
+            }
+        }
+    }
+}
+
+/* The index that item ITEM in E_k has after compacting */
+static ind_t compact_index(struct jmt_parse *parse, ind_t k, ind_t item) {
+    struct item_set *set;
+
+    if (item == EPS)
+        return item;
+    set = parse->sets[k];
+    return set->map == NULL ? item : set->map[item];
+}
+
+/* Drop all items from the sets E_lo .. E_(j-1) that can not become part
+ * of a complete parse any more, where E_lo is the first set that
+ * PARSE_COMPACT has not dealt with yet. Copy the remaining items in them
+ * and their links into the KEPT_ARENA, and the items in E_j and later
+ * sets into a new arena */
+static void parse_compact(struct jmt_parse *parse, ind_t j) {
+    struct mark mark = { .parse = parse, .lo = parse->compacted, .j = j };
+    struct arena *arena = NULL;
+    ind_t *maps = NULL;
+    size_t nmaps = 0;
+    int r;
+
+    parse_count_bytes(parse);
+
+    /* The maps of all sets are in one block MAPS */
+    for (ind_t k = mark.lo; k < j; k++) {
+        if (parse->sets[k] != NULL)
+            nmaps += parse->sets[k]->items.used;
+    }
+    r = ALLOC_N(maps, nmaps);
+    ERR_NOMEM(r < 0, parse);
+    nmaps = 0;
+    for (ind_t k = mark.lo; k < j; k++) {
+        struct item_set *set = parse->sets[k];
+        if (set != NULL) {
+            set->map = maps + nmaps;
+            nmaps += set->items.used;
+        }
+    }
+
+    /* Mark */
+    for (ind_t k = j; k <= parse->last_set; k++) {
+        struct item_set *set = parse->sets[k];
+        if (set == NULL)
+            continue;
+        for (ind_t i = 0; i < set->items.used; i++) {
+            mark_push(&mark, k, i);
+            ERR_BAIL(parse);
+        }
+    }
+    while (mark.used > 0) {
+        struct mark_ref ref = mark.stack[--mark.used];
+        struct item *x = set_item(parse, ref.set, ref.item);
+
+        if (ref.set >= j || parse->sets[ref.set]->map[ref.item] == M_PENDING)
+            mark_waiting(&mark, x->parent);
+        for (ind_t l = 0; l < x->nlinks; l++) {
+            struct link *lnk = x->links + l;
+            if (lnk->from_item != EPS)
+                mark_item(&mark, lnk->from_set, lnk->from_item, M_DONE);
+            mark_item(&mark, ref.set, lnk->to_item, M_DONE);
+            if (lnk->reason & R_LEO)
+                mark_waiting(&mark, lnk->from_set);
+        }
+        ERR_BAIL(parse);
+    }
+
+    /* Number the items we keep, and drop sets that became empty */
+    for (ind_t k = mark.lo; k < j; k++) {
+        struct item_set *set = parse->sets[k];
+        ind_t used = 0;
+
+        if (set == NULL)
+            continue;
+        for (ind_t i = 0; i < set->items.used; i++)
+            set->map[i] = set->map[i] ? used++ : IND_MAX;
+        if (used == 0) {
+            free(set->item_index);
+            free(set->link_index);
+            free(set->waiting);
+            free(set->groups);
+            free(set);
+            parse->sets[k] = NULL;
+        }
+    }
+
+    /* Copy */
+    arena = make_arena();
+    ERR_NOMEM(arena == NULL, parse);
+    parse->live = 0;
+    for (ind_t k = mark.lo; k <= parse->last_set; k++) {
+        struct item_set *set = parse->sets[k];
+        struct arena *to = k < j ? parse->kept_arena : arena;
+        struct item *items = NULL;
+        ind_t count = 0, used = 0;
+
+        if (set == NULL)
+            continue;
+        if (set->map == NULL) {
+            count = set->items.used;
+        } else {
+            for (ind_t i = 0; i < set->items.used; i++)
+                if (set->map[i] != IND_MAX)
+                    count += 1;
+        }
+        r = ARENA_ALLOC_N(to, items, count);
+        ERR_NOMEM(r < 0, parse);
+        for (ind_t i = 0; i < set->items.used; i++) {
+            struct item *x = array_elem(set->items, i, struct item);
+            struct item *y = items + used;
+            ind_t size = 1;
+
+            if (set->map != NULL && set->map[i] == IND_MAX)
+                continue;
+            while (size < x->nlinks)
+                size *= 2;
+            *y = *x;
+            r = ARENA_ALLOC_N(to, y->links, size);
+            ERR_NOMEM(r < 0, parse);
+            for (ind_t l = 0; l < x->nlinks; l++) {
+                struct link *lnk = y->links + l;
+                *lnk = x->links[l];
+                lnk->from_item = compact_index(parse, lnk->from_set,
+                                               lnk->from_item);
+                lnk->to_item = compact_index(parse, k, lnk->to_item);
+            }
+            if (k < j)
+                parse->kept += 1 + x->nlinks;
+            else
+                parse->live += 1 + x->nlinks;
+            used += 1;
+        }
+        set->items.data = items;
+        set->items.size = used;
+        set->items.used = used;
+        if (k < j) {
+            /* The numbers of the items changed, and no items will be
+             * added to the set any more */
+            parse->kept_sets += 1;
+            set_drop_index(set);
+            FREE(set->waiting);
+            FREE(set->groups);
+            set->ngroups = 0;
+            set->waiting_indexed = false;
+            set->waiting_marked = false;
+        }
+    }
+    /* Only now that all links have been copied can we drop the maps */
+    for (ind_t k = mark.lo; k < j; k++) {
+        if (parse->sets[k] != NULL)
+            parse->sets[k]->map = NULL;
+    }
+    free_arena(parse->arena);
+    parse->arena = arena;
+    arena = NULL;
+    parse->compacted = j;
+    parse->ncompactions += 1;
+ error:
+    free(mark.stack);
+    free(maps);
+    free_arena(arena);
+    return;
+}
+
+static void parse_run(struct jmt_parse *parse,
+                      const struct timespec *deadline) {
+    struct jmt *jmt = parse->jmt;
+    const char *text = parse->text;
+    size_t text_len = parse->nsets - 1;
+    const struct augeas *aug = parse->error->aug;
+
+    parse->compact_min = COMPACT_MIN;
+    if (aug != NULL && aug->jmt_compact_min > 0)
+        parse->compact_min = aug->jmt_compact_min;
 
     /* INIT */
     parse_add_item(parse, 0, jmt->start, 0, R_ROOT, EPS, EPS, EPS, EPS,
@@ -678,6 +1632,12 @@ jmt_parse(struct jmt *jmt, const char *text, size_t text_len)
         struct item_set *set = parse->sets[j];
         if (set == NULL)
             continue;
+        if (deadline_passed(deadline))
+            break;
+        if (parse->live >= parse->compact_min && parse->live >= parse->kept) {
+            parse_compact(parse, j);
+            ERR_BAIL(parse);
+        }
 
         for (int item=0; item < set->items.used; item++) {
             struct state *t = item_state(parse, j, item);
@@ -700,24 +1660,65 @@ jmt_parse(struct jmt *jmt, const char *text, size_t text_len)
                         ncallee(parse, j, item, t, i, x->to, pred);
                     }
                 } else {
-                    int count;
                     struct lens *lens = lens_of_parse(parse, x->lens);
-                    struct state *sA = lens_state(parse->jmt, x->lens);
-                    if (! lens->recursive && sA == NULL) {
-                        /* SCAN, terminal */
-                        // FIXME: We really need to find every k so that
-                        // text[j..k] matches lens->ctype, not just one
-                        count = regexp_match(lens->ctype, text, text_len, j, NULL);
-                        if (count > 0) {
-                            parse_add_scan(parse, j+count,
-                                           x->to, i,
+                    if (lens->recursive
+                        || is_nonterminal(parse->jmt, x->lens))
+                        continue;
+                    if (parse->all_matches) {
+                        /* SCAN, terminal, for every k so that text[j..k]
+                         * matches lens->ctype */
+                        struct scan scan = {
+                            .parse = parse, .j = j, .item = item,
+                            .parent = i, .trans = x
+                        };
+                        regexp_match_all(lens->ctype, text, text_len, j,
+                                         scan_found, &scan);
+                    } else {
+                        /* SCAN, terminal, for the longest match */
+                        int count = regexp_match(lens->ctype, text, text_len,
+                                                 j, NULL);
+                        if (count > 0)
+                            parse_add_scan(parse, j+count, x->to, i,
                                            x->lens, j, item);
-                        }
                     }
+                    ERR_BAIL(parse);
                 }
             }
         }
     }
+ error:
+    return;
+}
+
+/* Terminals are scanned for their longest match first, which is what the
+ * nonrecursive get does, too, and keeps lenses that repeat a terminal, like
+ * [ key /[a-z]+/ ]*, unambiguous. Only if that does not parse the whole
+ * text do we parse again with every match of each terminal */
+struct jmt_parse *
+jmt_parse(struct jmt *jmt, struct error *error,
+          const char *text, size_t text_len,
+          const struct timespec *deadline)
+{
+    struct jmt_parse *parse = NULL;
+
+    parse = parse_init(jmt, error, text, text_len);
+    if (parse == NULL)
+        return NULL;
+
+    parse_run(parse, deadline);
+    ERR_BAIL(parse);
+
+    if (parse_accepting_item(parse) == IND_MAX
+        && ! deadline_passed(deadline)) {
+        jmt_free_parse(parse);
+        parse = parse_init(jmt, error, text, text_len);
+        if (parse == NULL)
+            return NULL;
+        parse->all_matches = true;
+        parse_run(parse, deadline);
+        ERR_BAIL(parse);
+    }
+
     if (debugging("cf.jmt.parse"))
         parse_dot(parse, "jmt_parse.dot");
     return parse;
@@ -841,10 +1842,15 @@ static int filter_siblings(struct jmt_visitor *visitor, struct lens *lens,
                           ind_t k, ind_t item, ind_t caller,
                           struct array *siblings) {
     struct jmt_parse *parse = visitor->parse;
-    struct item *x = set_item(parse, k, item);
+    struct item *x;
     ind_t nlast = 0;
     int r;
 
+    leo_expand(parse, k, item);
+    if (HAS_ERR(parse))
+        return -3;
+    x = set_item(parse, k, item);
+
     for (ind_t lnk = 0; lnk < x->nlinks; lnk++)
         if (is_last_sibling(x->links + lnk))
             nlast += 1;
@@ -873,6 +1879,8 @@ static int filter_siblings(struct jmt_visitor *visitor, struct lens *lens,
             r = filter_siblings(visitor, lens,
                                 l->from_set, l->from_item, caller,
                                 siblings);
+            /* Expanding R_LEO links might have moved X */
+            x = set_item(parse, k, item);
             if (r == -1)
                 continue;
             if (r == 0) {
@@ -927,10 +1935,15 @@ build_children(struct jmt_parse *parse, ind_t k, ind_t item,
 static int
 build_tree(struct jmt_parse *parse, ind_t k, ind_t item, struct lens *lens,
            struct jmt_visitor *visitor, int lvl) {
-    struct item *x = set_item(parse, k, item);
-    ind_t start = x->links->from_set;
+    struct item *x;
+    ind_t start;
     ind_t end = k;
-    struct item *old_x = x;
+    ind_t old_item = item;
+
+    leo_expand(parse, k, item);
+    ERR_BAIL(parse);
+    x = set_item(parse, k, item);
+    start = x->links->from_set;
 
     if (start == end) {
         /* This completion corresponds to a nullable nonterminal
@@ -955,12 +1968,11 @@ build_tree(struct jmt_parse *parse, ind_t k, ind_t item, struct lens *lens,
         ind_t caller = sib->state->num;
 
         item = lnk->to_item;
-        x = set_item(parse, k, item);
         build_children(parse, k, item, visitor, lvl, caller);
         ERR_BAIL(parse);
     }
 
-    visit_exit(visitor, lens, start, end, old_x, lvl);
+    visit_exit(visitor, lens, start, end, set_item(parse, k, old_item), lvl);
     ERR_BAIL(parse);
  error:
     return end;
@@ -969,16 +1981,21 @@ build_tree(struct jmt_parse *parse, ind_t k, ind_t item, struct lens *lens,
 static int
 build_children(struct jmt_parse *parse, ind_t k, ind_t item,
                struct jmt_visitor *visitor, int lvl, ind_t caller) {
-    struct item *x = set_item(parse, k, item);
-    struct lens *lens = lens_of_parse(parse, x->links->lens);
+    struct item *x;
+    struct lens *lens;
     struct array siblings;
     ind_t end = k;
     int r;
 
     array_init(&siblings, sizeof(ind_t));
+    leo_expand(parse, k, item);
+    ERR_BAIL(parse);
+    x = set_item(parse, k, item);
+    lens = lens_of_parse(parse, x->links->lens);
     r = filter_siblings(visitor, lens, k, item, caller, &siblings);
     if (r < 0)
         goto error;
+    x = set_item(parse, k, item);
 
     /* x the first item in a list of siblings; visit items (x->from_set,
      * x->from_item) in order, which will visit x and its siblings in the
@@ -989,6 +2006,7 @@ build_children(struct jmt_parse *parse, ind_t k, ind_t item,
         if (sub->recursive) {
             build_tree(parse, k, item, sub, visitor, lvl+1);
             ERR_BAIL(parse);
+            x = set_item(parse, k, item);
         } else {
             if (debugging("cf.jmt.visit"))
                 build_trace("T", x->links->from_set, k, x, lvl+1);
@@ -1011,27 +2029,15 @@ int jmt_visit(struct jmt_visitor *visitor, size_t *len) {
     struct jmt_parse *parse = visitor->parse;
     ind_t k = parse->nsets - 1;     /* Current Earley set */
     ind_t item;
-    struct item_set *set = parse->sets[k];
 
-    if (set == NULL)
+    item = parse_accepting_item(parse);
+    if (item == IND_MAX)
         goto noparse;
-
-    for (item = 0; item < set->items.used; item++) {
+    if (debugging("cf.jmt.visit")) {
         struct item *x = set_item(parse, k, item);
-        if (x->parent == 0 && returns(x->state, parse->jmt->lens)) {
-            for (ind_t i = 0; i < x->nlinks; i++) {
-                if (is_complete(x->links + i) || is_scan(x->links + i)) {
-                    if (debugging("cf.jmt.visit"))
-                        printf("visit: found (%d, %d) in E_%d\n",
-                               x->state->num, x->parent, k);
-                    goto found;
-                }
-            }
-        }
+        printf("visit: found (%d, %d) in E_%d\n",
+               x->state->num, x->parent, k);
     }
- found:
-    if (item >= parse->sets[k]->items.used)
-        goto noparse;
     struct lens *lens = lens_of_parse(parse, parse->jmt->lens);
 
     visit_enter(visitor, lens, 0, k, NULL, 0);
@@ -1095,6 +2101,7 @@ static ind_t add_lens(struct jmt *jmt, struct lens *lens) {
         sA = make_state(jmt);
         ERR_NOMEM(sA == NULL, jmt);
         array_elem(jmt->lenses, l, struct jmt_lens)->state = sA;
+        array_elem(jmt->lenses, l, struct jmt_lens)->nonterminal = true;
         if (! lens->recursive) {
             /* Add lens again, so that l refers to the nonterminal T
              * for the lens, and l+1 refers to the terminal t for it */
@@ -1894,19 +2901,185 @@ struct jmt *jmt_build(struct lens *lens) {
     return NULL;
 }
 
-void jmt_free(struct jmt *jmt) {
-    if (jmt == NULL)
-        return;
-    array_release(&jmt->lenses);
+static void free_states(struct jmt *jmt) {
     struct state *s = jmt->start;
     while (s != NULL) {
         struct state *del = s;
         s = del->next;
         free_state(del);
     }
+    jmt->start = NULL;
+}
+
+void jmt_free(struct jmt *jmt) {
+    if (jmt == NULL)
+        return;
+    array_release(&jmt->lenses);
+    free_states(jmt);
     free(jmt);
 }
 
+/*
+ * Transducers as tables
+ *
+ * States are numbered in the order of the list starting at JMT->START,
+ * which makes the start state state 0.
+ */
+
+static ind_t state_index(struct state **states, ind_t nstates,
+                         struct state *s) {
+    for (ind_t i=0; i < nstates; i++)
+        if (states[i] == s)
+            return i;
+    return IND_MAX;
+}
+
+int jmt_tables(struct jmt *jmt, struct augcc_jmt *tables) {
+    struct state **states = NULL;
+    unsigned char *nonterminal = NULL;
+    uint32_t *num = NULL, *trans_start = NULL, *trans = NULL;
+    uint32_t *ret_start = NULL, *ret = NULL;
+    ind_t nstates = 0, ntrans = 0, nret = 0;
+
+    MEMZERO(tables, 1);
+    list_for_each(s, jmt->start) {
+        nstates += 1;
+        ntrans += s->trans.used;
+        nret += s->nret;
+    }
+
+    if (ALLOC_N(states, nstates) < 0
+        || ALLOC_N(nonterminal, jmt->lenses.used) < 0
+        || ALLOC_N(num, nstates) < 0
+        || ALLOC_N(trans_start, nstates + 1) < 0
+        || ALLOC_N(trans, 2 * ntrans + 1) < 0
+        || ALLOC_N(ret_start, nstates + 1) < 0
+        || ALLOC_N(ret, nret + 1) < 0)
+        goto error;
+
+    nstates = 0;
+    list_for_each(s, jmt->start)
+        states[nstates++] = s;
+
+    array_for_each(l, jmt->lenses)
+        nonterminal[l] = is_nonterminal(jmt, l);
+
+    ntrans = 0;
+    nret = 0;
+    for (ind_t i=0; i < nstates; i++) {
+        struct state *s = states[i];
+        num[i] = s->num;
+        trans_start[i] = ntrans;
+        for_each_trans(t, s) {
+            trans[2*ntrans] = state_index(states, nstates, t->to);
+            trans[2*ntrans + 1] = t->lens;
+            ntrans += 1;
+        }
+        ret_start[i] = nret;
+        for (ind_t r=0; r < s->nret; r++)
+            ret[nret++] = s->ret[r];
+    }
+    trans_start[nstates] = ntrans;
+    ret_start[nstates] = nret;
+
+    tables->lens = jmt->lens;
+    tables->nlenses = jmt->lenses.used;
+    tables->nonterminal = nonterminal;
+    tables->nstates = nstates;
+    tables->num = num;
+    tables->trans_start = trans_start;
+    tables->trans = trans;
+    tables->ret_start = ret_start;
+    tables->ret = ret;
+    free(states);
+    return 0;
+ error:
+    free(states);
+    free(nonterminal);
+    free(num);
+    free(trans_start);
+    free(trans);
+    free(ret_start);
+    free(ret);
+    return -1;
+}
+
+void jmt_free_tables(struct augcc_jmt *tables) {
+    free((void *) tables->nonterminal);
+    free((void *) tables->num);
+    free((void *) tables->trans_start);
+    free((void *) tables->trans);
+    free((void *) tables->ret_start);
+    free((void *) tables->ret);
+    MEMZERO(tables, 1);
+}
+
+struct jmt *jmt_from_tables(struct lens *lens,
+                            const struct augcc_jmt *tables) {
+    struct jmt *jmt = NULL;
+    struct state **states = NULL;
+    int r;
+
+    r = ALLOC(jmt);
+    ERR_NOMEM(r < 0, lens->info);
+
+    jmt->error = lens->info->error;
+    array_init(&jmt->lenses, sizeof(struct jmt_lens));
+
+    /* Number the lenses exactly like JMT_BUILD does; that also makes
+     * states for the nonterminals, which we do not need */
+    index_lenses(jmt, lens);
+    ERR_BAIL(jmt);
+    free_states(jmt);
+    if (jmt->lenses.used != tables->nlenses)
+        goto error;
+    array_for_each(l, jmt->lenses) {
+        struct jmt_lens *jl = array_elem(jmt->lenses, l, struct jmt_lens);
+        if (jl->nonterminal != tables->nonterminal[l])
+            goto error;
+        jl->state = NULL;
+    }
+    jmt->lens = tables->lens;
+    if (tables->nstates == 0)
+        goto error;
+
+    r = ALLOC_N(states, tables->nstates);
+    ERR_NOMEM(r < 0, jmt);
+    /* MAKE_STATE puts new states right after the start state */
+    for (ind_t i=0; i < tables->nstates; i++) {
+        ind_t k = (i == 0) ? 0 : tables->nstates - i;
+        states[k] = make_state(jmt);
+        ERR_BAIL(jmt);
+    }
+    for (ind_t i=0; i < tables->nstates; i++) {
+        struct state *s = states[i];
+        s->num = tables->num[i];
+        for (ind_t t = tables->trans_start[i];
+             t < tables->trans_start[i+1]; t++) {
+            ind_t to = tables->trans[2*t];
+            ind_t l = tables->trans[2*t + 1];
+            if (to >= tables->nstates
+                || (l < LENS_MAX && l >= jmt->lenses.used))
+                goto error;
+            add_new_trans(jmt, s, states[to], l);
+            ERR_BAIL(jmt);
+        }
+        for (ind_t t = tables->ret_start[i];
+             t < tables->ret_start[i+1]; t++) {
+            state_add_return(jmt, s, tables->ret[t]);
+            ERR_BAIL(jmt);
+        }
+    }
+    jmt->state_count = tables->nstates;
+
+    free(states);
+    return jmt;
+ error:
+    free(states);
+    jmt_free(jmt);
+    return NULL;
+}
+
 void jmt_dot(struct jmt *jmt, const char *fname) {
     FILE *fp = debug_fopen("%s", fname);
     if (fp == NULL)
@@ -1931,7 +3104,7 @@ void jmt_dot(struct jmt *jmt, const char *fname) {
                 fprintf(fp, ";\n");
             else if (t->lens == CALL)
                 fprintf(fp, "[ label = \"call\" ];\n");
-            else if (lens_state(jmt, t->lens) == NULL) {
+            else if (! is_nonterminal(jmt, t->lens)) {
                 struct lens *lens = lens_of_jmt(jmt, t->lens);
                 fprintf(fp, "[ label = \"");
                 print_regexp(fp, lens->ctype);
@@ -25,10 +25,13 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
 #include "lens.h"
 
 struct jmt;
 struct jmt_parse;
+struct augcc_jmt;
+struct error;
 
 typedef uint32_t ind_t;
 
@@ -49,9 +52,19 @@ struct jmt_visitor {
     void             *data;
 };
 
+/* Build the transducer for the recursive lens L. The transducer is
+ * immutable, and can be used for several parses at once.
+ */
 struct jmt *jmt_build(struct lens *l);
 
-struct jmt_parse *jmt_parse(struct jmt *jmt, const char *text, size_t text_len);
+/* Parse TEXT with JMT, reporting errors in ERROR. If DEADLINE is not NULL
+ * and passes before all of TEXT has been looked at, parsing stops early,
+ * and the incomplete parse is returned; it will never contain a
+ * successful parse of TEXT.
+ */
+struct jmt_parse *jmt_parse(struct jmt *jmt, struct error *error,
+                            const char *text, size_t text_len,
+                            const struct timespec *deadline);
 
 void jmt_free_parse(struct jmt_parse *);
 
@@ -62,6 +75,20 @@ int jmt_visit(struct jmt_visitor *visitor, size_t *len);
 
 void jmt_free(struct jmt *jmt);
 
+/* Describe JMT as tables that can be written into a lens plugin. The
+ * tables are allocated, and must be freed with JMT_FREE_TABLES. Return -1
+ * if allocation fails.
+ */
+int jmt_tables(struct jmt *jmt, struct augcc_jmt *tables);
+
+void jmt_free_tables(struct augcc_jmt *tables);
+
+/* Make the transducer for LENS from TABLES, which JMT_TABLES produced for
+ * a lens with the same structure. Return NULL if TABLES do not fit LENS.
+ */
+struct jmt *jmt_from_tables(struct lens *lens,
+                            const struct augcc_jmt *tables);
+
 void jmt_dot(struct jmt *jmt, const char *fname);
 #endif
 
@@ -167,6 +167,35 @@ static struct lens *make_lens_unop(enum lens_tag tag, struct info *info,
 
 typedef struct regexp *regexp_combinator(struct info *, int, struct regexp **);
 
+/* Fill in where the groups for the children of the union or concat LENS
+ * start in a match of its type LT, so that get and put do not need to add
+ * that up every time. Only the ctype and atype are ever matched with
+ * registers; nothing happens for the other types */
+static int lens_child_regs(struct lens *lens, enum lens_type lt) {
+    unsigned int **regs;
+    unsigned int r = 1;
+
+    if (lt == CTYPE)
+        regs = &lens->ctype_regs;
+    else if (lt == ATYPE)
+        regs = &lens->atype_regs;
+    else
+        return 0;
+    if (ltype(lens, lt) == NULL)
+        return 0;
+
+    if (*regs == NULL && ALLOC_N(*regs, lens->nchildren) < 0)
+        return -1;
+    for (int i=0; i < lens->nchildren; i++) {
+        struct regexp *type = ltype(lens->children[i], lt);
+        (*regs)[i] = r;
+        /* The combinators leave out missing types altogether */
+        if (type != NULL)
+            r += 1 + regexp_nsub(type);
+    }
+    return 0;
+}
+
 static struct lens *make_lens_binop(enum lens_tag tag, struct info *info,
                                     struct lens *l1, struct lens *l2,
                                     regexp_combinator *combinator) {
@@ -221,6 +250,8 @@ static struct lens *make_lens_binop(enum lens_tag tag, struct info *info,
             for (int i=0; i < lens->nchildren; i++)
                 types[i] = ltype(lens->children[i], t);
             ltype(lens, t) = (*combinator)(info, lens->nchildren, types);
+            if (lens_child_regs(lens, t) < 0)
+                goto error;
         }
     }
     FREE(types);
@@ -970,6 +1001,126 @@ static struct value *typecheck_maybe(struct info *info, struct lens *l) {
     return exn;
 }
 
+/*
+ * Dispatching on the first character in unions
+ *
+ * To find the child of a union that matches some string, get and put try
+ * one child after the other. For unions with many alternatives, most of
+ * them can not possibly match, since they require the string to start
+ * with a different character. A dispatch table lists, for each character,
+ * the children whose type can match a string starting with that
+ * character, so that only those need to be tried.
+ */
+
+/* Only build dispatch tables for unions with at least that many
+ * children; for smaller ones, trying all children is just as fast */
+#define DISPATCH_MIN_CHILDREN 4
+
+/* The children that can match a string starting with character C are
+ * CHILD[START[C+1]] up to, but not including, CHILD[START[C+2]]; the ones
+ * that can match the empty string are those for C == -1. Being able to
+ * match the empty string does not put a child in the list for any
+ * character */
+struct lens_dispatch {
+    unsigned int  start[UCHAR_MAX + 3];
+    unsigned int *child;
+};
+
+static void free_dispatch(struct lens_dispatch *dispatch) {
+    if (dispatch == NULL)
+        return;
+    free(dispatch->child);
+    free(dispatch);
+}
+
+/* Build the dispatch table for the union LENS from the type LT of its
+ * children. Return NULL if that can't be done, or if the table would not
+ * rule out any child for any character */
+static struct lens_dispatch *make_dispatch(struct lens *lens,
+                                           enum lens_type lt) {
+    struct lens_dispatch *dispatch = NULL;
+    bool (*first)[UCHAR_MAX + 2] = NULL;
+    unsigned int n = 0;
+    bool useful = false;
+
+    if (lens->nchildren < DISPATCH_MIN_CHILDREN)
+        return NULL;
+    if (ALLOC_N(first, lens->nchildren) < 0)
+        goto error;
+
+    /* FIRST[I][0] is for the empty string, FIRST[I][C+1] for C */
+    for (int i=0; i < lens->nchildren; i++) {
+        struct regexp *type = ltype(lens->children[i], lt);
+        bool any = false;
+
+        if (type == NULL
+            || regexp_first_chars(type, first[i] + 1, first[i]) < 0)
+            goto error;
+        for (int c = 0; c < UCHAR_MAX + 2; c++)
+            any = any || first[i][c];
+        /* A type that matches nothing can still match part of a string in
+         * error recovery, and we do not know how that starts */
+        if (! any)
+            memset(first[i], true, UCHAR_MAX + 2);
+    }
+
+    if (ALLOC(dispatch) < 0)
+        goto error;
+    for (int c = 0; c < UCHAR_MAX + 2; c++) {
+        unsigned int count = 0;
+        for (int i=0; i < lens->nchildren; i++)
+            count += first[i][c];
+        useful = useful || count < lens->nchildren;
+        n += count;
+    }
+    if (! useful)
+        goto error;
+
+    if (ALLOC_N(dispatch->child, n) < 0)
+        goto error;
+    n = 0;
+    for (int c = 0; c < UCHAR_MAX + 2; c++) {
+        dispatch->start[c] = n;
+        for (int i=0; i < lens->nchildren; i++)
+            if (first[i][c])
+                dispatch->child[n++] = i;
+    }
+    dispatch->start[UCHAR_MAX + 2] = n;
+
+    free(first);
+    return dispatch;
+ error:
+    free(first);
+    free_dispatch(dispatch);
+    return NULL;
+}
+
+unsigned int lns_union_candidates(struct lens *lens, bool atype, int c,
+                                  const unsigned int **cand) {
+    struct lens_dispatch *dispatch;
+
+    if (atype) {
+        if (! lens->adispatch_checked) {
+            lens->adispatch = make_dispatch(lens, ATYPE);
+            lens->adispatch_checked = 1;
+        }
+        dispatch = lens->adispatch;
+    } else {
+        if (! lens->cdispatch_checked) {
+            lens->cdispatch = make_dispatch(lens, CTYPE);
+            lens->cdispatch_checked = 1;
+        }
+        dispatch = lens->cdispatch;
+    }
+
+    if (dispatch == NULL) {
+        *cand = NULL;
+        return lens->nchildren;
+    }
+    *cand = dispatch->child + dispatch->start[c + 1];
+    return dispatch->start[c + 2] - dispatch->start[c + 1];
+}
+
 void free_lens(struct lens *lens) {
     if (lens == NULL)
         return;
@@ -1003,6 +1154,10 @@ void free_lens(struct lens *lens) {
         for (int i=0; i < lens->nchildren; i++)
             unref(lens->children[i], lens);
         free(lens->children);
+        free(lens->ctype_regs);
+        free(lens->atype_regs);
+        free_dispatch(lens->cdispatch);
+        free_dispatch(lens->adispatch);
         break;
     case L_REC:
         if (!lens->rec_internal) {
@@ -1019,6 +1174,7 @@ void free_lens(struct lens *lens) {
 
     unref(lens->info, info);
     jmt_free(lens->jmt);
+    free(lens->plugin_nodes);
     free(lens);
  error:
     return;
@@ -1049,8 +1205,105 @@ void lens_release(struct lens *lens) {
         lens_release(lens->body);
     }
 
-    jmt_free(lens->jmt);
-    lens->jmt = NULL;
+    /* The parser for a recursive lens is kept; building it is expensive,
+     * and it is never changed once built */
+    lens->plugin_checked = 0;
+    lens->plugin = NULL;
+    FREE(lens->plugin_nodes);
+}
+
+int lns_build_jmt(struct lens *lens) {
+    if (lens->jmt == NULL)
+        lens->jmt = jmt_build(lens);
+    return lens->jmt == NULL ? -1 : 0;
+}
+
+/*
+ * Fingerprints, using 64 bit FNV-1a
+ */
+#define FINGERPRINT_BASIS UINT64_C(0xcbf29ce484222325)
+#define FINGERPRINT_PRIME UINT64_C(0x100000001b3)
+
+static uint64_t fingerprint_bytes(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+
+    for (size_t i=0; i < len; i++) {
+        h ^= p[i];
+        h *= FINGERPRINT_PRIME;
+    }
+    return h;
+}
+
+static uint64_t fingerprint_uint(uint64_t h, unsigned int u) {
+    return fingerprint_bytes(h, &u, sizeof(u));
+}
+
+/* Strings are hashed with their terminating NUL, so that two strings
+ * next to each other can't be confused with a different split */
+static uint64_t fingerprint_str(uint64_t h, const char *s) {
+    if (s == NULL)
+        return fingerprint_uint(h, 0);
+    return fingerprint_bytes(h, s, strlen(s) + 1);
+}
+
+/* The text of a regexp is not part of the fingerprint: regexps computed
+ * from automata, e.g. with the '-' operator, are written out in an order
+ * that changes from run to run. That is harmless, since plugins only ever
+ * supply DFAs for regexps whose pattern matches exactly */
+static uint64_t fingerprint_regexp(uint64_t h, struct regexp *r) {
+    if (r == NULL)
+        return fingerprint_uint(h, 0);
+    return fingerprint_uint(h, 1 + r->nocase);
+}
+
+static uint64_t fingerprint(uint64_t h, struct lens *lens) {
+    h = fingerprint_uint(h, lens->tag);
+    h = fingerprint_uint(h, lens->recursive);
+    h = fingerprint_regexp(h, lens->ctype);
+    switch (lens->tag) {
+    case L_DEL:
+        h = fingerprint_regexp(h, lens->regexp);
+        h = fingerprint_str(h, lens->string == NULL ? NULL
+                                                    : lens->string->str);
+        break;
+    case L_STORE:
+    case L_KEY:
+        h = fingerprint_regexp(h, lens->regexp);
+        break;
+    case L_VALUE:
+    case L_LABEL:
+    case L_SEQ:
+    case L_COUNTER:
+        h = fingerprint_str(h, lens->string->str);
+        break;
+    case L_SUBTREE:
+    case L_STAR:
+    case L_MAYBE:
+    case L_SQUARE:
+        h = fingerprint(h, lens->child);
+        break;
+    case L_CONCAT:
+    case L_UNION:
+        h = fingerprint_uint(h, lens->nchildren);
+        for (int i=0; i < lens->nchildren; i++)
+            h = fingerprint(h, lens->children[i]);
+        break;
+    case L_REC:
+        /* The body of the internal instance is the body of the outside
+         * one, which we visit */
+        h = fingerprint_uint(h, lens->rec_internal);
+        if (!lens->rec_internal)
+            h = fingerprint(h, lens->body);
+        break;
+    default:
+        BUG_LENS_TAG(lens);
+        break;
+    }
+    return h;
+}
+
+uint64_t lns_fingerprint(struct lens *lens) {
+    return fingerprint(FINGERPRINT_BASIS, lens);
 }
 
 /*
@@ -2026,6 +2279,8 @@ static void propagate_type(struct lens *l, enum lens_type lt) {
         }
         ltype(l, lt) = regexp_concat_n(l->info, l->nchildren, types);
         FREE(types);
+        r = lens_child_regs(l, lt);
+        ERR_NOMEM(r < 0, l->info);
         break;
     case L_UNION:
         r = ALLOC_N(types, l->nchildren);
@@ -2036,6 +2291,8 @@ static void propagate_type(struct lens *l, enum lens_type lt) {
         }
         ltype(l, lt) = regexp_union_n(l->info, l->nchildren, types);
         FREE(types);
+        r = lens_child_regs(l, lt);
+        ERR_NOMEM(r < 0, l->info);
         break;
     case L_SUBTREE:
         propagate_type(l->child, lt);
@@ -80,6 +80,11 @@ struct lens {
     struct regexp            *ktype;
     struct regexp            *vtype;
     struct jmt               *jmt;    /* When recursive == 1, might have jmt */
+    /* The lens plugin whose get routine we use for this lens, and the
+     * sublenses in the order in which that routine numbers them; see
+     * LENS_PLUGINS_ATTACH */
+    const struct augcc_lens  *plugin;
+    struct lens             **plugin_nodes;
     unsigned int              value : 1;
     unsigned int              key : 1;
     unsigned int              recursive : 1;
@@ -87,6 +92,15 @@ struct lens {
     /* Whether we are inside a recursive lens or outside */
     unsigned int              rec_internal : 1;
     unsigned int              ctype_nullable : 1;
+    /* Whether we looked for a lens plugin for this lens already */
+    unsigned int              plugin_checked : 1;
+    /* For L_STAR, whether we checked if every match of the child is a
+     * single line, and whether it is; see STAR_MATCH_END in get.c */
+    unsigned int              lines_checked : 1;
+    unsigned int              lines : 1;
+    /* For L_UNION, whether we tried to build CDISPATCH and ADISPATCH */
+    unsigned int              cdispatch_checked : 1;
+    unsigned int              adispatch_checked : 1;
     union {
         /* Primitive lenses */
         struct {                   /* L_DEL uses both */
@@ -98,6 +112,16 @@ struct lens {
         struct {                    /* L_UNION, L_CONCAT */
             unsigned int nchildren;
             struct lens **children;
+            /* In a match of the ctype (atype), the group for children[i]
+             * is ctype_regs[i] (atype_regs[i]) registers after the group
+             * for the whole lens. Computed when the type is assigned */
+            unsigned int *ctype_regs;
+            unsigned int *atype_regs;
+            /* L_UNION only: which children can match a string starting
+             * with a given character, going by their ctype (atype); see
+             * LNS_UNION_CANDIDATES */
+            struct lens_dispatch *cdispatch;
+            struct lens_dispatch *adispatch;
         };
         struct {
             struct lens *body;      /* L_REC */
@@ -144,6 +168,21 @@ struct value *lns_make_square(struct info *, struct lens *, struct lens *,
                               struct lens *lens, int check);
 
 
+/* Find the children of the union LENS that can match a string starting
+ * with character C, or the empty string if C is -1, going by their atype
+ * if ATYPE is true and by their ctype otherwise. Set *CAND to their
+ * indexes in LENS->CHILDREN, in order, and return how many there are.
+ * A child that can match the empty string is only listed for C == -1,
+ * and for the characters its nonempty matches can start with; for C >= 0,
+ * the candidates are only those that can match a nonempty string.
+ * When we do not have a table for LENS, any child can match; then *CAND
+ * is set to NULL and the result is the number of children.
+ *
+ * The table is built the first time it is needed, which modifies LENS.
+ */
+unsigned int lns_union_candidates(struct lens *lens, bool atype, int c,
+                                  const unsigned int **cand);
+
 /* Pretty-print a lens */
 char *format_lens(struct lens *l);
 
@@ -175,6 +214,8 @@ struct lns_error {
     int           pos;        /* Errors from get/parse */
     char         *path;       /* Errors from put, pos will be -1 */
     char         *message;
+    bool          timeout;    /* Get gave up because it ran out of time */
+    bool          deferred;   /* Only LENS and POS are known, see LNS_GET */
 };
 
 struct dict *make_dict(char *key, struct skel *skel, struct dict *subdict);
@@ -192,12 +233,45 @@ void free_lns_error(struct lns_error *err);
  * NULL, return the tree on success, and NULL on failure.
  *
  * ENABLE_SPAN indicates whether span information should be collected or not
+ *
+ * If DEFER_ERRORS is set, errors are not diagnosed any further than
+ * finding the lens that failed and the position where it failed, and have
+ * their DEFERRED flag set. Their messages are generic, and they never
+ * have LAST and NEXT lenses. Running LNS_GET again on the same text
+ * without DEFER_ERRORS produces the full error.
+ *
+ * If MAX_TIME is not 0, give up with an error after spending more than
+ * MAX_TIME milliseconds on TEXT; the error then has its TIMEOUT flag set.
+ *
+ * If PARALLEL is set, a big TEXT may be gotten in chunks on several
+ * threads, see AUG_PARALLEL_LOAD.
  */
 struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
-                     int enable_span, struct lns_error **err);
+                     int enable_span, int defer_errors, int parallel,
+                     unsigned int max_time, struct lns_error **err);
 struct skel *lns_parse(struct lens *lens, const char *text,
                        struct dict **dict, struct lns_error **err);
 
+/* Return true if LENS is a star that matches a text one line at a time,
+ * and the trees it produces for a line only depend on that line. LNS_GET
+ * then produces the same trees for any part of a text that starts and
+ * ends at a line boundary as it does for that part when it gets the
+ * whole text */
+bool lns_get_lines(struct lens *lens);
+
+/* Parse text TEXT with LENS like LNS_GET, but instead of building a tree,
+ * report the nodes through the callbacks in CB as described for
+ * AUG_TEXT_STREAM. Spans are never collected.
+ *
+ * Return 0 if all of TEXT was processed, 1 if a callback stopped
+ * processing early, and -1 on error. If ERR is non-NULL, *ERR is set to
+ * the error, or to NULL if there was none.
+ */
+struct aug_text_callbacks;
+int lns_get_stream(struct info *info, struct lens *lens, const char *text,
+                   const struct aug_text_callbacks *cb,
+                   struct lns_error **err);
+
 /* Write tree TREE that was initially read from TEXT (but might have been
  * modified) into file OUT using LENS.
  *
@@ -215,6 +289,15 @@ void lns_put(struct info *info, FILE *out, struct lens *lens, struct tree *tree,
 void lens_release(struct lens *lens);
 void free_lens(struct lens *lens);
 
+/* Build the parser for the recursive LENS, unless it already has one.
+ * Return -1 on error, with details in LENS->INFO->ERROR */
+int lns_build_jmt(struct lens *lens);
+
+/* A hash of the structure of LENS and its strings. Lens plugins are only
+ * used for lenses with the same fingerprint as the lens they were
+ * generated from */
+uint64_t lns_fingerprint(struct lens *lens);
+
 /*
  * Encoding of tree levels into strings
  */
@@ -101,3 +101,99 @@ int mem_realloc_n(void *ptrptr, size_t size, size_t count)
     *(void**)ptrptr = tmp;
     return 0;
 }
+
+/*
+ * Arenas
+ */
+
+/* Memory is handed out from chunks of this size; bigger requests get a
+ * chunk of their own */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/* Everything handed out is suitably aligned for any of these. We build
+ * with -std=gnu99, which does not have max_align_t */
+union arena_align {
+    long long    ll;
+    long double  ld;
+    void        *p;
+    void       (*fp)(void);
+};
+#define ARENA_ALIGN (sizeof(union arena_align))
+
+struct chunk {
+    struct chunk *next;
+    size_t        size;
+    size_t        used;
+    union arena_align data[];
+};
+
+struct arena {
+    struct chunk *chunks;   /* The chunk we allocate from is first */
+};
+
+struct arena *make_arena(void) {
+    struct arena *arena;
+
+    if (ALLOC(arena) < 0)
+        return NULL;
+    return arena;
+}
+
+void free_arena(struct arena *arena) {
+    if (arena == NULL)
+        return;
+    while (arena->chunks != NULL) {
+        struct chunk *chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        free(chunk);
+    }
+    free(arena);
+}
+
+size_t arena_size(const struct arena *arena) {
+    size_t size = 0;
+
+    for (const struct chunk *c = arena->chunks; c != NULL; c = c->next)
+        size += sizeof(*c) + c->size;
+    return size;
+}
+
+int arena_alloc_n(struct arena *arena, void *ptrptr, size_t size,
+                  size_t count) {
+    struct chunk *chunk = arena->chunks;
+    size_t bytes;
+
+    if (AUGEAS_UNLIKELY(size == 0 || count == 0)) {
+        *(void **)ptrptr = NULL;
+        return 0;
+    }
+    if (AUGEAS_UNLIKELY(xalloc_oversized(count, size)
+                        || size * count > SIZE_MAX - ARENA_ALIGN)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    bytes = ((size * count + ARENA_ALIGN - 1) / ARENA_ALIGN) * ARENA_ALIGN;
+
+    if (chunk == NULL || chunk->size - chunk->used < bytes) {
+        size_t chunk_size = ARENA_CHUNK_SIZE;
+        if (bytes > chunk_size)
+            chunk_size = bytes;
+        chunk = malloc(sizeof(*chunk) + chunk_size);
+        if (AUGEAS_UNLIKELY(chunk == NULL))
+            return -1;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        if (arena->chunks != NULL && bytes > ARENA_CHUNK_SIZE) {
+            /* Keep allocating from the current chunk */
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        } else {
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+        }
+    }
+    *(void **)ptrptr = (char *) chunk->data + chunk->used;
+    chunk->used += bytes;
+    memset(*(void **)ptrptr, 0, bytes);
+    return 0;
+}
@@ -81,4 +81,48 @@ int mem_realloc_n(void *ptrptr, size_t size, size_t count) ATTRIBUTE_RETURN_CHEC
     (ptr) = NULL;                               \
   } while(0)
 
+/*
+ * Arenas
+ *
+ * An arena hands out memory for objects that are all freed at the same
+ * time by FREE_ARENA. Individual objects can not be freed, which makes
+ * allocating them much cheaper than with ALLOC.
+ */
+struct arena;
+
+struct arena *make_arena(void);
+void free_arena(struct arena *arena);
+
+/* The number of bytes ARENA has taken from malloc */
+size_t arena_size(const struct arena *arena);
+
+/* Don't call this directly - use the macros below */
+int arena_alloc_n(struct arena *arena, void *ptrptr, size_t size,
+                  size_t count) ATTRIBUTE_RETURN_CHECK;
+
+/**
+ * ARENA_ALLOC:
+ * @arena: the arena to allocate from
+ * @ptr: pointer to hold address of allocated memory
+ *
+ * Like ALLOC, but take the memory from ARENA
+ *
+ * Returns -1 on failure, 0 on success
+ */
+#define ARENA_ALLOC(arena, ptr)                                 \
+    arena_alloc_n((arena), &(ptr), sizeof(*(ptr)), 1)
+
+/**
+ * ARENA_ALLOC_N:
+ * @arena: the arena to allocate from
+ * @ptr: pointer to hold address of allocated memory
+ * @count: number of elements to allocate
+ *
+ * Like ALLOC_N, but take the memory from ARENA
+ *
+ * Returns -1 on failure, 0 on success
+ */
+#define ARENA_ALLOC_N(arena, ptr, count)                        \
+    arena_alloc_n((arena), &(ptr), sizeof(*(ptr)), (count))
+
 #endif /* __VIR_MEMORY_H_ */
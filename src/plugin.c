@@ -0,0 +1,881 @@
+/*
+ * plugin.c: lens plugins generated by augcc
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <argz.h>
+#include <ctype.h>
+#include <inttypes.h>
+#if HAVE_DLOPEN
+#include <dlfcn.h>
+#endif
+
+#include "internal.h"
+#include "memory.h"
+#include "errcode.h"
+#include "syntax.h"
+#include "lens.h"
+#include "regexp.h"
+#include "jmt.h"
+#include "augcc.h"
+#include "plugin.h"
+
+/* When generating a plugin, we build DFAs for regexps whose automaton has
+ * up to this many states; that's much bigger than what we build on demand,
+ * since the time it takes is only spent once, when the plugin is built */
+#define PLUGIN_DFA_MAX_NFA 8192
+
+struct lens_plugins {
+    size_t                      nplugins;
+    void                      **handles;
+    const struct augcc_plugin **plugins;
+};
+
+/*
+ * The regexps of a lens
+ */
+
+/* Call VISIT for each regexp that LNS_GET might match against for LENS.
+ * REVERSE is true for the regexps for which it also uses a reverse DFA.
+ * Return -1 as soon as VISIT returns -1, and 0 otherwise. */
+typedef int (*regexp_visitor)(struct regexp *re, bool reverse, void *data);
+
+static int visit_regexps(struct lens *lens, bool reverse,
+                         regexp_visitor visit, void *data) {
+    if (lens->ctype != NULL && visit(lens->ctype, reverse, data) < 0)
+        return -1;
+
+    switch (lens->tag) {
+    case L_DEL:
+    case L_STORE:
+    case L_KEY:
+        if (lens->regexp != lens->ctype
+            && visit(lens->regexp, false, data) < 0)
+            return -1;
+        break;
+    case L_SUBTREE:
+    case L_STAR:
+    case L_MAYBE:
+    case L_SQUARE:
+        return visit_regexps(lens->child, false, visit, data);
+    case L_CONCAT:
+    case L_UNION:
+        for (int i=0; i < lens->nchildren; i++) {
+            /* Matches of a concat are split among its children with the
+             * reverse DFAs of all but the first child */
+            bool rev = lens->tag == L_CONCAT && i > 0;
+            if (visit_regexps(lens->children[i], rev, visit, data) < 0)
+                return -1;
+        }
+        break;
+    case L_REC:
+        if (!lens->rec_internal)
+            return visit_regexps(lens->body, false, visit, data);
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static int regexp_cmp(const char *pattern1, unsigned int nocase1,
+                      const char *pattern2, unsigned int nocase2) {
+    int r = strcmp(pattern1, pattern2);
+    if (r != 0)
+        return r;
+    return (int) nocase1 - (int) nocase2;
+}
+
+/*
+ * Using plugins
+ */
+
+static int augcc_regexp_cmp(const void *key, const void *elt) {
+    const struct regexp *re = key;
+    const struct augcc_regexp *ar = elt;
+
+    return regexp_cmp(re->pattern->str, re->nocase, ar->pattern, ar->nocase);
+}
+
+static int attach_regexp(struct regexp *re, ATTRIBUTE_UNUSED bool reverse,
+                         void *data) {
+    const struct augcc_lens *alens = data;
+    const struct augcc_regexp *ar;
+
+    ar = bsearch(re, alens->regexps, alens->nregexps, sizeof(*ar),
+                 augcc_regexp_cmp);
+    if (ar == NULL)
+        return 0;
+    if (re->dfa == NULL && ar->dfa != NULL)
+        re->dfa = make_dfa_borrowed(ar->dfa);
+    if (re->rdfa == NULL && ar->rdfa != NULL)
+        re->rdfa = make_dfa_borrowed(ar->rdfa);
+    return 0;
+}
+
+/* Number LENS and its sublenses in NODES in preorder, starting at N, the
+ * way the get routine in ALENS does, and check that the ctype of each of
+ * them has the pattern it had when the plugin was generated. Return the
+ * number after the last one, or -1 if the ctypes do not match */
+static int number_nodes(const struct augcc_lens *alens, struct lens *lens,
+                        struct lens **nodes, int n) {
+    if ((unsigned int) n >= alens->nnodes || lens->ctype == NULL)
+        return -1;
+    if (augcc_regexp_cmp(lens->ctype, alens->regexps + alens->ctypes[n]) != 0)
+        return -1;
+    nodes[n++] = lens;
+
+    switch (lens->tag) {
+    case L_DEL:
+    case L_STORE:
+    case L_VALUE:
+    case L_KEY:
+    case L_LABEL:
+    case L_SEQ:
+    case L_COUNTER:
+        return n;
+    case L_SUBTREE:
+    case L_STAR:
+    case L_MAYBE:
+    case L_SQUARE:
+        return number_nodes(alens, lens->child, nodes, n);
+    case L_CONCAT:
+    case L_UNION:
+        for (int i=0; i < lens->nchildren && n >= 0; i++)
+            n = number_nodes(alens, lens->children[i], nodes, n);
+        return n;
+    default:
+        return -1;
+    }
+}
+
+static void attach_get(struct lens *lens, const struct augcc_lens *alens) {
+    struct lens **nodes = NULL;
+
+    if (alens->get == NULL || lens->recursive)
+        return;
+    if (ALLOC_N(nodes, alens->nnodes) < 0)
+        return;
+    if (number_nodes(alens, lens, nodes, 0) != (int) alens->nnodes) {
+        if (debugging("plugins"))
+            fprintf(stderr, "plugins: not using get for %s, its regexps "
+                    "have changed\n", alens->name);
+        free(nodes);
+        return;
+    }
+    lens->plugin = alens;
+    lens->plugin_nodes = nodes;
+    if (debugging("plugins"))
+        fprintf(stderr, "plugins: using get for %s\n", alens->name);
+}
+
+void lens_plugins_attach(struct lens_plugins *plugins, struct lens *lens) {
+    uint64_t fingerprint;
+
+    if (plugins == NULL || lens->plugin_checked)
+        return;
+    lens->plugin_checked = 1;
+
+    fingerprint = lns_fingerprint(lens);
+    for (size_t i=0; i < plugins->nplugins; i++) {
+        const struct augcc_plugin *plugin = plugins->plugins[i];
+        for (unsigned int j=0; j < plugin->nlenses; j++) {
+            const struct augcc_lens *alens = plugin->lenses + j;
+            if (alens->fingerprint != fingerprint)
+                continue;
+            if (debugging("plugins"))
+                fprintf(stderr, "plugins: using DFAs for %s\n", alens->name);
+            visit_regexps(lens, false, attach_regexp, (void *) alens);
+            attach_get(lens, alens);
+            if (lens->recursive && lens->jmt == NULL && alens->jmt != NULL) {
+                lens->jmt = jmt_from_tables(lens, alens->jmt);
+                if (lens->jmt != NULL && debugging("plugins"))
+                    fprintf(stderr, "plugins: using parser for %s\n",
+                            alens->name);
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * Loading plugins
+ */
+#if HAVE_DLOPEN
+static const struct augcc_plugin *open_plugin(const char *path,
+                                              void **handle) {
+    const struct augcc_plugin *plugin = NULL;
+
+    *handle = dlopen(path, RTLD_NOW|RTLD_LOCAL);
+    if (*handle == NULL) {
+        if (debugging("plugins"))
+            fprintf(stderr, "plugins: %s\n", dlerror());
+        return NULL;
+    }
+    plugin = dlsym(*handle, AUGCC_PLUGIN_SYMBOL);
+    if (plugin == NULL || plugin->abi_version != AUGCC_ABI_VERSION) {
+        if (debugging("plugins"))
+            fprintf(stderr, "plugins: %s is not a lens plugin for this "
+                    "version of augeas\n", path);
+        dlclose(*handle);
+        *handle = NULL;
+        return NULL;
+    }
+    return plugin;
+}
+#else
+static const struct augcc_plugin *open_plugin(const char *path,
+                                              void **handle) {
+    if (debugging("plugins"))
+        fprintf(stderr, "plugins: can not load %s: no dlopen\n", path);
+    *handle = NULL;
+    return NULL;
+}
+#endif
+
+struct lens_plugins *load_lens_plugins(const char *paths) {
+    struct lens_plugins *plugins = NULL;
+    char *argz = NULL;
+    size_t argz_len = 0;
+    size_t count;
+
+    if (argz_create_sep(paths, ':', &argz, &argz_len) != 0)
+        goto error;
+    count = argz_count(argz, argz_len);
+    if (count == 0)
+        goto error;
+
+    if (ALLOC(plugins) < 0)
+        goto error;
+    if (ALLOC_N(plugins->handles, count) < 0
+        || ALLOC_N(plugins->plugins, count) < 0)
+        goto error;
+
+    for (char *p = argz; p != NULL; p = argz_next(argz, argz_len, p)) {
+        size_t n = plugins->nplugins;
+        plugins->plugins[n] = open_plugin(p, plugins->handles + n);
+        if (plugins->plugins[n] != NULL)
+            plugins->nplugins += 1;
+    }
+    if (plugins->nplugins == 0)
+        goto error;
+
+    free(argz);
+    return plugins;
+ error:
+    free_lens_plugins(plugins);
+    free(argz);
+    return NULL;
+}
+
+void free_lens_plugins(struct lens_plugins *plugins) {
+    if (plugins == NULL)
+        return;
+#if HAVE_DLOPEN
+    for (size_t i=0; i < plugins->nplugins; i++)
+        dlclose(plugins->handles[i]);
+#endif
+    free(plugins->handles);
+    free(plugins->plugins);
+    free(plugins);
+}
+
+/*
+ * Writing plugins
+ */
+
+/* A regexp we write DFAs for */
+struct gen_regexp {
+    struct regexp *re;
+    bool           reverse;  /* Whether we need a reverse DFA, too */
+    int            dfa;      /* Index of the DFA we wrote, or -1 */
+    int            rdfa;     /* Index of the reverse DFA we wrote, or -1 */
+};
+
+struct gen_regexps {
+    struct gen_regexp *regexps;
+    size_t             nregexps;
+    size_t             size;
+};
+
+static int gen_regexp_cmp(const void *p1, const void *p2) {
+    const struct gen_regexp *g1 = p1, *g2 = p2;
+
+    return regexp_cmp(g1->re->pattern->str, g1->re->nocase,
+                      g2->re->pattern->str, g2->re->nocase);
+}
+
+static int collect_regexp(struct regexp *re, bool reverse, void *data) {
+    struct gen_regexps *gr = data;
+
+    if (gr->nregexps >= gr->size) {
+        size_t size = (gr->size == 0) ? 64 : 2 * gr->size;
+        if (REALLOC_N(gr->regexps, size) < 0)
+            return -1;
+        gr->size = size;
+    }
+    gr->regexps[gr->nregexps].re = re;
+    gr->regexps[gr->nregexps].reverse = reverse;
+    gr->regexps[gr->nregexps].dfa = -1;
+    gr->regexps[gr->nregexps].rdfa = -1;
+    gr->nregexps += 1;
+    return 0;
+}
+
+/* Sort the regexps in GR the way struct augcc_lens needs them, and merge
+ * duplicates */
+static void sort_regexps(struct gen_regexps *gr) {
+    size_t n = 0;
+
+    if (gr->nregexps == 0)
+        return;
+    qsort(gr->regexps, gr->nregexps, sizeof(*gr->regexps), gen_regexp_cmp);
+    for (size_t i=1; i < gr->nregexps; i++) {
+        if (gen_regexp_cmp(gr->regexps + n, gr->regexps + i) == 0) {
+            gr->regexps[n].reverse |= gr->regexps[i].reverse;
+        } else {
+            n += 1;
+            gr->regexps[n] = gr->regexps[i];
+        }
+    }
+    gr->nregexps = n + 1;
+}
+
+/* Write S as a C string literal */
+static void write_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *) s; *p; p++) {
+        /* Escape '?' to avoid trigraphs */
+        if (*p == '"' || *p == '\\' || *p == '?')
+            fprintf(out, "\\%c", *p);
+        else if (isprint(*p))
+            fputc(*p, out);
+        else
+            fprintf(out, "\\%03o", *p);
+    }
+    fputc('"', out);
+}
+
+static void write_dfa(FILE *out, char kind, size_t id, struct dfa *dfa) {
+    struct augcc_dfa t;
+    size_t ntrans;
+
+    dfa_tables(dfa, &t);
+    ntrans = (size_t) t.nstates * t.nclasses;
+
+    fprintf(out, "static const unsigned char %c%zu_classes[] = {", kind, id);
+    for (int i=0; i <= UCHAR_MAX; i++)
+        fprintf(out, "%s%u,", (i % 16 == 0) ? "\n    " : " ", t.classes[i]);
+    fprintf(out, "\n};\n");
+
+    fprintf(out, "static const bool %c%zu_accept[] = {", kind, id);
+    for (unsigned int i=0; i < t.nstates; i++)
+        fprintf(out, "%s%d,", (i % 16 == 0) ? "\n    " : " ", t.accept[i]);
+    fprintf(out, "\n};\n");
+
+    fprintf(out, "static const int %c%zu_trans[] = {", kind, id);
+    for (size_t i=0; i < ntrans; i++)
+        fprintf(out, "%s%d,", (i % 16 == 0) ? "\n    " : " ", t.trans[i]);
+    fprintf(out, "\n};\n");
+
+    fprintf(out, "static const struct augcc_dfa %c%zu = {\n"
+            "    %u, %u, %c%zu_classes, %c%zu_accept, %c%zu_trans\n};\n\n",
+            kind, id, t.nstates, t.nclasses,
+            kind, id, kind, id, kind, id);
+}
+
+/* Write the DFAs for all regexps in GR, and remember in each entry which
+ * ones we wrote */
+static void write_dfas(FILE *out, struct gen_regexps *gr) {
+    for (size_t i=0; i < gr->nregexps; i++) {
+        struct gen_regexp *g = gr->regexps + i;
+        struct dfa *dfa;
+
+        dfa = regexp_make_dfa(g->re, false, PLUGIN_DFA_MAX_NFA);
+        if (dfa == NULL)
+            continue;
+        write_dfa(out, 'd', i, dfa);
+        g->dfa = i;
+        free_dfa(dfa);
+
+        if (! g->reverse)
+            continue;
+        dfa = regexp_make_dfa(g->re, true, PLUGIN_DFA_MAX_NFA);
+        if (dfa == NULL)
+            continue;
+        write_dfa(out, 'r', i, dfa);
+        g->rdfa = i;
+        free_dfa(dfa);
+    }
+}
+
+static void write_lens_regexps(FILE *out, size_t index,
+                               struct gen_regexps *lr,
+                               struct gen_regexps *all) {
+    fprintf(out, "static const struct augcc_regexp lens%zu_regexps[] = {\n",
+            index);
+    for (size_t i=0; i < lr->nregexps; i++) {
+        struct gen_regexp *g;
+
+        g = bsearch(lr->regexps + i, all->regexps, all->nregexps,
+                    sizeof(*g), gen_regexp_cmp);
+        fprintf(out, "    { ");
+        write_string(out, g->re->pattern->str);
+        fprintf(out, ", %u, ", g->re->nocase);
+        if (g->dfa >= 0)
+            fprintf(out, "&d%d, ", g->dfa);
+        else
+            fprintf(out, "NULL, ");
+        if (g->rdfa >= 0)
+            fprintf(out, "&r%d },\n", g->rdfa);
+        else
+            fprintf(out, "NULL },\n");
+    }
+    fprintf(out, "};\n\n");
+}
+
+static void write_uints(FILE *out, const char *type, size_t index,
+                        const char *name, const uint32_t *v, size_t n) {
+    fprintf(out, "static const %s jmt%zu_%s[] = {", type, index, name);
+    for (size_t i=0; i < n; i++)
+        fprintf(out, "%s%" PRIu32 ",", (i % 8 == 0) ? "\n    " : " ", v[i]);
+    if (n == 0)
+        fprintf(out, " 0");
+    fprintf(out, "\n};\n");
+}
+
+/* Write the parser for the recursive lens LENS */
+static int write_jmt(FILE *out, size_t index, struct lens *lens) {
+    struct augcc_jmt t;
+    uint32_t *nonterminal = NULL;
+
+    if (lns_build_jmt(lens) < 0)
+        return -1;
+    if (jmt_tables(lens->jmt, &t) < 0)
+        return -1;
+    if (ALLOC_N(nonterminal, t.nlenses + 1) < 0) {
+        jmt_free_tables(&t);
+        return -1;
+    }
+    for (unsigned int i=0; i < t.nlenses; i++)
+        nonterminal[i] = t.nonterminal[i];
+
+    write_uints(out, "unsigned char", index, "nonterminal",
+                nonterminal, t.nlenses);
+    write_uints(out, "uint32_t", index, "num", t.num, t.nstates);
+    write_uints(out, "uint32_t", index, "trans_start",
+                t.trans_start, t.nstates + 1);
+    write_uints(out, "uint32_t", index, "trans",
+                t.trans, 2 * t.trans_start[t.nstates]);
+    write_uints(out, "uint32_t", index, "ret_start",
+                t.ret_start, t.nstates + 1);
+    write_uints(out, "uint32_t", index, "ret",
+                t.ret, t.ret_start[t.nstates]);
+    fprintf(out, "static const struct augcc_jmt jmt%zu = {\n"
+            "    %" PRIu32 ", %u, jmt%zu_nonterminal, %u, jmt%zu_num,\n"
+            "    jmt%zu_trans_start, jmt%zu_trans,"
+            " jmt%zu_ret_start, jmt%zu_ret\n};\n\n",
+            index, t.lens, t.nlenses, index, t.nstates, index,
+            index, index, index, index);
+
+    free(nonterminal);
+    jmt_free_tables(&t);
+    return 0;
+}
+
+/*
+ * Writing get routines
+ *
+ * The get routine for a lens consists of one function per node, i.e., per
+ * occurrence of the lens or one of its sublenses, that gets the match
+ * TEXT[START..END) of that node, and calls the functions for the children
+ * of the node for their part of the match. Nodes are numbered in preorder,
+ * but written children first, so that we never need to declare them.
+ */
+
+struct gen_get {
+    FILE               *out;
+    size_t              index;    /* Of the lens we write the routine for */
+    struct gen_regexps *lr;       /* The regexps of that lens */
+    struct gen_regexps *all;      /* The regexps of all lenses */
+    unsigned int       *ctypes;   /* Index of each node's ctype in LR */
+    unsigned int        nnodes;
+    unsigned int        size;
+};
+
+static struct gen_regexp *find_regexp(struct gen_regexps *gr,
+                                      struct regexp *re) {
+    struct gen_regexp key = { .re = re };
+
+    if (re == NULL)
+        return NULL;
+    return bsearch(&key, gr->regexps, gr->nregexps, sizeof(key),
+                   gen_regexp_cmp);
+}
+
+/* Return true if we can write a get routine for LENS, which needs the DFA
+ * of its ctype if DFA is true */
+static bool can_write_get(struct lens *lens, struct gen_regexps *all,
+                          bool dfa) {
+    struct gen_regexp *g = find_regexp(all, lens->ctype);
+
+    if (lens->recursive || g == NULL || (dfa && g->dfa < 0))
+        return false;
+
+    switch (lens->tag) {
+    case L_DEL:
+    case L_STORE:
+    case L_VALUE:
+    case L_KEY:
+    case L_LABEL:
+    case L_SEQ:
+    case L_COUNTER:
+        return true;
+    case L_SUBTREE:
+    case L_MAYBE:
+        return can_write_get(lens->child, all, false);
+    case L_SQUARE:
+        return lens->child->tag == L_CONCAT
+            && can_write_get(lens->child, all, false);
+    case L_STAR:
+        return can_write_get(lens->child, all, true);
+    case L_CONCAT:
+    case L_UNION:
+        if (lens->nchildren < 2)
+            return false;
+        for (int i=0; i < lens->nchildren; i++) {
+            if (! can_write_get(lens->children[i], all, true))
+                return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Write the array lensINDEX_nNODE_dfas of the DFAs of the ctypes of the
+ * children of LENS */
+static void write_child_dfas(struct gen_get *gg, unsigned int node,
+                             struct lens *lens) {
+    fprintf(gg->out,
+            "static const struct augcc_dfa *const lens%zu_n%u_dfas[] = {",
+            gg->index, node);
+    for (int i=0; i < lens->nchildren; i++) {
+        struct gen_regexp *g = find_regexp(gg->all, lens->children[i]->ctype);
+        fprintf(gg->out, "%s&d%d", (i > 0) ? ", " : " ", g->dfa);
+    }
+    fprintf(gg->out, " };\n");
+}
+
+/* Write the function for LENS and its children, and return the number of
+ * its node, or -1 if we run out of memory. SQUARE is true if LENS is the
+ * child of a L_SQUARE */
+static int write_get_node(struct gen_get *gg, struct lens *lens,
+                          bool square) {
+    FILE *out = gg->out;
+    unsigned int node = gg->nnodes;
+    int *child = NULL;
+    int nchildren = 0, result = -1;
+
+    if (gg->nnodes >= gg->size) {
+        unsigned int size = (gg->size == 0) ? 64 : 2 * gg->size;
+        if (REALLOC_N(gg->ctypes, size) < 0)
+            return -1;
+        gg->size = size;
+    }
+    gg->ctypes[node] = find_regexp(gg->lr, lens->ctype) - gg->lr->regexps;
+    gg->nnodes += 1;
+
+    if (lens->tag == L_CONCAT || lens->tag == L_UNION)
+        nchildren = lens->nchildren;
+    else if (lens->tag == L_SUBTREE || lens->tag == L_STAR
+             || lens->tag == L_MAYBE || lens->tag == L_SQUARE)
+        nchildren = 1;
+    if (nchildren > 0 && ALLOC_N(child, nchildren) < 0)
+        return -1;
+    for (int i=0; i < nchildren; i++) {
+        struct lens *c = (nchildren == 1) ? lens->child : lens->children[i];
+        child[i] = write_get_node(gg, c, lens->tag == L_SQUARE);
+        if (child[i] < 0)
+            goto done;
+    }
+
+    if (lens->tag == L_CONCAT || lens->tag == L_UNION)
+        write_child_dfas(gg, node, lens);
+
+    fprintf(out, "static int lens%zu_n%u(struct augcc_get *g,\n"
+            "                 unsigned int start, unsigned int end) {\n",
+            gg->index, node);
+    switch (lens->tag) {
+    case L_DEL:
+        fprintf(out, "    return augcc_del(g, %u, start, end);\n", node);
+        break;
+    case L_STORE:
+    case L_KEY:
+        fprintf(out, "    return g->ops->%s(g->data, %u, start, end);\n",
+                (lens->tag == L_STORE) ? "store" : "key", node);
+        break;
+    case L_VALUE:
+    case L_LABEL:
+    case L_SEQ:
+    case L_COUNTER: {
+        const char *op = (lens->tag == L_VALUE) ? "value"
+            : (lens->tag == L_LABEL) ? "label"
+            : (lens->tag == L_SEQ) ? "seq" : "counter";
+        fprintf(out, "    (void) start;\n    (void) end;\n"
+                "    return g->ops->%s(g->data, %u);\n", op, node);
+        break;
+    }
+    case L_SUBTREE:
+        fprintf(out,
+                "    if (g->ops->enter(g->data, %u) < 0\n"
+                "        || lens%zu_n%d(g, start, end) < 0)\n"
+                "        return -1;\n"
+                "    return g->ops->leave(g->data, %u);\n",
+                node, gg->index, child[0], node);
+        break;
+    case L_SQUARE:
+        fprintf(out,
+                "    if (augcc_open(g, %u) < 0\n"
+                "        || lens%zu_n%d(g, start, end) < 0)\n"
+                "        return -1;\n"
+                "    return augcc_close(g, %u);\n",
+                node, gg->index, child[0], node);
+        break;
+    case L_MAYBE:
+        /* Whether a nullable child matched the empty word is up to the
+         * generic code */
+        if (lens->child->ctype_nullable)
+            fprintf(out, "    if (start == end)\n        return -1;\n");
+        fprintf(out,
+                "    if (augcc_open(g, %u) < 0)\n"
+                "        return -1;\n"
+                "    if (start < end && lens%zu_n%d(g, start, end) < 0)\n"
+                "        return -1;\n"
+                "    return augcc_close(g, %u);\n",
+                node, gg->index, child[0], node);
+        break;
+    case L_STAR: {
+        struct gen_regexp *g = find_regexp(gg->all, lens->child->ctype);
+        bool lines = regexp_is_line(lens->child->ctype) == 1;
+        fprintf(out,
+                "    unsigned int pos = start;\n\n"
+                "    if (augcc_open(g, %u) < 0)\n"
+                "        return -1;\n"
+                "    while (pos < end) {\n"
+                "        int n;\n"
+                "        if (augcc_expired(g))\n"
+                "            return -1;\n"
+                "        n = augcc_dfa_match(&d%d, g->text, pos, %s);\n"
+                "        if (n <= 0 || lens%zu_n%d(g, pos, pos + n) < 0)\n"
+                "            return -1;\n"
+                "        pos += n;\n"
+                "    }\n"
+                "    return augcc_close(g, %u);\n",
+                node, g->dfa,
+                lines ? "augcc_line_end(g->text, pos, end)" : "end",
+                gg->index, child[0], node);
+        break;
+    }
+    case L_CONCAT:
+        fprintf(out,
+                "    unsigned int split[%d];\n\n"
+                "    if (augcc_concat(g, %d, lens%zu_n%u_dfas, start, end, "
+                "split) < 0)\n"
+                "        return -1;\n",
+                nchildren + 1, nchildren, gg->index, node);
+        if (square) {
+            /* Like SQUARE_MATCH in get.c */
+            bool nocase = lens->children[0]->ctype->nocase
+                || lens->children[nchildren - 1]->ctype->nocase;
+            fprintf(out,
+                    "    if (! augcc_square(g, %s, split[0], split[1],\n"
+                    "                       split[%d], split[%d]))\n"
+                    "        return -1;\n",
+                    nocase ? "true" : "false", nchildren - 1, nchildren);
+        }
+        fprintf(out, "    if (augcc_open(g, %u) < 0)\n        return -1;\n",
+                node);
+        for (int i=0; i < nchildren; i++)
+            fprintf(out, "    if (lens%zu_n%d(g, split[%d], split[%d]) < 0)\n"
+                    "        return -1;\n", gg->index, child[i], i, i + 1);
+        fprintf(out, "    return augcc_close(g, %u);\n", node);
+        break;
+    case L_UNION:
+        fprintf(out, "    switch (augcc_union(g, %d, lens%zu_n%u_dfas, "
+                "start, end)) {\n", nchildren, gg->index, node);
+        for (int i=0; i < nchildren; i++)
+            fprintf(out, "    case %d:\n"
+                    "        return lens%zu_n%d(g, start, end);\n",
+                    i, gg->index, child[i]);
+        fprintf(out, "    default:\n        return -1;\n    }\n");
+        break;
+    default:
+        /* CAN_WRITE_GET keeps us from getting here */
+        goto done;
+    }
+    fprintf(out, "}\n\n");
+    result = node;
+ done:
+    free(child);
+    return result;
+}
+
+/* Write the get routine lensINDEX_get for LENS, and the ctype of each of
+ * its nodes. Return the number of nodes, 0 if there is no get routine for
+ * LENS, and -1 if we run out of memory */
+static int write_get(FILE *out, size_t index, struct lens *lens,
+                     struct gen_regexps *lr, struct gen_regexps *all) {
+    struct gen_get gg;
+    int result = -1;
+
+    if (! can_write_get(lens, all, lens->tag != L_STAR))
+        return 0;
+
+    MEMZERO(&gg, 1);
+    gg.out = out;
+    gg.index = index;
+    gg.lr = lr;
+    gg.all = all;
+    if (write_get_node(&gg, lens, false) < 0)
+        goto done;
+
+    fprintf(out, "static const unsigned int lens%zu_ctypes[] = {", index);
+    for (unsigned int i=0; i < gg.nnodes; i++)
+        fprintf(out, "%s%u,", (i % 16 == 0) ? "\n    " : " ", gg.ctypes[i]);
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static int lens%zu_get(const struct augcc_get_ops *ops, "
+            "void *data,\n"
+            "                     const char *text, unsigned int size) {\n"
+            "    struct augcc_get g = { ops, data, text, NULL, 0 };\n"
+            "    int r = -1;\n\n", index);
+    /* Like INIT_REGS in get.c, a L_STAR at the top matches everything */
+    if (lens->tag == L_STAR) {
+        fprintf(out, "    r = lens%zu_n0(&g, 0, size);\n", index);
+    } else {
+        struct gen_regexp *g = find_regexp(all, lens->ctype);
+        fprintf(out, "    if (augcc_dfa_match(&d%d, text, 0, size) "
+                "== (int) size)\n"
+                "        r = lens%zu_n0(&g, 0, size);\n", g->dfa, index);
+    }
+    fprintf(out, "    augcc_get_done(&g);\n    return r;\n}\n\n");
+    result = gg.nnodes;
+ done:
+    free(gg.ctypes);
+    return result;
+}
+
+int lens_plugin_write(struct augeas *aug, FILE *out,
+                      int nlenses, char *const *lenses) {
+    struct lens **lns = NULL;
+    struct gen_regexps *lr = NULL;
+    struct gen_regexps all;
+    int *nnodes = NULL;
+    int result = -1, r;
+
+    MEMZERO(&all, 1);
+    r = ALLOC_N(lns, nlenses);
+    ERR_NOMEM(r < 0, aug);
+    r = ALLOC_N(lr, nlenses);
+    ERR_NOMEM(r < 0, aug);
+    r = ALLOC_N(nnodes, nlenses);
+    ERR_NOMEM(r < 0, aug);
+
+    for (int i=0; i < nlenses; i++) {
+        lns[i] = lens_lookup(aug, lenses[i]);
+        ERR_BAIL(aug);
+        ERR_THROW(lns[i] == NULL, aug, AUG_ENOLENS,
+                  "Lens %s not found", lenses[i]);
+
+        r = visit_regexps(lns[i], false, collect_regexp, lr + i);
+        ERR_NOMEM(r < 0, aug);
+        r = visit_regexps(lns[i], false, collect_regexp, &all);
+        ERR_NOMEM(r < 0, aug);
+        sort_regexps(lr + i);
+    }
+    sort_regexps(&all);
+
+    fprintf(out, "/* Lens plugin generated by augcc. Do not edit.\n *\n"
+            " * Lenses:");
+    for (int i=0; i < nlenses; i++)
+        fprintf(out, " %s", lenses[i]);
+    fprintf(out, "\n */\n\n#include <stddef.h>\n#include <augcc.h>\n\n");
+
+    write_dfas(out, &all);
+    for (int i=0; i < nlenses; i++) {
+        if (lr[i].nregexps > 0)
+            write_lens_regexps(out, i, lr + i, &all);
+        if (lns[i]->recursive) {
+            r = write_jmt(out, i, lns[i]);
+            ERR_NOMEM(r < 0, aug);
+        } else {
+            nnodes[i] = write_get(out, i, lns[i], lr + i, &all);
+            ERR_NOMEM(nnodes[i] < 0, aug);
+        }
+    }
+
+    fprintf(out, "static const struct augcc_lens lenses[] = {\n");
+    for (int i=0; i < nlenses; i++) {
+        fprintf(out, "    { ");
+        write_string(out, lenses[i]);
+        fprintf(out, ", UINT64_C(0x%016" PRIx64 "), %zu, ",
+                lns_fingerprint(lns[i]), lr[i].nregexps);
+        if (lr[i].nregexps > 0)
+            fprintf(out, "lens%d_regexps, ", i);
+        else
+            fprintf(out, "NULL, ");
+        if (lns[i]->recursive)
+            fprintf(out, "&jmt%d, ", i);
+        else
+            fprintf(out, "NULL, ");
+        if (nnodes[i] > 0)
+            fprintf(out, "%d, lens%d_ctypes, lens%d_get },\n",
+                    nnodes[i], i, i);
+        else
+            fprintf(out, "0, NULL, NULL },\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "const struct augcc_plugin augcc_plugin = {\n"
+            "    AUGCC_ABI_VERSION, %d, lenses\n};\n", nlenses);
+
+    ERR_THROW(ferror(out), aug, AUG_EFILEACCESS,
+              "Writing the plugin failed");
+    result = 0;
+ error:
+    if (lr != NULL) {
+        for (int i=0; i < nlenses; i++)
+            free(lr[i].regexps);
+    }
+    free(lr);
+    free(lns);
+    free(nnodes);
+    free(all.regexps);
+    return result;
+}
+
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -0,0 +1,69 @@
+/*
+ * plugin.h: lens plugins generated by augcc
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef PLUGIN_H_
+#define PLUGIN_H_
+
+/*
+ * A lens plugin holds precomputed DFAs for the regular expressions of some
+ * lenses, the parser tables of recursive lenses, and get routines for the
+ * other ones; the format is described in augcc.h. When a lens is used for
+ * the first time, we check whether one of the loaded plugins was generated
+ * from it, and if so, use the DFAs and parser from the plugin instead of
+ * building them on demand, and its get routine in LNS_GET and LNS_PARSE.
+ *
+ * Like the tree cache, plugins are purely an optimization: plugins that
+ * can't be loaded are skipped, and only reported when debugging
+ * "plugins".
+ */
+
+struct lens_plugins;
+
+/* Load the plugins named in PATHS, a list of file names separated by ':'.
+ * Return NULL if none of them could be loaded.
+ */
+struct lens_plugins *load_lens_plugins(const char *paths);
+
+/* Unload PLUGINS. No lens that uses DFAs from them can be used after
+ * this */
+void free_lens_plugins(struct lens_plugins *plugins);
+
+/* Use the DFAs from PLUGINS for the regexps in LENS, its parser if LENS
+ * is recursive, and its get routine otherwise, if one of PLUGINS was
+ * generated from LENS. Nothing happens if LENS was checked before.
+ */
+void lens_plugins_attach(struct lens_plugins *plugins, struct lens *lens);
+
+/* Write the C source of a plugin for the NLENSES lenses with qualified
+ * names LENSES to OUT.
+ *
+ * Return 0 on success, -1 on error, with details in AUG's error
+ */
+int lens_plugin_write(struct augeas *aug, FILE *out,
+                      int nlenses, char *const *lenses);
+#endif
+
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
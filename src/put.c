@@ -237,8 +237,8 @@ static struct split *split_concat(struct state *state, struct lens *lens) {
     }
 
     struct tree *cur = outer->tree;
-    int reg = 1;
     for (int i=0; i < lens->nchildren; i++) {
+        int reg = lens->atype_regs[i];
         assert(reg < regs.num_regs);
         assert(regs.start[reg] != -1);
         struct tree *follow = cur;
@@ -249,9 +249,7 @@ static struct split *split_concat(struct state *state, struct lens *lens) {
         tail = split_append(&split, tail, cur, follow,
                             outer->enc, regs.start[reg], regs.end[reg]);
         cur = follow;
-        reg += 1 + regexp_nsub(lens->children[i]->atype);
     }
-    assert(reg < regs.num_regs);
  done:
     free(regs.start);
     free(regs.end);
@@ -317,6 +315,18 @@ static int applies(struct lens *lens, struct state *state) {
     return 1;
 }
 
+/* Find the children of the union LENS that can apply to the current split
+ * in STATE, as for LNS_UNION_CANDIDATES */
+static unsigned int union_candidates(struct lens *lens, struct state *state,
+                                     const unsigned int **cand) {
+    struct split *split = state->split;
+    int c = -1;
+
+    if (split->start < split->end)
+        c = (unsigned char) split->enc[split->start];
+    return lns_union_candidates(lens, true, c, cand);
+}
+
 /*
  * Check whether SKEL has the skeleton type required by LENS
  */
@@ -474,9 +484,11 @@ static void put_del(ATTRIBUTE_UNUSED struct lens *lens, struct state *state) {
 
 static void put_union(struct lens *lens, struct state *state) {
     assert(lens->tag == L_UNION);
+    const unsigned int *cand;
+    unsigned int ncand = union_candidates(lens, state, &cand);
 
-    for (int i=0; i < lens->nchildren; i++) {
-        struct lens *l = lens->children[i];
+    for (int k=0; k < ncand; k++) {
+        struct lens *l = lens->children[(cand == NULL) ? k : cand[k]];
         if (applies(l, state)) {
             if (skel_instance_of(l, state->skel))
                 put_lens(l, state);
@@ -705,10 +717,13 @@ static void create_del(struct lens *lens, struct state *state) {
 
 static void create_union(struct lens *lens, struct state *state) {
     assert(lens->tag == L_UNION);
+    const unsigned int *cand;
+    unsigned int ncand = union_candidates(lens, state, &cand);
 
-    for (int i=0; i < lens->nchildren; i++) {
-        if (applies(lens->children[i], state)) {
-            create_lens(lens->children[i], state);
+    for (int k=0; k < ncand; k++) {
+        struct lens *l = lens->children[(cand == NULL) ? k : cand[k]];
+        if (applies(l, state)) {
+            create_lens(l, state);
             return;
         }
     }
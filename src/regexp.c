@@ -27,6 +27,7 @@
 #include "syntax.h"
 #include "memory.h"
 #include "errcode.h"
+#include "augcc.h"
 
 static const struct string empty_pattern_string = {
     .ref = REF_MAX, .str = (char *) "()"
@@ -218,6 +219,8 @@ void free_regexp(struct regexp *regexp) {
         regfree(regexp->re);
         free(regexp->re);
     }
+    free_dfa(regexp->dfa);
+    free_dfa(regexp->rdfa);
     free(regexp);
 }
 
@@ -572,9 +575,147 @@ int regexp_check(struct regexp *r, const char **msg) {
     return regexp_compile_internal(r, msg);
 }
 
+/* Build R->DFA only once it has been asked for this many times; most
+ * regexps that are only matched once or twice, like the ones checked while
+ * typechecking lenses, never need one */
+#define REGEXP_DFA_THRESHOLD 8
+
+/* Turning an automaton into a DFA gets expensive quickly as it grows, and
+ * for the big regexps that whole files are matched against, it costs a lot
+ * more than it could ever save. Only build DFAs for automata with at most
+ * this many states */
+#define REGEXP_DFA_MAX_NFA 512
+
+static size_t fa_size(struct fa *fa) {
+    size_t size = 0;
+
+    for (struct state *s = fa_state_initial(fa); s != NULL;
+         s = fa_state_next(s))
+        size += 1;
+    return size;
+}
+
+/* Like REGEXP_TO_FA, but without reporting errors, and with a
+ * case-sensitive automaton even if R is case-insensitive, since a DFA
+ * needs explicit transitions for upper case letters */
+static struct fa *regexp_to_fa_quiet(struct regexp *r) {
+    const char *p = r->pattern->str;
+    char *expanded = NULL;
+    size_t len = strlen(p);
+    struct fa *fa = NULL;
+
+    if (r->nocase) {
+        if (fa_expand_nocase(p, len, &expanded, &len) != REG_NOERROR)
+            return NULL;
+        p = expanded;
+    }
+    if (fa_compile(p, len, &fa) != REG_NOERROR) {
+        fa_free(fa);
+        fa = NULL;
+    }
+    free(expanded);
+    return fa;
+}
+
+/* Reversing an automaton can make it exponentially bigger; give up on
+ * reverse DFAs that would be bigger than this */
+#define REGEXP_REVERSE_MAX_STATES 1024
+
+/* Return true if PATTERN contains a '^' or '$' outside of a bracket
+ * expression. The regex matcher may take them as anchors, but libfa always
+ * takes them as plain characters, so that a DFA built with libfa would
+ * match something else than the regex matcher */
+static bool has_anchors(const char *pattern) {
+    for (const char *p = pattern; *p != '\0'; p++) {
+        if (*p == '\\') {
+            if (p[1] != '\0')
+                p += 1;
+        } else if (*p == '^' || *p == '$') {
+            return true;
+        } else if (*p == '[') {
+            p += 1;
+            if (*p == '^')
+                p += 1;
+            if (*p == ']')
+                p += 1;
+            while (*p != '\0' && *p != ']')
+                p += 1;
+            if (*p == '\0')
+                break;
+        }
+    }
+    return false;
+}
+
+struct dfa *regexp_make_dfa(struct regexp *r, bool reverse, size_t max_nfa) {
+    struct fa *fa = NULL, *rev = NULL;
+    struct dfa *dfa = NULL;
+
+    if (has_anchors(r->pattern->str))
+        return NULL;
+    fa = regexp_to_fa_quiet(r);
+    if (fa == NULL || (max_nfa > 0 && fa_size(fa) > max_nfa))
+        goto done;
+    if (reverse) {
+        rev = fa_reverse(fa, REGEXP_REVERSE_MAX_STATES);
+        if (rev != NULL)
+            dfa = make_dfa(rev);
+    } else {
+        dfa = make_dfa(fa);
+    }
+ done:
+    fa_free(rev);
+    fa_free(fa);
+    return dfa;
+}
+
+struct dfa *regexp_dfa(struct regexp *r) {
+    if (r->dfa != NULL || r->no_dfa)
+        return r->dfa;
+    if (r->nmatch < REGEXP_DFA_THRESHOLD) {
+        r->nmatch += 1;
+        return NULL;
+    }
+
+    /* Any problem here is not an error, we just keep using R->RE */
+    r->dfa = regexp_make_dfa(r, false, REGEXP_DFA_MAX_NFA);
+    r->no_dfa = (r->dfa == NULL);
+    return r->dfa;
+}
+
+struct dfa *regexp_reverse_dfa(struct regexp *r) {
+    if (r->rdfa != NULL || r->no_rdfa)
+        return r->rdfa;
+    if (regexp_dfa(r) == NULL)
+        return NULL;
+
+    r->rdfa = regexp_make_dfa(r, true, 0);
+    r->no_rdfa = (r->rdfa == NULL);
+    return r->rdfa;
+}
+
+int regexp_prepare(struct regexp *r) {
+    if (r->re == NULL && regexp_compile(r) == -1)
+        return -1;
+    if (r->dfa == NULL && !r->no_dfa) {
+        r->dfa = regexp_make_dfa(r, false, REGEXP_DFA_MAX_NFA);
+        r->no_dfa = (r->dfa == NULL);
+    }
+    if (r->dfa != NULL && r->rdfa == NULL && !r->no_rdfa) {
+        r->rdfa = regexp_make_dfa(r, true, 0);
+        r->no_rdfa = (r->rdfa == NULL);
+    }
+    return 0;
+}
+
 int regexp_match(struct regexp *r,
                  const char *string, const int size,
                  const int start, struct re_registers *regs) {
+    if (regs == NULL && start <= size) {
+        struct dfa *dfa = regexp_dfa(r);
+        if (dfa != NULL)
+            return dfa_match(dfa, string, size, start);
+    }
     if (r->re == NULL) {
         if (regexp_compile(r) == -1)
             return -3;
@@ -582,15 +723,121 @@ int regexp_match(struct regexp *r,
     return re_match(r->re, string, size, start, regs);
 }
 
+int regexp_match_all(struct regexp *r, const char *string, int size,
+                     int start, regexp_match_found found, void *data) {
+    int count;
+
+    if (r->dfa == NULL && !r->no_dfa) {
+        /* Callers use this for every position of the text, and a DFA
+         * is the only way we have to find all matches at once; for
+         * regexps that are too big for one, we only report the longest
+         * match below */
+        r->dfa = regexp_make_dfa(r, false, REGEXP_DFA_MAX_NFA);
+        r->no_dfa = (r->dfa == NULL);
+    }
+    if (r->dfa != NULL) {
+        dfa_match_all(r->dfa, string, size, start, found, data);
+        return 0;
+    }
+
+    count = regexp_match(r, string, size, start, NULL);
+    if (count < -1)
+        return -1;
+    if (count > 0)
+        (*found)(count, data);
+    return 0;
+}
+
 int regexp_matches_empty(struct regexp *r) {
     return regexp_match(r, "", 0, 0, NULL) == 0;
 }
 
+int regexp_is_line(struct regexp *r) {
+    static const char line[] = "[^\n]*\n";
+    struct fa *fa = NULL, *fa_line = NULL;
+    int result = -1;
+
+    if (r == NULL)
+        return 0;
+    fa = regexp_to_fa_quiet(r);
+    if (fa == NULL)
+        goto done;
+    if (fa_compile(line, strlen(line), &fa_line) != REG_NOERROR)
+        goto done;
+    result = fa_contains(fa, fa_line);
+ done:
+    fa_free(fa);
+    fa_free(fa_line);
+    return result < 0 ? -1 : result;
+}
+
+int regexp_first_chars(struct regexp *r, bool *first, bool *empty) {
+    struct fa *fa = NULL;
+    struct state *initial, *to;
+    unsigned char min, max;
+
+    if (r == NULL)
+        return -1;
+    fa = regexp_to_fa_quiet(r);
+    if (fa == NULL)
+        return -1;
+
+    MEMZERO(first, UCHAR_MAX + 1);
+    initial = fa_state_initial(fa);
+    for (size_t i=0; fa_state_trans(initial, i, &to, &min, &max) == 0; i++)
+        for (int c = min; c <= max; c++)
+            first[c] = true;
+    *empty = fa_state_is_accepting(initial);
+    fa_free(fa);
+    return 0;
+}
+
+/* Count the groups in PATTERN the way the regex matcher does with the
+ * syntax from REGEXP_COMPILE_INTERNAL: every '(' starts a group, unless it
+ * is escaped or inside a bracket expression, where backslashes have no
+ * special meaning */
+static unsigned int count_groups(const char *pattern) {
+    unsigned int nsub = 0;
+
+    for (const char *p = pattern; *p != '\0'; p++) {
+        if (*p == '\\') {
+            if (p[1] != '\0')
+                p += 1;
+        } else if (*p == '(') {
+            nsub += 1;
+        } else if (*p == '[') {
+            p += 1;
+            if (*p == '^')
+                p += 1;
+            if (*p == ']')
+                p += 1;
+            while (*p != '\0' && *p != ']') {
+                if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+                    char delim = p[1];
+                    p += 2;
+                    while (*p != '\0' && !(p[0] == delim && p[1] == ']'))
+                        p += 1;
+                    if (*p == '\0')
+                        break;
+                    p += 1;
+                }
+                p += 1;
+            }
+            if (*p == '\0')
+                break;
+        }
+    }
+    return nsub;
+}
+
 int regexp_nsub(struct regexp *r) {
-    if (r->re == NULL)
-        if (regexp_compile(r) == -1)
-            return -1;
-    return r->re->re_nsub;
+    if (r->re != NULL)
+        return r->re->re_nsub;
+    if (! r->nsub_counted) {
+        r->nsub = count_groups(r->pattern->str);
+        r->nsub_counted = 1;
+    }
+    return r->nsub;
 }
 
 void regexp_release(struct regexp *regexp) {
@@ -598,6 +845,335 @@ void regexp_release(struct regexp *regexp) {
         regfree(regexp->re);
         FREE(regexp->re);
     }
+    if (regexp != NULL) {
+        free_dfa(regexp->dfa);
+        free_dfa(regexp->rdfa);
+        regexp->dfa = NULL;
+        regexp->rdfa = NULL;
+        regexp->nmatch = 0;
+        regexp->no_dfa = 0;
+        regexp->no_rdfa = 0;
+    }
+}
+
+/*
+ * Table-driven DFA
+ */
+
+/* Refuse to build transition tables with more entries than this */
+#define DFA_MAX_TABLE (1 << 22)
+
+/* Transition to DFA_DEAD when no accepting state can be reached anymore */
+#define DFA_DEAD (-1)
+
+/* Characters are mapped to equivalence classes; two characters are in the
+ * same class if no transition of the automaton distinguishes between
+ * them. That keeps the transition table at NSTATES * NCLASSES entries,
+ * which is much smaller than NSTATES * 256 for typical automata. State 0
+ * is the initial state.
+ */
+struct dfa {
+    unsigned int   nstates;
+    unsigned int   nclasses;
+    unsigned char  classes[UCHAR_MAX + 1];
+    bool          *accept;
+    int           *trans;
+    /* ACCEPT and TRANS belong to a lens plugin, not to us */
+    bool           borrowed;
+};
+
+struct dfa_index {
+    struct state *state;
+    int           index;
+};
+
+static int dfa_index_cmp(const void *p1, const void *p2) {
+    const struct dfa_index *i1 = p1, *i2 = p2;
+
+    if (i1->state < i2->state)
+        return -1;
+    return (i1->state > i2->state) ? 1 : 0;
+}
+
+static int dfa_state_index(struct dfa_index *index, size_t nstates,
+                           struct state *st) {
+    struct dfa_index key = { .state = st }, *found;
+
+    found = bsearch(&key, index, nstates, sizeof(*index), dfa_index_cmp);
+    return (found == NULL) ? DFA_DEAD : found->index;
+}
+
+struct dfa *make_dfa(struct fa *fa) {
+    struct dfa *dfa = NULL;
+    struct dfa_index *index = NULL;
+    bool *live = NULL, boundary[UCHAR_MAX + 2];
+    size_t nstates = 0;
+    struct state *st, *to;
+    unsigned char min, max;
+    int r;
+
+    if (fa_minimize(fa) < 0)
+        return NULL;
+
+    nstates = fa_size(fa);
+
+    if (ALLOC(dfa) < 0 || ALLOC_N(index, nstates) < 0)
+        goto error;
+
+    /* Number the states in list order, which puts the initial state
+     * first, and compute the character classes */
+    MEMZERO(boundary, UCHAR_MAX + 2);
+    nstates = 0;
+    for (st = fa_state_initial(fa); st != NULL; st = fa_state_next(st)) {
+        index[nstates].state = st;
+        index[nstates].index = nstates;
+        nstates += 1;
+        for (size_t i=0; fa_state_trans(st, i, &to, &min, &max) == 0; i++) {
+            boundary[min] = true;
+            boundary[max + 1] = true;
+        }
+    }
+    for (int c = 0, cls = 0; c <= UCHAR_MAX; c++) {
+        if (c > 0 && boundary[c])
+            cls += 1;
+        dfa->classes[c] = cls;
+        dfa->nclasses = cls + 1;
+    }
+
+    if (nstates * dfa->nclasses > DFA_MAX_TABLE)
+        goto error;
+    dfa->nstates = nstates;
+    if (ALLOC_N(dfa->accept, nstates) < 0)
+        goto error;
+    if (ALLOC_N(dfa->trans, nstates * dfa->nclasses) < 0)
+        goto error;
+    if (ALLOC_N(live, nstates) < 0)
+        goto error;
+
+    qsort(index, nstates, sizeof(*index), dfa_index_cmp);
+    for (size_t i=0; i < nstates * dfa->nclasses; i++)
+        dfa->trans[i] = DFA_DEAD;
+
+    int s = 0;
+    for (st = fa_state_initial(fa); st != NULL; st = fa_state_next(st), s++) {
+        int *row = dfa->trans + s * dfa->nclasses;
+        dfa->accept[s] = fa_state_is_accepting(st);
+        live[s] = dfa->accept[s];
+        for (size_t i=0; fa_state_trans(st, i, &to, &min, &max) == 0; i++) {
+            int t = dfa_state_index(index, nstates, to);
+            for (int c = min; c <= max; c++)
+                row[dfa->classes[c]] = t;
+        }
+    }
+
+    /* Redirect transitions into states from which no accepting state can
+     * be reached to DFA_DEAD so that matching stops as early as
+     * possible */
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (s = 0; s < nstates; s++) {
+            if (live[s])
+                continue;
+            int *row = dfa->trans + s * dfa->nclasses;
+            for (int c = 0; c < dfa->nclasses; c++) {
+                if (row[c] != DFA_DEAD && live[row[c]]) {
+                    live[s] = true;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    for (size_t i=0; i < nstates * dfa->nclasses; i++)
+        if (dfa->trans[i] != DFA_DEAD && !live[dfa->trans[i]])
+            dfa->trans[i] = DFA_DEAD;
+
+    r = 0;
+ done:
+    free(index);
+    free(live);
+    if (r < 0) {
+        free_dfa(dfa);
+        dfa = NULL;
+    }
+    return dfa;
+ error:
+    r = -1;
+    goto done;
+}
+
+struct dfa *make_dfa_borrowed(const struct augcc_dfa *tables) {
+    struct dfa *dfa = NULL;
+
+    if (ALLOC(dfa) < 0)
+        return NULL;
+    dfa->nstates = tables->nstates;
+    dfa->nclasses = tables->nclasses;
+    memcpy(dfa->classes, tables->classes, sizeof(dfa->classes));
+    dfa->accept = (bool *) tables->accept;
+    dfa->trans = (int *) tables->trans;
+    dfa->borrowed = true;
+    return dfa;
+}
+
+void dfa_tables(const struct dfa *dfa, struct augcc_dfa *tables) {
+    tables->nstates = dfa->nstates;
+    tables->nclasses = dfa->nclasses;
+    tables->classes = dfa->classes;
+    tables->accept = dfa->accept;
+    tables->trans = dfa->trans;
+}
+
+void free_dfa(struct dfa *dfa) {
+    if (dfa == NULL)
+        return;
+    if (! dfa->borrowed) {
+        free(dfa->accept);
+        free(dfa->trans);
+    }
+    free(dfa);
+}
+
+int dfa_accepts(const struct dfa *dfa, const char *text, size_t size) {
+    int s = 0;
+
+    for (size_t i=0; i < size; i++) {
+        s = dfa->trans[s * dfa->nclasses + dfa->classes[(unsigned char) text[i]]];
+        if (s == DFA_DEAD)
+            return 0;
+    }
+    return dfa->accept[s];
+}
+
+int dfa_match(const struct dfa *dfa, const char *text, int size, int start) {
+    int s = 0;
+    int result = dfa->accept[0] ? 0 : -1;
+
+    for (int i = start; i < size; i++) {
+        s = dfa->trans[s * dfa->nclasses + dfa->classes[(unsigned char) text[i]]];
+        if (s == DFA_DEAD)
+            break;
+        if (dfa->accept[s])
+            result = i + 1 - start;
+    }
+    return result;
+}
+
+void dfa_match_all(const struct dfa *dfa, const char *text, int size,
+                   int start, regexp_match_found found, void *data) {
+    int s = 0;
+
+    for (int i = start; i < size; i++) {
+        s = dfa->trans[s * dfa->nclasses + dfa->classes[(unsigned char) text[i]]];
+        if (s == DFA_DEAD)
+            break;
+        if (dfa->accept[s])
+            (*found)(i + 1 - start, data);
+    }
+}
+
+void free_dfa_marks(struct dfa_marks *m) {
+    FREE(m->marks);
+    FREE(m->work);
+    m->nmarks = 0;
+    m->nwork = 0;
+}
+
+/* The reverse DFAs for the parts of the concatenation are run over the
+ * text from the end backwards; a new run of RDFAS[K] is started wherever
+ * the parts after it match the rest of the text. Since all runs of
+ * RDFAS[K] that are in the same state at the same position behave the
+ * same from there on, we only need to track the set of states they are
+ * in, which is never bigger than RDFAS[K]->NSTATES.
+ *
+ * WORK starts with two arrays of N ints, the size of the set of states
+ * for each part and the offset of the part's space in WORK. That space
+ * consists of three arrays of RDFAS[K]->NSTATES ints: the current set,
+ * the next set, and a stamp to weed out duplicates from the next set.
+ */
+const bool *dfa_mark_concat(struct dfa_marks *m, int n,
+                            struct dfa **rdfas, const char *text,
+                            int start, int end) {
+    size_t len = end - start + 1, nwork = 2 * n;
+    int *used, *offset;
+
+    for (int k=0; k < n; k++)
+        nwork += 3 * rdfas[k]->nstates;
+    if (n * len > m->nmarks) {
+        if (REALLOC_N(m->marks, n * len) < 0)
+            return NULL;
+        m->nmarks = n * len;
+    }
+    if (nwork > m->nwork) {
+        if (REALLOC_N(m->work, nwork) < 0)
+            return NULL;
+        m->nwork = nwork;
+    }
+    MEMZERO(m->work, nwork);
+    used = m->work;
+    offset = m->work + n;
+    offset[0] = 2 * n;
+    for (int k=1; k < n; k++)
+        offset[k] = offset[k-1] + 3 * rdfas[k-1]->nstates;
+
+    for (int i = end; i >= start; i--) {
+        /* Whether a part matches starting at I may depend on a new run of
+         * the part after it, so we need to go from the last part to the
+         * first */
+        for (int k = n - 1; k >= 0; k--) {
+            const struct dfa *dfa = rdfas[k];
+            int *cur = m->work + offset[k];
+            int *next = cur + dfa->nstates;
+            int *stamp = next + dfa->nstates;
+            bool *marks = m->marks + k * len;
+            int nnext = 0;
+            bool accept = false;
+
+            /* Move all runs back over TEXT[I] */
+            if (i < end) {
+                int cls = dfa->classes[(unsigned char) text[i]];
+                for (int j=0; j < used[k]; j++) {
+                    int s = dfa->trans[cur[j] * dfa->nclasses + cls];
+                    if (s != DFA_DEAD && stamp[s] != i + 1) {
+                        stamp[s] = i + 1;
+                        next[nnext++] = s;
+                    }
+                }
+            }
+            /* Start a new run if the parts after this one match the rest
+             * of the text */
+            if ((k == n - 1) ? (i == end) : marks[len + i - start]) {
+                if (stamp[0] != i + 1) {
+                    stamp[0] = i + 1;
+                    next[nnext++] = 0;
+                }
+            }
+            memcpy(cur, next, nnext * sizeof(*cur));
+            used[k] = nnext;
+            for (int j=0; j < nnext && !accept; j++)
+                accept = dfa->accept[cur[j]];
+            marks[i - start] = accept;
+        }
+    }
+    return m->marks;
+}
+
+int dfa_match_marked(const struct dfa *dfa, const char *text,
+                     int start, int end, const bool *marks) {
+    int s = 0;
+    int result = (dfa->accept[0] && marks[0]) ? start : -1;
+
+    for (int i = start; i < end; i++) {
+        s = dfa->trans[s * dfa->nclasses + dfa->classes[(unsigned char) text[i]]];
+        if (s == DFA_DEAD)
+            break;
+        if (dfa->accept[s] && marks[i + 1 - start]) {
+            if (result >= 0)
+                return -2;
+            result = i + 1;
+        }
+    }
+    return result;
 }
 
 /*
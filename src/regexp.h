@@ -23,6 +23,7 @@
 #ifndef REGEXP_H_
 #define REGEXP_H_
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <regex.h>
 
@@ -31,7 +32,20 @@ struct regexp {
     struct info              *info;
     struct string            *pattern;
     struct re_pattern_buffer *re;
+    /* A DFA for matching without registers, built lazily once the regexp
+     * has been matched a few times. NO_DFA is set if it can't be built,
+     * and we always use RE then */
+    struct dfa               *dfa;
+    /* A DFA for the reverse of the regexp, used to split matches of a
+     * concatenation of regexps among its parts, and built lazily, too */
+    struct dfa               *rdfa;
+    unsigned int              nmatch;
+    /* The number of groups in PATTERN once NSUB_COUNTED is set */
+    unsigned int              nsub;
     unsigned int              nocase : 1;
+    unsigned int              nsub_counted : 1;
+    unsigned int              no_dfa : 1;
+    unsigned int              no_rdfa : 1;
 };
 
 void print_regexp(FILE *out, struct regexp *regexp);
@@ -75,15 +89,51 @@ int regexp_check(struct regexp *r, const char **msg);
 
 /* Call RE_MATCH on R->RE and return its result; if R hasn't been compiled
  * yet, compile it. Return -3 if compilation fails
+ *
+ * When REGS is NULL, only the length of the longest match is needed; that
+ * is computed with R's DFA if one is available, and only falls back to
+ * RE_MATCH when the DFA can't be built.
  */
 int regexp_match(struct regexp *r, const char *string, const int size,
                  const int start, struct re_registers *regs);
 
+/* Compile R and build its DFAs right away, rather than when it is first
+ * matched. Afterwards, matching R does not modify it any more, and R can
+ * be matched from several threads at once. Return -1 if R does not
+ * compile
+ */
+int regexp_prepare(struct regexp *r);
+
+/* Called by REGEXP_MATCH_ALL with the length COUNT of a match */
+typedef void (*regexp_match_found)(int count, void *data);
+
+/* Call FOUND for every COUNT > 0 such that R matches
+ * STRING[START..START+COUNT), shortest match first, with one pass over
+ * STRING. If R is too big for a DFA, FOUND is only called for the longest
+ * match. Return -1 if R does not compile, 0 otherwise
+ */
+int regexp_match_all(struct regexp *r, const char *string, int size,
+                     int start, regexp_match_found found, void *data);
+
 /* Return 1 if R matches the empty string, 0 otherwise */
 int regexp_matches_empty(struct regexp *r);
 
-/* Return the number of subexpressions (parentheses) inside R. May cause
- * compilation of R; return -1 if compilation fails.
+/* Return 1 if every word that R matches is a single line, i.e., consists
+ * of characters other than a newline followed by one newline, 0 if not,
+ * and -1 if that can't be determined. A match of such a regexp starting
+ * at some position can only ever end right after the next newline.
+ */
+int regexp_is_line(struct regexp *r);
+
+/* Set FIRST[C], for each of the UCHAR_MAX + 1 characters C, to whether
+ * some word that R matches starts with C, and *EMPTY to whether R matches
+ * the empty word. FIRST might include a few characters too many, but
+ * never misses one. Return -1 if R does not compile, 0 otherwise
+ */
+int regexp_first_chars(struct regexp *r, bool *first, bool *empty);
+
+/* Return the number of subexpressions (parentheses) inside R. Does not
+ * compile R; they are counted from its pattern if R is not compiled yet
  */
 int regexp_nsub(struct regexp *r);
 
@@ -125,6 +175,97 @@ char *regexp_escape(const struct regexp *r);
 /* If R is case-insensitive, expand its pattern so that it matches the same
  * string even when used in a case-sensitive match. */
 char *regexp_expand_nocase(struct regexp *r);
+
+/*
+ * Table-driven DFA
+ */
+
+/* A deterministic automaton in table form, built from a libfa
+ * automaton. Running it over a string costs one table lookup per
+ * character, without any backtracking
+ */
+struct dfa;
+struct fa;
+
+/* Build a table-driven DFA that accepts the same language as FA. FA is
+ * minimized in the process, but otherwise not modified. Return NULL if
+ * allocation fails or if FA is too big to be turned into a table.
+ */
+struct dfa *make_dfa(struct fa *fa);
+
+/* Make a DFA that uses the transition tables from a lens plugin directly.
+ * The tables are not copied, and must stay around as long as the DFA */
+struct augcc_dfa;
+struct dfa *make_dfa_borrowed(const struct augcc_dfa *tables);
+
+/* Point TABLES at the transition tables of DFA */
+void dfa_tables(const struct dfa *dfa, struct augcc_dfa *tables);
+
+void free_dfa(struct dfa *dfa);
+
+/* Return 1 if DFA accepts exactly the SIZE characters at TEXT, and 0
+ * otherwise
+ */
+int dfa_accepts(const struct dfa *dfa, const char *text, size_t size);
+
+/* Return the length of the longest prefix of TEXT[START..SIZE) that DFA
+ * accepts, or -1 if no prefix (not even the empty one) is accepted
+ */
+int dfa_match(const struct dfa *dfa, const char *text, int size, int start);
+
+/* Call FOUND for every COUNT > 0 such that DFA accepts
+ * TEXT[START..START+COUNT), in increasing order of COUNT */
+void dfa_match_all(const struct dfa *dfa, const char *text, int size,
+                   int start, regexp_match_found found, void *data);
+
+/* Scratch space for DFA_MARK_CONCAT, reused across calls */
+struct dfa_marks {
+    bool   *marks;
+    size_t  nmarks;
+    int    *work;
+    size_t  nwork;
+};
+
+void free_dfa_marks(struct dfa_marks *m);
+
+/* Find where the concatenation of N regexps can match the rest of
+ * TEXT[START..END), when RDFAS[K] is the reverse DFA of the K-th regexp.
+ * Returns an array of N rows of END - START + 1 entries each, where entry
+ * I - START of row K says whether the regexps K through N-1 match
+ * TEXT[I..END). This takes one pass over the text, without backtracking.
+ *
+ * The result lives in M and is valid until the next call. Return NULL if
+ * allocation fails.
+ */
+const bool *dfa_mark_concat(struct dfa_marks *m, int n,
+                            struct dfa **rdfas, const char *text,
+                            int start, int end);
+
+/* Return the I with START <= I <= END such that DFA accepts
+ * TEXT[START..I) and MARKS[I - START] is set. Return -1 if there is no
+ * such I, and -2 if there is more than one.
+ */
+int dfa_match_marked(const struct dfa *dfa, const char *text,
+                     int start, int end, const bool *marks);
+
+/* Return the DFA for R, building it if necessary. To keep regexps that
+ * are only matched a few times cheap, this returns NULL for the first
+ * few calls; it also returns NULL if the DFA can't be built.
+ */
+struct dfa *regexp_dfa(struct regexp *r);
+
+/* Return a DFA for the reverse of the words matched by R, building it if
+ * necessary. Like REGEXP_DFA, this returns NULL for the first few calls,
+ * and also if the DFA can't be built.
+ */
+struct dfa *regexp_reverse_dfa(struct regexp *r);
+
+/* Build a new DFA for R, or for the reverse of R if REVERSE is true,
+ * regardless of how often R has been matched. Give up if the automaton
+ * for R has more than MAX_NFA states, unless MAX_NFA is 0. Return NULL if
+ * the DFA can not be built.
+ */
+struct dfa *regexp_make_dfa(struct regexp *r, bool reverse, size_t max_nfa);
 #endif
 
 
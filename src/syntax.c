@@ -1995,7 +1995,10 @@ int load_module_file(struct augeas *aug, const char *filename,
         list_append(aug->modules, module);
         list_for_each(bnd, module->bindings) {
             if (bnd->value->tag == V_LENS) {
-                lens_release(bnd->value->lens);
+                struct lens *lens = bnd->value->lens;
+                if (lens->recursive && (aug->flags & AUG_PREPARE_RECURSIVE))
+                    lns_build_jmt(lens);
+                lens_release(lens);
             }
         }
     }
@@ -24,6 +24,7 @@
 
 #include <fnmatch.h>
 #include <glob.h>
+#include <argz.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -31,6 +32,7 @@
 #include <unistd.h>
 #include <selinux/selinux.h>
 #include <stdbool.h>
+#include <limits.h>
 
 #include "internal.h"
 #include "memory.h"
@@ -38,6 +40,10 @@
 #include "syntax.h"
 #include "transform.h"
 #include "errcode.h"
+#include "regexp.h"
+#include "fa.h"
+#include "hash.h"
+#include "cache.h"
 
 static const int fnm_flags = FNM_PATHNAME;
 static const int glob_flags = GLOB_NOSORT;
@@ -144,14 +150,14 @@ static char *mtime_as_string(struct augeas *aug, const char *fname) {
     return NULL;
 }
 
-/* fnmatch(3) which will match // in a pattern to a path, like glob(3) does */
-static int fnmatch_normalize(const char *pattern, const char *string, int flags) {
-    int i, j, r;
+/* Collapse any run of '/' in PATTERN into a single '/', the way glob(3)
+ * treats them. Return NULL if allocation fails */
+static char *glob_normalize(const char *pattern) {
+    int i, j;
     char *pattern_norm = NULL;
 
-    r = ALLOC_N(pattern_norm, strlen(pattern) + 1);
-    if (r < 0)
-        goto error;
+    if (ALLOC_N(pattern_norm, strlen(pattern) + 1) < 0)
+        return NULL;
 
     for (i = 0, j = 0; i < strlen(pattern); i++) {
         if (pattern[i] != '/' || pattern[i+1] != '/') {
@@ -160,15 +166,20 @@ static int fnmatch_normalize(const char *pattern, const char *string, int flags)
         }
     }
     pattern_norm[j] = 0;
+    return pattern_norm;
+}
+
+/* fnmatch(3) which will match // in a pattern to a path, like glob(3) does */
+static int fnmatch_normalize(const char *pattern, const char *string, int flags) {
+    int r;
+    char *pattern_norm = glob_normalize(pattern);
+
+    if (pattern_norm == NULL)
+        return -1;
 
     r = fnmatch(pattern_norm, string, flags);
     FREE(pattern_norm);
     return r;
-
- error:
-    if (pattern_norm != NULL)
-        FREE(pattern_norm);
-    return -1;
 }
 
 static bool file_current(struct augeas *aug, const char *fname,
@@ -300,6 +311,376 @@ int filter_matches(struct tree *xfm, const char *path) {
     return 1;
 }
 
+/*
+ * Compiled filters
+ */
+
+/* Turn GLOB into an automaton that accepts the same paths as
+ * fnmatch_normalize(GLOB, path, fnm_flags). MAKE_REGEXP_FROM_GLOB does not
+ * translate bracket expressions and escapes faithfully, and we return
+ * NULL for globs that contain them; we also return NULL if we run out of
+ * memory.
+ */
+static struct fa *glob_to_fa(const char *glob) {
+    struct regexp *rx = NULL;
+    struct fa *fa = NULL;
+    char *norm = NULL;
+    int r;
+
+    if (strpbrk(glob, "[]\\") != NULL)
+        return NULL;
+
+    norm = glob_normalize(glob);
+    if (norm == NULL)
+        return NULL;
+
+    rx = make_regexp_from_glob(NULL, norm);
+    if (rx != NULL) {
+        r = fa_compile(rx->pattern->str, strlen(rx->pattern->str), &fa);
+        if (r != REG_NOERROR)
+            fa = NULL;
+    }
+    unref(rx, regexp);
+    free(norm);
+    return fa;
+}
+
+/* Add GLOB to the union of automata in *FA. If GLOB can not be turned
+ * into an automaton, set *FA to NULL */
+static void glob_union(struct fa **fa, const char *glob) {
+    struct fa *g = NULL, *u = NULL;
+
+    if (*fa == NULL)
+        return;
+
+    g = glob_to_fa(glob);
+    if (g != NULL)
+        u = fa_union(*fa, g);
+    fa_free(g);
+    fa_free(*fa);
+    *fa = u;
+}
+
+static void free_xfm_filter(struct xfm_filter *f) {
+    free(f->globs);
+    free_dfa(f->dfa);
+    MEMZERO(f, 1);
+}
+
+/* Check that F was compiled from the globs that XFM has now */
+static bool xfm_filter_current(struct xfm_filter *f, struct tree *xfm) {
+    const char *g = NULL;
+
+    if (f->xfm != xfm)
+        return false;
+
+    list_for_each(c, xfm->children) {
+        char kind;
+        if (is_incl(c))
+            kind = '+';
+        else if (is_excl(c))
+            kind = '-';
+        else
+            continue;
+        g = argz_next(f->globs, f->globs_len, g);
+        if (g == NULL || g[0] != kind || STRNEQ(g + 1, c->value))
+            return false;
+    }
+    return argz_next(f->globs, f->globs_len, g) == NULL;
+}
+
+static int xfm_filter_compile(struct xfm_filter *f, struct tree *xfm) {
+    struct fa *incl = NULL, *excl = NULL, *fa = NULL;
+    int r;
+
+    f->xfm = xfm;
+    incl = fa_make_basic(FA_EMPTY);
+    excl = fa_make_basic(FA_EMPTY);
+
+    list_for_each(c, xfm->children) {
+        char *g = NULL;
+
+        if (is_incl(c)) {
+            r = xasprintf(&g, "+%s", c->value);
+            glob_union(&incl, c->value);
+        } else if (is_excl(c)) {
+            r = xasprintf(&g, "-%s", c->value);
+            glob_union(&excl, c->value);
+        } else {
+            continue;
+        }
+        if (r < 0)
+            goto error;
+        r = argz_add(&f->globs, &f->globs_len, g);
+        free(g);
+        if (r != 0)
+            goto error;
+    }
+
+    /* If any of the globs could not be compiled, F->DFA stays NULL and we
+     * use fnmatch(3) for this transform */
+    if (incl != NULL && excl != NULL) {
+        fa = fa_minus(incl, excl);
+        if (fa != NULL)
+            f->dfa = make_dfa(fa);
+    }
+    fa_free(fa);
+    fa_free(incl);
+    fa_free(excl);
+    return 0;
+ error:
+    fa_free(incl);
+    fa_free(excl);
+    free_xfm_filter(f);
+    return -1;
+}
+
+/* The filters in an index bucket, in increasing order */
+struct xfm_bucket {
+    size_t  nidx;
+    size_t *idx;
+};
+
+static void free_xfm_index(hash_t *index) {
+    hscan_t scan;
+    hnode_t *node;
+
+    if (index == NULL)
+        return;
+
+    hash_scan_begin(&scan, index);
+    while ((node = hash_scan_next(&scan))) {
+        struct xfm_bucket *bucket = hnode_get(node);
+        free((char *) hnode_getkey(node));
+        free(bucket->idx);
+        free(bucket);
+        hnode_put(node, NULL);
+    }
+    hash_free_nodes(index);
+    hash_destroy(index);
+}
+
+/* Add filter IDX to the bucket for the directory part of GLOB. Since we
+ * add filters in increasing order, the bucket stays sorted */
+static int xfm_index_add(hash_t *index, const char *glob, size_t idx) {
+    struct xfm_bucket *bucket = NULL;
+    hnode_t *node;
+    char *key = NULL;
+    size_t len = 0;
+    int r;
+
+    key = glob_normalize(glob);
+    if (key == NULL)
+        return -1;
+
+    for (size_t i=0; key[i] != '\0' && strchr("*?[\\", key[i]) == NULL; i++)
+        if (key[i] == SEP)
+            len = i + 1;
+    key[len] = '\0';
+
+    node = hash_lookup(index, key);
+    if (node == NULL) {
+        if (ALLOC(bucket) < 0)
+            goto error;
+        if (hash_alloc_insert(index, key, bucket) < 0)
+            goto error;
+    } else {
+        free(key);
+        bucket = hnode_get(node);
+        if (bucket->idx[bucket->nidx - 1] == idx)
+            return 0;
+    }
+    key = NULL;
+
+    r = REALLOC_N(bucket->idx, bucket->nidx + 1);
+    if (r < 0)
+        return -1;
+    bucket->idx[bucket->nidx] = idx;
+    bucket->nidx += 1;
+    return 1;
+ error:
+    free(bucket);
+    free(key);
+    return -1;
+}
+
+static int xfm_cache_index(struct xfm_cache *cache) {
+    size_t nentries = 0;
+    int r;
+
+    free_xfm_index(cache->index);
+    cache->index = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+    if (cache->index == NULL)
+        return -1;
+
+    for (size_t i=0; i < cache->nfilters; i++) {
+        struct xfm_filter *f = cache->filters + i;
+        for (const char *g = argz_next(f->globs, f->globs_len, NULL);
+             g != NULL;
+             g = argz_next(f->globs, f->globs_len, g)) {
+            if (g[0] != '+')
+                continue;
+            r = xfm_index_add(cache->index, g + 1, i);
+            if (r < 0)
+                return -1;
+            nentries += r;
+        }
+    }
+
+    free(cache->candidates);
+    cache->candidates = NULL;
+    cache->ncandidates = 0;
+    if (ALLOC_N(cache->candidates, nentries) < 0)
+        return -1;
+    cache->ncandidates = nentries;
+    return 0;
+}
+
+static void xfm_cache_clear(struct xfm_cache *cache) {
+    for (size_t i=0; i < cache->nfilters; i++)
+        free_xfm_filter(cache->filters + i);
+    free(cache->filters);
+    free_xfm_index(cache->index);
+    free(cache->candidates);
+    free(cache->key);
+    MEMZERO(cache, 1);
+}
+
+int xfm_cache_update(struct augeas *aug, struct tree *load) {
+    struct xfm_cache *cache = aug->xfm_cache;
+    struct xfm_filter *filters = NULL;
+    size_t nfilters = 0, i;
+    bool current;
+    int r;
+
+    if (cache == NULL) {
+        r = ALLOC(cache);
+        ERR_NOMEM(r < 0, aug);
+        aug->xfm_cache = cache;
+    }
+
+    list_for_each(xfm, load->children)
+        nfilters += 1;
+
+    /* Nothing changed, which is by far the most common case */
+    current = (nfilters == cache->nfilters);
+    i = 0;
+    list_for_each(xfm, load->children) {
+        if (! current)
+            break;
+        current = xfm_filter_current(cache->filters + i, xfm);
+        i += 1;
+    }
+    if (current)
+        return 0;
+
+    /* Reuse filters for transforms that did not change, possibly from a
+     * different position, and compile new ones for all others */
+    r = ALLOC_N(filters, nfilters);
+    ERR_NOMEM(r < 0, aug);
+
+    i = 0;
+    list_for_each(xfm, load->children) {
+        struct xfm_filter *f = NULL;
+        for (size_t j=0; j < cache->nfilters; j++) {
+            if (xfm_filter_current(cache->filters + j, xfm)) {
+                f = cache->filters + j;
+                break;
+            }
+        }
+        if (f != NULL) {
+            filters[i] = *f;
+            MEMZERO(f, 1);
+        } else {
+            r = xfm_filter_compile(filters + i, xfm);
+            ERR_NOMEM(r < 0, aug);
+        }
+        i += 1;
+    }
+
+    for (i=0; i < cache->nfilters; i++)
+        free_xfm_filter(cache->filters + i);
+    free(cache->filters);
+    cache->filters = filters;
+    cache->nfilters = nfilters;
+    filters = NULL;
+
+    r = xfm_cache_index(cache);
+    ERR_NOMEM(r < 0, aug);
+    return 0;
+ error:
+    for (i=0; i < nfilters && filters != NULL; i++)
+        free_xfm_filter(filters + i);
+    free(filters);
+    /* Some filters may have been moved out of the cache; start over on
+     * the next update */
+    if (cache != NULL)
+        xfm_cache_clear(cache);
+    return -1;
+}
+
+void free_xfm_cache(struct xfm_cache *cache) {
+    if (cache == NULL)
+        return;
+    xfm_cache_clear(cache);
+    free(cache);
+}
+
+static int cmp_size(const void *p1, const void *p2) {
+    size_t s1 = *(const size_t *) p1;
+    size_t s2 = *(const size_t *) p2;
+    return (s1 < s2) ? -1 : (s1 > s2);
+}
+
+int xfm_cache_candidates(struct xfm_cache *cache, const char *path) {
+    size_t len = strlen(path), ncands = 0, n;
+
+    if (cache->index == NULL)
+        return 0;
+
+    if (cache->key_size < len + 1) {
+        if (REALLOC_N(cache->key, len + 1) < 0)
+            return -1;
+        cache->key_size = len + 1;
+    }
+    strcpy(cache->key, path);
+
+    /* Look up every directory prefix of PATH, including the empty one */
+    for (size_t i=0; i <= len; i++) {
+        hnode_t *node;
+        char c;
+
+        if (i > 0 && path[i-1] != SEP)
+            continue;
+        c = cache->key[i];
+        cache->key[i] = '\0';
+        node = hash_lookup(cache->index, cache->key);
+        cache->key[i] = c;
+        if (node != NULL) {
+            struct xfm_bucket *bucket = hnode_get(node);
+            memcpy(cache->candidates + ncands, bucket->idx,
+                   bucket->nidx * sizeof(*bucket->idx));
+            ncands += bucket->nidx;
+        }
+    }
+
+    /* A filter with incl globs in different directories can show up
+     * more than once */
+    qsort(cache->candidates, ncands, sizeof(*cache->candidates), cmp_size);
+    n = 0;
+    for (size_t i=0; i < ncands; i++) {
+        if (n == 0 || cache->candidates[n-1] != cache->candidates[i])
+            cache->candidates[n++] = cache->candidates[i];
+    }
+    return n;
+}
+
+int xfm_filter_matches(struct xfm_filter *filter, const char *path) {
+    if (filter->dfa == NULL)
+        return filter_matches(filter->xfm, path);
+    return dfa_accepts(filter->dfa, path, strlen(path));
+}
+
 /*
  * Transformers
  */
@@ -403,6 +784,10 @@ static int store_error(struct augeas *aug,
         r = tree_set_value(err_info, status);
         ERR_NOMEM(r < 0, aug);
 
+        err_info->deferred = err != NULL && err->deferred;
+        if (err_info->deferred)
+            aug->deferred_errors += 1;
+
         /* Errors from err_set are ignored on purpose. We try
          * to report as much as we can */
         if (err != NULL) {
@@ -532,7 +917,23 @@ static char *file_name_path(struct augeas *aug, const char *fname) {
     return path;
 }
 
-/* Replace the subtree for FPATH with SUB */
+static struct tree *file_info(struct augeas *aug, const char *fname) {
+    char *path = NULL;
+    struct tree *result = NULL;
+    int r;
+
+    r = pathjoin(&path, 2, AUGEAS_META_FILES, fname);
+    ERR_NOMEM(r < 0, aug);
+
+    result = tree_fpath(aug, path);
+    ERR_BAIL(aug);
+ error:
+    free(path);
+    return result;
+}
+
+/* Replace the subtree for FPATH with SUB. The span of the old subtree,
+ * and the text it was gotten from, are dropped, too */
 static void tree_freplace(struct augeas *aug, const char *fpath,
                          struct tree *sub) {
     struct tree *parent;
@@ -541,6 +942,8 @@ static void tree_freplace(struct augeas *aug, const char *fpath,
     ERR_RET(aug);
 
     parent->file = true;
+    free_span(parent->span);
+    parent->span = NULL;
     tree_unlink_children(aug, parent);
     list_append(parent->children, sub);
     list_for_each(s, sub) {
@@ -589,7 +992,8 @@ static void lens_get(struct augeas *aug,
                      struct lens *lens,
                      const char *filename,
                      const char *text, int text_len,
-                     const char *path,
+                     const char *path, int defer_errors,
+                     unsigned int max_time,
                      struct lns_error **err) {
     struct info *info = NULL;
     struct span *span = NULL;
@@ -605,7 +1009,9 @@ static void lens_get(struct augeas *aug,
         ERR_NOMEM(span == NULL, info);
     }
 
-    tree = lns_get(info, lens, text, aug->flags & AUG_ENABLE_SPAN, err);
+    tree = lns_get(info, lens, text, aug->flags & AUG_ENABLE_SPAN,
+                   defer_errors, aug->flags & AUG_PARALLEL_LOAD,
+                   max_time, err);
 
     if (*err == NULL) {
         // Successful get
@@ -626,21 +1032,234 @@ static void lens_get(struct augeas *aug,
     free_tree(tree);
 }
 
+/*
+ * Incremental reloading
+ *
+ * When a file that was loaded with spans changes, mostly only a few lines
+ * of it changed. If its lens gets the file line by line (see
+ * LNS_GET_LINES), we only get the lines from the first to the last one
+ * that changed, and splice the trees for them into the tree for the file
+ * in place of the ones for the old version of these lines. All other
+ * nodes stay as they are, and only their spans move. For that, the span
+ * of the file node keeps the text the tree was gotten from.
+ */
+
+/* Add DELTA to the spans of TREE, its siblings, and all their
+ * descendants */
+static void tree_shift_spans(struct tree *tree, int delta) {
+    list_for_each(t, tree) {
+        shift_span(t->span, delta);
+        tree_shift_spans(t->children, delta);
+    }
+}
+
+/* Keep *TEXT, which the tree at PATH was just gotten from, with the span
+ * of the file node */
+static void file_keep_text(struct augeas *aug, const char *path,
+                           char **text) {
+    struct tree *file = tree_fpath(aug, path);
+
+    if (file != NULL && file->span != NULL) {
+        free(file->span->text);
+        file->span->text = *text;
+        *text = NULL;
+    }
+}
+
+/* If the tree at PATH was gotten with LENS from an earlier version of
+ * TEXT, only get the lines that changed since then, and splice the trees
+ * for them into the tree at PATH. Return 1 if that worked, 0 if all of
+ * TEXT needs to be gotten, and -1 on error */
+static int lens_reget(struct augeas *aug, struct lens *lens,
+                      const char *filename, const char *text, int text_len,
+                      const char *path, unsigned int max_time) {
+    struct tree *file = tree_fpath(aug, path);
+    struct tree *prev = NULL, *next = NULL, *tree = NULL;
+    struct info *info = NULL;
+    struct lns_error *err = NULL;
+    char *middle = NULL;
+    const char *old;
+    int old_len, prefix, suffix, start, old_end, end, where = 0;
+    int result = -1;
+
+    if (file == NULL || file->dirty || file->span == NULL
+        || file->span->text == NULL || ! lns_get_lines(lens))
+        return 0;
+    old = file->span->text;
+    old_len = strlen(old);
+
+    /* The lines from START to OLD_END in OLD changed, and are now the
+     * lines from START to END in TEXT */
+    for (prefix = 0; prefix < old_len && prefix < text_len; prefix++)
+        if (old[prefix] != text[prefix])
+            break;
+    for (suffix = 0; suffix < old_len - prefix && suffix < text_len - prefix;
+         suffix++)
+        if (old[old_len - 1 - suffix] != text[text_len - 1 - suffix])
+            break;
+    for (start = prefix; start > 0 && old[start - 1] != '\n'; start--);
+    for (old_end = old_len - suffix;
+         old_end > 0 && old_end < old_len && old[old_end - 1] != '\n';
+         old_end++);
+    end = old_end + text_len - old_len;
+
+    /* The trees for the lines before START come first, followed by the
+     * ones for the changed lines and the ones for the lines after
+     * OLD_END. A node with an empty span right at START or OLD_END could
+     * belong to either side */
+    list_for_each(t, file->children) {
+        struct span *span = t->span;
+        int here;
+
+        if (span == NULL || span->span_start == UINT_MAX)
+            return 0;
+        if (span->span_start == span->span_end
+            && (span->span_start == start || span->span_start == old_end))
+            return 0;
+        if (span->span_end <= start)
+            here = 0;
+        else if (span->span_start >= old_end)
+            here = 2;
+        else if (span->span_start >= start && span->span_end <= old_end)
+            here = 1;
+        else
+            return 0;
+        if (here < where)
+            return 0;
+        if (here == 0)
+            prev = t;
+        if (here == 2 && where < 2)
+            next = t;
+        where = here;
+    }
+
+    middle = strndup(text + start, end - start);
+    ERR_NOMEM(middle == NULL, aug);
+    info = make_lns_info(aug, filename, middle, end - start);
+    ERR_BAIL(aug);
+
+    tree = lns_get(info, lens, middle, 1, 1, 0, max_time, &err);
+    ERR_BAIL(aug);
+    if (err != NULL) {
+        /* Get the whole text again to report the error exactly as we
+         * otherwise would */
+        result = 0;
+        goto error;
+    }
+
+    for (struct tree *t = (prev == NULL) ? file->children : prev->next;
+         t != next; ) {
+        struct tree *del = t;
+        t = t->next;
+        tree_unlink(aug, del);
+    }
+    tree_shift_spans(tree, start);
+    tree_shift_spans(next, text_len - old_len);
+    if (tree != NULL) {
+        struct tree *last = tree;
+
+        list_for_each(t, tree) {
+            t->parent = file;
+            tree_clean(t);
+            last = t;
+        }
+        last->next = next;
+        if (prev == NULL)
+            file->children = tree;
+        else
+            prev->next = tree;
+        tree = NULL;
+    }
+    file->span->span_end = text_len;
+    result = 1;
+ error:
+    free_lns_error(err);
+    free_tree(tree);
+    unref(info, info);
+    free(middle);
+    return result;
+}
+
+static void xfm_error(struct tree *xfm, const char *msg) {
+    char *v = msg ? strdup(msg) : NULL;
+    char *l = strdup("error");
+
+    if (l == NULL || v == NULL) {
+        free(v);
+        free(l);
+        return;
+    }
+    tree_append(xfm, l, v);
+}
+
+/* The budgets from AUGEAS_LIMITS; a limit of 0 means 'unlimited' */
+struct load_limits {
+    int64_t      size;
+    unsigned int time;
+};
+
+/* Read the limit at PATH. A limit that is not a nonnegative number gets
+ * an 'error' child, and is treated as 'unlimited' */
+static int64_t load_limit(struct augeas *aug, const char *path) {
+    struct tree *limit = tree_find(aug, path);
+    int64_t result;
+
+    if (limit == NULL)
+        return 0;
+    for (struct tree *t = limit->children; t != NULL; ) {
+        struct tree *del = t;
+        t = del->next;
+        if (streqv(del->label, "error"))
+            tree_unlink(aug, del);
+    }
+    if (limit->value == NULL)
+        return 0;
+    if (xstrtoint64(limit->value, 10, &result) < 0 || result < 0) {
+        xfm_error(limit, "the limit must be a nonnegative number");
+        return 0;
+    }
+    return result;
+}
+
+static void load_limits(struct augeas *aug, struct load_limits *limits) {
+    int64_t time = load_limit(aug, AUGEAS_LIMIT_TIME);
+
+    limits->size = load_limit(aug, AUGEAS_LIMIT_SIZE);
+    limits->time = (time > UINT_MAX) ? UINT_MAX : time;
+}
+
 static int load_file(struct augeas *aug, struct lens *lens,
-                     const char *lens_name, char *filename) {
+                     const char *lens_name, char *filename,
+                     const struct load_limits *limits) {
     char *text = NULL;
     const char *err_status = NULL;
     char *path = NULL;
     struct lns_error *err = NULL;
+    struct tree *tree = NULL;
     int result = -1, r, text_len = 0;
+    bool reget;
 
     path = file_name_path(aug, filename);
     ERR_NOMEM(path == NULL, aug);
 
+    /* Only get what changed if we got the file with the same lens */
+    reget = (aug->flags & AUG_ENABLE_SPAN)
+        && STREQ(xfm_lens_name(file_info(aug, filename + strlen(aug->root) - 1)),
+                 lens_name);
+
     r = add_file_info(aug, path, lens, lens_name, filename, false);
     if (r < 0)
         goto done;
 
+    if (limits->size > 0) {
+        struct stat st;
+        if (stat(filename, &st) == 0 && st.st_size > limits->size) {
+            err_status = "too_large";
+            errno = EFBIG;
+            goto done;
+        }
+    }
+
     text = xread_file(filename);
     if (text == NULL) {
         err_status = "read_failed";
@@ -649,17 +1268,32 @@ static int load_file(struct augeas *aug, struct lens *lens,
     text_len = strlen(text);
     text = append_newline(text, text_len);
 
-    lens_get(aug, lens, filename, text, text_len, path, &err);
-    if (err != NULL) {
-        err_status = "parse_failed";
-        goto done;
+    if (tree_cache_lookup(aug, lens, lens_name, filename,
+                          text, text_len, &tree)) {
+        tree_freplace(aug, path, tree);
+        ERR_BAIL(aug);
+    } else if (reget && (r = lens_reget(aug, lens, filename, text, text_len,
+                                        path, limits->time)) != 0) {
+        if (r < 0)
+            goto error;
+    } else {
+        lens_get(aug, lens, filename, text, text_len, path,
+                 aug->flags & AUG_DEFER_ERRORS, limits->time, &err);
+        if (err != NULL) {
+            err_status = err->timeout ? "parse_timeout" : "parse_failed";
+            goto done;
+        }
+        ERR_BAIL(aug);
+        tree_cache_store(aug, lens, lens_name, filename, text, text_len,
+                         tree_fpath(aug, path));
     }
-    ERR_BAIL(aug);
 
     result = 0;
  done:
     store_error(aug, filename + strlen(aug->root) - 1, path, err_status,
                 errno, err, text);
+    if (result == 0 && (aug->flags & AUG_ENABLE_SPAN))
+        file_keep_text(aug, path, &text);
  error:
     free_lns_error(err);
     free(path);
@@ -695,6 +1329,112 @@ static struct lens *lens_from_name(struct augeas *aug, const char *name) {
     return NULL;
 }
 
+/* The name of the file described by FILE, a node underneath TOP, the
+ * node for /augeas/files. The name starts with a '/' and is relative to
+ * AUG->ROOT, just like the names passed to STORE_ERROR */
+static char *meta_file_name(struct tree *top, struct tree *file) {
+    size_t len = 0;
+    char *name = NULL, *p;
+
+    for (struct tree *t = file; t != top; t = t->parent)
+        len += strlen(t->label) + 1;
+    if (ALLOC_N(name, len + 1) < 0)
+        return NULL;
+    p = name + len;
+    for (struct tree *t = file; t != top; t = t->parent) {
+        size_t l = strlen(t->label);
+        p -= l;
+        memcpy(p, t->label, l);
+        *(--p) = '/';
+    }
+    return name;
+}
+
+/* Load the file described by FILE again, this time with full error
+ * diagnosis, and replace the deferred error in ERR_INFO with the result */
+static void diagnose_file(struct augeas *aug, struct tree *top,
+                          struct tree *file, struct tree *err_info,
+                          const struct load_limits *limits) {
+    struct tree *lens_name = tree_child(file, s_lens);
+    struct tree *path = tree_child(file, s_path);
+    struct lens *lens = NULL;
+    struct lns_error *err = NULL;
+    struct info *info = NULL;
+    struct tree *tree = NULL;
+    char *name = NULL, *filename = NULL, *text = NULL;
+    int text_len, r;
+
+    err_info->deferred = false;
+    if (lens_name == NULL || lens_name->value == NULL
+        || path == NULL || path->value == NULL)
+        return;
+
+    lens = lens_from_name(aug, lens_name->value);
+    if (lens == NULL)
+        goto done;
+
+    name = meta_file_name(top, file);
+    ERR_NOMEM(name == NULL, aug);
+    r = asprintf(&filename, "%s%s", aug->root, name + 1);
+    ERR_NOMEM(r < 0, aug);
+
+    text = xread_file(filename);
+    if (text == NULL)
+        goto done;
+    text_len = strlen(text);
+    text = append_newline(text, text_len);
+
+    info = make_lns_info(aug, filename, text, text_len);
+    ERR_BAIL(aug);
+    tree = lns_get(info, lens, text, 0, 0, 0, limits->time, &err);
+    /* If the file changed since it was loaded, and can be parsed now,
+     * we keep what we know about the original error */
+    if (err != NULL)
+        store_error(aug, name, path->value,
+                    err->timeout ? "parse_timeout" : "parse_failed",
+                    0, err, text);
+ done:
+ error:
+    /* Errors here only mean that we can't say more about the original
+     * error, and should not affect the API call that caused all this */
+    reset_error(aug->error);
+    free_tree(tree);
+    free_lns_error(err);
+    unref(info, info);
+    free(text);
+    free(filename);
+    free(name);
+}
+
+static void diagnose_files(struct augeas *aug, struct tree *top,
+                           struct tree *tree,
+                           const struct load_limits *limits) {
+    list_for_each(t, tree->children) {
+        if (t->file) {
+            struct tree *err_info = tree_child(t, s_error);
+            if (err_info != NULL && err_info->deferred)
+                diagnose_file(aug, top, t, err_info, limits);
+        } else {
+            diagnose_files(aug, top, t, limits);
+        }
+    }
+}
+
+void transform_diagnose(struct augeas *aug) {
+    struct load_limits limits;
+    struct tree *top;
+
+    if (aug->deferred_errors == 0)
+        return;
+    aug->deferred_errors = 0;
+
+    top = tree_find(aug, AUGEAS_META_FILES);
+    if (top == NULL)
+        return;
+    load_limits(aug, &limits);
+    diagnose_files(aug, top, top, &limits);
+}
+
 int text_store(struct augeas *aug, const char *lens_path,
                const char *path, const char *text) {
     struct lns_error *err = NULL;
@@ -705,7 +1445,7 @@ int text_store(struct augeas *aug, const char *lens_path,
     lens = lens_from_name(aug, lens_path);
     ERR_BAIL(aug);
 
-    lens_get(aug, lens, path, text, strlen(text), path, &err);
+    lens_get(aug, lens, path, text, strlen(text), path, 0, 0, &err);
     if (err != NULL) {
         err_status = "parse_failed";
         goto error;
@@ -719,6 +1459,31 @@ int text_store(struct augeas *aug, const char *lens_path,
     return result;
 }
 
+int text_stream(struct augeas *aug, const char *lens_name, const char *text,
+                const struct aug_text_callbacks *cb) {
+    struct lns_error *err = NULL;
+    struct info *info = NULL;
+    struct lens *lens = NULL;
+    int result = -1, r;
+
+    lens = lens_from_name(aug, lens_name);
+    ERR_BAIL(aug);
+
+    info = make_lns_info(aug, NULL, text, strlen(text));
+    ERR_BAIL(aug);
+
+    r = lns_get_stream(info, lens, text, cb, &err);
+    ERR_BAIL(aug);
+    ERR_THROW(err != NULL, aug, AUG_EPARSE, "%s at position %d",
+              err->message, err->pos);
+
+    result = r;
+ error:
+    free_lns_error(err);
+    unref(info, info);
+    return result;
+}
+
 const char *xfm_lens_name(struct tree *xfm) {
     struct tree *l = tree_child(xfm, s_lens);
 
@@ -748,18 +1513,6 @@ struct lens *xfm_lens(struct augeas *aug,
     return lens_from_name(aug, l->value);
 }
 
-static void xfm_error(struct tree *xfm, const char *msg) {
-    char *v = msg ? strdup(msg) : NULL;
-    char *l = strdup("error");
-
-    if (l == NULL || v == NULL) {
-        free(v);
-        free(l);
-        return;
-    }
-    tree_append(xfm, l, v);
-}
-
 int transform_validate(struct augeas *aug, struct tree *xfm) {
     struct tree *l = NULL;
 
@@ -770,6 +1523,8 @@ int transform_validate(struct augeas *aug, struct tree *xfm) {
                        && t->value[0] != SEP) {
             /* Normalize relative paths to absolute ones */
             int r;
+            r = tree_unslab_value(t);
+            ERR_NOMEM(r < 0, aug);
             r = REALLOC_N(t->value, strlen(t->value) + 2);
             ERR_NOMEM(r < 0, aug);
             memmove(t->value + 1, t->value, strlen(t->value) + 1);
@@ -834,26 +1589,12 @@ void transform_file_error(struct augeas *aug, const char *status,
     free(msg);
 }
 
-static struct tree *file_info(struct augeas *aug, const char *fname) {
-    char *path = NULL;
-    struct tree *result = NULL;
-    int r;
-
-    r = pathjoin(&path, 2, AUGEAS_META_FILES, fname);
-    ERR_NOMEM(r < 0, aug);
-
-    result = tree_fpath(aug, path);
-    ERR_BAIL(aug);
- error:
-    free(path);
-    return result;
-}
-
 int transform_load(struct augeas *aug, struct tree *xfm, const char *file) {
     int nmatches = 0;
     char **matches;
     const char *lens_name;
     struct lens *lens = xfm_lens(aug, xfm, &lens_name);
+    struct load_limits limits;
     int r;
 
     if (lens == NULL) {
@@ -864,6 +1605,7 @@ int transform_load(struct augeas *aug, struct tree *xfm, const char *file) {
     r = filter_generate(xfm, aug->root, &nmatches, &matches);
     if (r == -1)
         return -1;
+    load_limits(aug, &limits);
     for (int i=0; i < nmatches; i++) {
         const char *filename = matches[i] + strlen(aug->root) - 1;
         struct tree *finfo = file_info(aug, filename);
@@ -895,7 +1637,7 @@ int transform_load(struct augeas *aug, struct tree *xfm, const char *file) {
                 free(fpath);
             }
         } else if (!file_current(aug, matches[i], finfo)) {
-            load_file(aug, lens, lens_name, matches[i]);
+            load_file(aug, lens, lens_name, matches[i], &limits);
         }
         if (finfo != NULL)
             finfo->dirty = 0;
@@ -906,11 +1648,11 @@ int transform_load(struct augeas *aug, struct tree *xfm, const char *file) {
     return 0;
 }
 
-int transform_applies(struct tree *xfm, const char *path) {
+int transform_applies(struct xfm_filter *filter, const char *path) {
     if (STRNEQLEN(path, AUGEAS_FILES_TREE, strlen(AUGEAS_FILES_TREE))
         || path[strlen(AUGEAS_FILES_TREE)] != SEP)
         return 0;
-    return filter_matches(xfm, path + strlen(AUGEAS_FILES_TREE));
+    return xfm_filter_matches(filter, path + strlen(AUGEAS_FILES_TREE));
 }
 
 static int transfer_file_attrs(FILE *from, FILE *to,
@@ -1113,6 +1855,9 @@ static void lens_put(struct augeas *aug, const char *filename,
         }
         tree->span->span_start = ftell(out);
     }
+    /* The spans, if any, will be for the text we write now */
+    if (tree->span != NULL)
+        FREE(tree->span->text);
 
     lns_put(info, out, lens, tree->children, text,
             aug->flags & AUG_ENABLE_SPAN, err);
@@ -69,16 +69,75 @@ int transform_validate(struct augeas *aug, struct tree *xfm);
  */
 int transform_load(struct augeas *aug, struct tree *xfm, const char *file);
 
+/* Files that failed to load while AUG_DEFER_ERRORS was set only have the
+ * lens and position of the failure recorded underneath /augeas/files.
+ * Read them again and record the full errors, with messages and the last
+ * and next lens. Nothing happens if there are no such errors.
+ */
+void transform_diagnose(struct augeas *aug);
+
 /* Return 1 if TRANSFORM applies to PATH, 0 otherwise.
  * PATH must not include "/files/".
  */
 int filter_matches(struct tree *xfm, const char *path);
 
-/* Return 1 if TRANSFORM applies to PATH, 0 otherwise. The TRANSFORM
- * applies to PATH if (1) PATH starts with "/files/" and (2) the rest of
- * PATH matches the transform's filter
+/* The incl and excl globs of a transform compiled into one DFA that
+ * accepts exactly the paths that FILTER_MATCHES accepts for XFM. Globs
+ * that can not be translated faithfully into a DFA leave DFA as NULL, and
+ * matching falls back to FILTER_MATCHES.
+ */
+struct xfm_filter {
+    struct tree *xfm;
+    char        *globs;      /* The globs used to build DFA as an argz
+                                vector, each prefixed with '+' for incl
+                                and '-' for excl */
+    size_t       globs_len;
+    struct dfa  *dfa;
+};
+
+/* The compiled filters for all transforms in /augeas/load, in the same
+ * order as the transforms appear there. Kept in AUG->XFM_CACHE.
+ *
+ * INDEX maps the literal directory part of each incl glob, i.e. everything
+ * up to the last '/' before the first wildcard, to the filters that have
+ * such a glob. A filter can only match a path if one of the path's
+ * directory prefixes is a key in INDEX.
+ */
+struct xfm_cache {
+    size_t             nfilters;
+    struct xfm_filter *filters;
+    struct hash_t     *index;
+    size_t            *candidates;  /* Scratch space for candidate lookup */
+    size_t             ncandidates; /* Allocated size of CANDIDATES */
+    char              *key;         /* Scratch space for index keys */
+    size_t             key_size;
+};
+
+/* Bring AUG->XFM_CACHE in sync with the transforms underneath LOAD. Only
+ * transforms whose globs changed since the last update are recompiled.
+ *
+ * Return 0 on success, -1 on failure
+ */
+int xfm_cache_update(struct augeas *aug, struct tree *load);
+
+void free_xfm_cache(struct xfm_cache *cache);
+
+/* Find the filters in CACHE that might match PATH, which must not include
+ * "/files/". Their indices into CACHE->FILTERS are stored in increasing
+ * order in CACHE->CANDIDATES, and are valid until the next call.
+ *
+ * Return the number of candidates, or -1 if allocation fails
+ */
+int xfm_cache_candidates(struct xfm_cache *cache, const char *path);
+
+/* Same as FILTER_MATCHES, but using the compiled FILTER */
+int xfm_filter_matches(struct xfm_filter *filter, const char *path);
+
+/* Return 1 if the transform for FILTER applies to PATH, 0 otherwise. The
+ * transform applies to PATH if (1) PATH starts with "/files/" and (2) the
+ * rest of PATH matches the transform's filter
 */
-int transform_applies(struct tree *xfm, const char *path);
+int transform_applies(struct xfm_filter *filter, const char *path);
 
 /* Save TREE into the file corresponding to PATH. It is assumed that the
  * TRANSFORM applies to that PATH
@@ -91,6 +150,12 @@ int transform_save(struct augeas *aug, struct tree *xfm,
 int text_store(struct augeas *aug, const char *lens_name,
                const char *path, const char *text);
 
+/* Transform TEXT with the lens LENS_NAME and report the resulting nodes
+ * through CB, as described for AUG_TEXT_STREAM
+ */
+int text_stream(struct augeas *aug, const char *lens_name, const char *text,
+                const struct aug_text_callbacks *cb);
+
 /* Transform the tree at PATH back into TEXT_OUT, assuming TEXT_IN was
  * used to initially generate the tree
  */
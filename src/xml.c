@@ -176,6 +176,7 @@ int aug_to_xml(const struct augeas *aug, const char *pathin,
     int result = -1;
 
     api_entry(aug);
+    diagnose_deferred_errors(aug, pathin);
 
     ARG_CHECK(flags != 0, aug, "aug_to_xml: FLAGS must be 0");
     ARG_CHECK(xmldoc == NULL, aug, "aug_to_xml: XMLDOC must be non-NULL");
@@ -634,6 +634,26 @@ static void testNoCaseComplement(CuTest *tc) {
     fa_free(isect);
 }
 
+static void testReverse(CuTest *tc) {
+    struct fa *fa = make_good_fa(tc, "ab*c|de");
+    struct fa *exp = make_good_fa(tc, "cb*a|ed");
+    struct fa *rev;
+
+    rev = mark(fa_reverse(fa, 0));
+    CuAssertPtrNotNull(tc, rev);
+    CuAssertIntEquals(tc, 1, fa_equals(exp, rev));
+
+    /* The reverse needs 2^4 states, which is more than we allow */
+    fa = make_good_fa(tc, "[ab][ab][ab]a[ab]*");
+    exp = make_good_fa(tc, "[ab]*a[ab][ab][ab]");
+    rev = fa_reverse(fa, 8);
+    CuAssertPtrEquals(tc, NULL, rev);
+
+    rev = mark(fa_reverse(fa, 0));
+    CuAssertPtrNotNull(tc, rev);
+    CuAssertIntEquals(tc, 1, fa_equals(exp, rev));
+}
+
 static void free_words(int n, char **words) {
     for (int i=0; i < n; i++) {
         free(words[i]);
@@ -712,6 +732,7 @@ int main(int argc, char **argv) {
         SUITE_ADD_TEST(suite, testNoCase);
         SUITE_ADD_TEST(suite, testExpandNoCase);
         SUITE_ADD_TEST(suite, testNoCaseComplement);
+        SUITE_ADD_TEST(suite, testReverse);
         SUITE_ADD_TEST(suite, testEnumerate);
 
         CuSuiteRun(suite);
@@ -512,6 +512,66 @@ static void testRename(CuTest *tc) {
     aug_close(aug);
 }
 
+/* Change the labels and values of nodes that were loaded from a file,
+ * which start out sharing storage with the rest of the file's tree */
+static void testChangeLoaded(CuTest *tc) {
+    struct augeas *aug;
+    int r;
+    const char *value;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_load_file(aug, "/etc/hosts");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_set(aug, "/files/etc/hosts/1/ipaddr", "127.0.0.2");
+    CuAssertRetSuccess(tc, r);
+
+    /* The entries were loaded without a value; the values we give them
+     * are not in the slab and must be freed with the node */
+    r = aug_set(aug, "/files/etc/hosts/1", "first");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/files/etc/hosts/1", "entry");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/files/etc/hosts/2", "second");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_rename(aug, "/files/etc/hosts/1/canonical", "alias");
+    CuAssertIntEquals(tc, 1, r);
+
+    r = aug_mv(aug, "/files/etc/hosts/2/canonical", "/a/canonical");
+    CuAssertRetSuccess(tc, r);
+
+    /* Drop all loaded nodes before looking at what was copied out */
+    r = aug_rm(aug, "/files/etc/hosts/2");
+    CuAssertIntEquals(tc, 3, r);
+
+    r = aug_get(aug, "/a/canonical", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "orange.watzmann.net", value);
+
+    r = aug_get(aug, "/files/etc/hosts/1/ipaddr", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "127.0.0.2", value);
+
+    r = aug_get(aug, "/files/etc/hosts/1", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "entry", value);
+
+    r = aug_match(aug, "/files/etc/hosts/1/alias", NULL);
+    CuAssertIntEquals(tc, 4, r);
+
+    r = aug_rm(aug, "/files/etc/hosts");
+    CuAssertPositive(tc, r);
+
+    r = aug_get(aug, "/a/canonical", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "orange.watzmann.net", value);
+
+    aug_close(aug);
+}
+
 static void testToXml(CuTest *tc) {
     struct augeas *aug;
     int r;
@@ -644,6 +704,87 @@ static void testTextRetrieve(CuTest *tc) {
     aug_close(aug);
 }
 
+/* Record the events from aug_text_stream in a string */
+struct stream_events {
+    char buf[1024];
+    const char *stop;   /* Stop when we see a leaf with this label */
+};
+
+static int stream_record(struct stream_events *ev, char kind,
+                         const char *label, const char *value) {
+    size_t len = strlen(ev->buf);
+    snprintf(ev->buf + len, sizeof(ev->buf) - len, "%c%s=%s;", kind,
+             label == NULL ? "" : label, value == NULL ? "" : value);
+    return 0;
+}
+
+static int stream_enter(void *data, const char *label, const char *value) {
+    return stream_record(data, '{', label, value);
+}
+
+static int stream_leaf(void *data, const char *label, const char *value) {
+    struct stream_events *ev = data;
+    stream_record(ev, ' ', label, value);
+    return ev->stop != NULL && STREQ(ev->stop, label);
+}
+
+static int stream_exit(void *data, const char *label, const char *value) {
+    return stream_record(data, '}', label, value);
+}
+
+static void testTextStream(CuTest *tc) {
+    static const char *const hosts =
+        "192.168.0.1 rtr.example.com router\n"
+        "# comment\n"
+        "10.0.0.1 other\n";
+    struct stream_events ev;
+    struct aug_text_callbacks cb = {
+        stream_enter, stream_leaf, stream_exit, &ev
+    };
+    struct augeas *aug;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    MEMZERO(&ev, 1);
+    r = aug_text_stream(aug, "Hosts.lns", hosts, &cb);
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertStrEquals(tc,
+                      "{1=; ipaddr=192.168.0.1; canonical=rtr.example.com;"
+                      " alias=router;}1=;"
+                      " #comment=comment;"
+                      "{2=; ipaddr=10.0.0.1; canonical=other;}2=;",
+                      ev.buf);
+    /* No tree is built */
+    r = aug_match(aug, "/files/*", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    /* Stop early */
+    MEMZERO(&ev, 1);
+    ev.stop = "#comment";
+    r = aug_text_stream(aug, "Hosts.lns", hosts, &cb);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc,
+                      "{1=; ipaddr=192.168.0.1; canonical=rtr.example.com;"
+                      " alias=router;}1=;"
+                      " #comment=comment;",
+                      ev.buf);
+
+    /* Text the lens can not parse */
+    MEMZERO(&ev, 1);
+    r = aug_text_stream(aug, "Hosts.lns", "192.168.0.1\n", &cb);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_EPARSE, aug_error(aug));
+
+    /* A missing lens is an error, too */
+    r = aug_text_stream(aug, NULL, "192.168.0.1\n", &cb);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_EBADARG, aug_error(aug));
+
+    aug_close(aug);
+}
+
 static void testAugEscape(CuTest *tc) {
     static const char *const in  = "a/[]b|=c()!, \td";
     static const char *const exp = "a\\/\\[\\]b\\|\\=c\\(\\)\\!\\,\\ \\\td";
@@ -714,6 +855,47 @@ static void testLoadFile(CuTest *tc) {
     aug_close(aug);
 }
 
+/* Changes to the incl and excl entries of transforms must be picked up by
+ * aug_load_file, even after the filters were used once */
+static void testLoadFileChangedFilter(CuTest *tc) {
+    struct augeas *aug;
+    const char *value;
+    int r;
+
+    aug = aug_init(root, loadpath,
+                   AUG_NO_STDINC|AUG_NO_LOAD|AUG_NO_MODL_AUTOLOAD);
+    CuAssertPtrNotNull(tc, aug);
+    CuAssertIntEquals(tc, AUG_NOERROR, aug_error(aug));
+
+    r = aug_set(aug, "/augeas/load/Hosts/lens", "Hosts.lns");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/load/Hosts/incl", "/etc/hosts");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_load_file(aug, "/etc/fstab");
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_ENOLENS, aug_error(aug));
+
+    r = aug_set(aug, "/augeas/load/Fstab/lens", "Fstab.lns");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/load/Fstab/incl", "/etc/*tab");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_load_file(aug, "/etc/fstab");
+    CuAssertRetSuccess(tc, r);
+    r = aug_get(aug, "/files/etc/fstab/1/vfstype", &value);
+    CuAssertIntEquals(tc, 1, r);
+
+    r = aug_set(aug, "/augeas/load/Fstab/excl", "/etc/fstab");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_load_file(aug, "/etc/fstab");
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_ENOLENS, aug_error(aug));
+
+    aug_close(aug);
+}
+
 /* Make sure that if somebody erroneously creates a node
    /augeas/files/path, we do not corrupt the tree. It used to be that
    having such a node would free /augeas/files
@@ -905,12 +1087,15 @@ int main(void) {
     SUITE_ADD_TEST(suite, testMv);
     SUITE_ADD_TEST(suite, testCp);
     SUITE_ADD_TEST(suite, testRename);
+    SUITE_ADD_TEST(suite, testChangeLoaded);
     SUITE_ADD_TEST(suite, testToXml);
     SUITE_ADD_TEST(suite, testTextStore);
     SUITE_ADD_TEST(suite, testTextRetrieve);
+    SUITE_ADD_TEST(suite, testTextStream);
     SUITE_ADD_TEST(suite, testAugEscape);
     SUITE_ADD_TEST(suite, testRm);
     SUITE_ADD_TEST(suite, testLoadFile);
+    SUITE_ADD_TEST(suite, testLoadFileChangedFilter);
     SUITE_ADD_TEST(suite, testLoadBadPath);
     SUITE_ADD_TEST(suite, testLoadBadLens);
     SUITE_ADD_TEST(suite, testAugNs);
@@ -0,0 +1,137 @@
+#!/bin/sh
+
+# Test that augcc generates a plugin that compiles, and that lenses using
+# the DFAs and get routines from the plugin still pass their tests
+
+if [ -z "$abs_top_builddir" ]; then
+    echo "abs_top_builddir is not set"
+    exit 1
+fi
+
+if [ -z "$abs_top_srcdir" ]; then
+    echo "abs_top_srcdir is not set"
+    exit 1
+fi
+
+CC=${CC:-cc}
+if ! command -v ${CC%% *} > /dev/null 2>&1; then
+    echo "no C compiler, skipping"
+    exit 77
+fi
+
+ROOT=$abs_top_builddir/build/test-augcc
+LENSES=$abs_top_srcdir/lenses
+
+# The files of the lenses we put into the plugin; json, httpd, nginx and xml
+# are recursive and also get their parser from the plugin, all others get a
+# get routine
+PLUGIN_LENSES="aliases fstab group hosts httpd json nginx pam passwd php
+               puppet services sudoers sysctl systemd xml"
+RECURSIVE_LENSES="json httpd nginx xml"
+
+rm -rf $ROOT
+mkdir -p $ROOT
+
+# The name of the module defined in lens file $1
+module_name() {
+    sed -n 's/^ *module \+\([A-Za-z0-9_]*\).*/\1/p' $LENSES/$1.aug | head -1
+}
+
+qnames=
+for f in $PLUGIN_LENSES; do
+    qnames="$qnames $(module_name $f).lns"
+done
+
+augcc --nostdinc -I $LENSES -o $ROOT/plugin.c $qnames || exit 1
+
+if AUGEAS_LENS_PLUGINS=$ROOT/none.so AUGEAS_DEBUG=plugins \
+    augparse --nostdinc -I $LENSES $LENSES/tests/test_hosts.aug 2>&1 \
+    | grep -q "no dlopen" ; then
+    echo "plugins are not supported, skipping"
+    exit 77
+fi
+
+$CC -shared -fPIC -I$abs_top_srcdir/src -o $ROOT/plugin.so $ROOT/plugin.c
+if [ $? != 0 ]; then
+    echo "compiling the plugin failed"
+    exit 1
+fi
+
+for f in $PLUGIN_LENSES; do
+    mod=$(module_name $f)
+    out=$(AUGEAS_LENS_PLUGINS=$ROOT/plugin.so AUGEAS_DEBUG=plugins \
+          augparse --nostdinc -I $LENSES $LENSES/tests/test_$f.aug 2>&1)
+    if [ $? != 0 ]; then
+        echo "test_$f.aug failed with the plugin:"
+        echo "$out"
+        exit 1
+    fi
+    if ! echo "$out" | grep -q "using DFAs for $mod.lns" ; then
+        echo "test_$f.aug did not use the DFAs from the plugin:"
+        echo "$out"
+        exit 1
+    fi
+done
+
+# Recursive lenses also get their parser from the plugin
+for f in $RECURSIVE_LENSES; do
+    mod=$(module_name $f)
+    out=$(AUGEAS_LENS_PLUGINS=$ROOT/plugin.so AUGEAS_DEBUG=plugins \
+          augparse --nostdinc -I $LENSES $LENSES/tests/test_$f.aug 2>&1)
+    if ! echo "$out" | grep -q "using parser for $mod.lns" ; then
+        echo "test_$f.aug did not use the parser from the plugin:"
+        echo "$out"
+        exit 1
+    fi
+done
+
+# All other lenses use their get routine from the plugin
+for f in $PLUGIN_LENSES; do
+    case " $RECURSIVE_LENSES " in *" $f "*) continue;; esac
+    mod=$(module_name $f)
+    out=$(AUGEAS_LENS_PLUGINS=$ROOT/plugin.so AUGEAS_DEBUG=plugins \
+          augparse --nostdinc -I $LENSES $LENSES/tests/test_$f.aug 2>&1)
+    if ! echo "$out" | grep -q "using get for $mod.lns" ; then
+        echo "test_$f.aug did not use the get routine from the plugin:"
+        echo "$out"
+        exit 1
+    fi
+done
+
+# Everything the tests for Hosts get, the get routine can handle on its own
+out=$(AUGEAS_LENS_PLUGINS=$ROOT/plugin.so AUGEAS_DEBUG=plugins \
+      augparse --nostdinc -I $LENSES $LENSES/tests/test_hosts.aug 2>&1)
+if echo "$out" | grep -q "falling back" ; then
+    echo "test_hosts.aug fell back to the generic get:"
+    echo "$out"
+    exit 1
+fi
+
+# Text that the get routine can not handle is gotten by the generic code,
+# which reports the error
+cat > $ROOT/test_fallback.aug <<EOF
+module Test_fallback =
+test Hosts.lns get "127.0.0.1\\n" = *
+test Hosts.lns get "127.0.0.1 localhost\\n" =
+  { "1" { "ipaddr" = "127.0.0.1" } { "canonical" = "localhost" } }
+EOF
+out=$(AUGEAS_LENS_PLUGINS=$ROOT/plugin.so AUGEAS_DEBUG=plugins \
+      augparse --nostdinc -I $LENSES $ROOT/test_fallback.aug 2>&1)
+if [ $? != 0 ] || ! echo "$out" | grep -q "falling back" ; then
+    echo "test_fallback.aug did not fall back to the generic get:"
+    echo "$out"
+    exit 1
+fi
+
+# A lens that is not in the plugin is not affected by it
+out=$(AUGEAS_LENS_PLUGINS=$ROOT/plugin.so AUGEAS_DEBUG=plugins \
+      augparse --nostdinc -I $LENSES $LENSES/tests/test_shellvars.aug 2>&1)
+if [ $? != 0 ]; then
+    echo "test_shellvars.aug failed with the plugin:"
+    echo "$out"
+    exit 1
+fi
+if echo "$out" | grep -q "using DFAs" ; then
+    echo "test_shellvars.aug used DFAs from a plugin for other lenses"
+    exit 1
+fi
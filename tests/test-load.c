@@ -335,6 +335,126 @@ static void testReloadChanged(CuTest *tc) {
     aug_close(aug);
 }
 
+/* Load /etc/hosts under BUILD_ROOT with the lenses in LENSES and the
+ * cache in CACHE */
+static struct augeas *load_cached_hosts(CuTest *tc, const char *build_root,
+                                        const char *lenses,
+                                        const char *cache) {
+    struct augeas *aug = NULL;
+    int r;
+
+    aug = aug_init(build_root, lenses, AUG_NO_STDINC|AUG_NO_MODL_AUTOLOAD);
+    CuAssertPtrNotNull(tc, aug);
+    r = aug_set(aug, "/augeas/load/Hosts/lens", "Hosts.lns");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/load/Hosts/incl", "/etc/hosts");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/cache", cache);
+    CuAssertRetSuccess(tc, r);
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "/augeas//error", NULL);
+    CuAssertIntEquals(tc, 0, r);
+    return aug;
+}
+
+/* Replace the first occurrence of FROM in FNAME with TO, which must have
+ * the same length, without changing the size or the inode of FNAME */
+static void replace_in_place(CuTest *tc, const char *fname,
+                             const char *from, const char *to) {
+    char buf[4096], *p;
+    size_t len;
+    FILE *fp;
+    int r;
+
+    fp = fopen(fname, "r+");
+    CuAssertPtrNotNull(tc, fp);
+    len = fread(buf, 1, sizeof(buf) - 1, fp);
+    buf[len] = '\0';
+    p = strstr(buf, from);
+    CuAssertPtrNotNull(tc, p);
+    r = fseek(fp, p - buf, SEEK_SET);
+    CuAssertRetSuccess(tc, r);
+    CuAssertIntEquals(tc, strlen(to), fwrite(to, 1, strlen(to), fp));
+    r = fclose(fp);
+    CuAssertRetSuccess(tc, r);
+}
+
+/* Trees loaded from the cache must be the same as the ones produced by the
+ * lens, and the cache must not be used once the file or any module that
+ * the lens is built from changes */
+static void testTreeCache(CuTest *tc) {
+    augeas *aug = NULL;
+    const char *s;
+    char *build_root = setup_hosts(tc);
+    char *cache = NULL, *hosts = NULL, *lenses = NULL;
+    int r, nnodes;
+
+    r = asprintf(&cache, "%s/cache", build_root);
+    CuAssertPositive(tc, r);
+    r = asprintf(&hosts, "%s/etc/hosts", build_root);
+    CuAssertPositive(tc, r);
+    r = asprintf(&lenses, "%s/lenses", build_root);
+    CuAssertPositive(tc, r);
+    run(tc, "chmod -R u+w %s", build_root);
+    run(tc, "cp -pr %s/lenses %s", abs_top_srcdir, build_root);
+    run(tc, "touch -d '1 hour ago' %s", hosts);
+    run(tc, "cp -p %s %s/hosts.orig", hosts, build_root);
+
+    aug = load_cached_hosts(tc, build_root, lenses, cache);
+    nnodes = aug_match(aug, "/files/etc/hosts//*", NULL);
+    CuAssertPositive(tc, nnodes);
+    aug_close(aug);
+    run(tc, "test $(ls %s/*.tree | wc -l) = 1", cache);
+
+    /* Change the tree in the cache entry without making it invalid; the
+     * next load must come up with the changed tree */
+    run(tc, "sed -i -e 's/127\\.0\\.0\\.1/127.0.0.9/' %s/*.tree", cache);
+    aug = load_cached_hosts(tc, build_root, lenses, cache);
+    r = aug_match(aug, "/files/etc/hosts//*", NULL);
+    CuAssertIntEquals(tc, nnodes, r);
+    r = aug_match(aug, "/files/etc/hosts/1[ipaddr = '127.0.0.9']", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    aug_close(aug);
+
+    /* Changing a module that Hosts imports lenses from makes us parse the
+     * file again */
+    run(tc, "touch -d '2 hours ago' %s/util.aug", lenses);
+    aug = load_cached_hosts(tc, build_root, lenses, cache);
+    r = aug_match(aug, "/files/etc/hosts/1[ipaddr = '127.0.0.1']", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    aug_close(aug);
+
+    /* So does changing the content of the file without changing its size,
+     * mtime or inode */
+    run(tc, "sed -i -e 's/127\\.0\\.0\\.1/127.0.0.9/' %s/*.tree", cache);
+    replace_in_place(tc, hosts, "127.0.0.1", "127.0.0.7");
+    run(tc, "touch -r %s/hosts.orig %s", build_root, hosts);
+    aug = load_cached_hosts(tc, build_root, lenses, cache);
+    r = aug_match(aug, "/files/etc/hosts/1[ipaddr = '127.0.0.7']", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    /* Modifying the tree and saving it works as usual */
+    r = aug_set(aug, "/files/etc/hosts/1/ipaddr", "127.0.0.2");
+    CuAssertRetSuccess(tc, r);
+    r = aug_save(aug);
+    CuAssertRetSuccess(tc, r);
+    aug_close(aug);
+
+    aug = load_cached_hosts(tc, build_root, lenses, cache);
+    r = aug_match(aug, "/files/etc/hosts//*", NULL);
+    CuAssertIntEquals(tc, nnodes, r);
+    r = aug_get(aug, "/files/etc/hosts/1/ipaddr", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "127.0.0.2", s);
+
+    free(build_root);
+    free(cache);
+    free(hosts);
+    free(lenses);
+    aug_close(aug);
+}
+
 static void testReloadDirty(CuTest *tc) {
     augeas *aug = NULL;
     int r;
@@ -561,6 +681,397 @@ static void testPermsErrorReported(CuTest *tc) {
     aug_close(aug);
 }
 
+/* Test that files over the limits in /augeas/limits are skipped */
+static void testLoadLimits(CuTest *tc) {
+    augeas *aug = NULL;
+    int r;
+    const char *s, *aug_root;
+
+    aug = setup_writable_hosts(tc);
+
+    r = aug_set(aug, "/augeas/load/Fstab/lens", "Fstab.lns");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/load/Fstab/incl", "/etc/fstab");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/augeas/root", &aug_root);
+    CuAssertIntEquals(tc, 1, r);
+    run(tc, "cp -p %s/etc/fstab %setc/fstab", root, aug_root);
+
+    /* /etc/hosts has 309 bytes, /etc/fstab 760 */
+    r = aug_set(aug, "/augeas/limits/size", "500");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/files/etc/hosts/*", NULL);
+    CuAssertPositive(tc, r);
+    r = aug_match(aug, "/files/etc/fstab", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    r = aug_get(aug, "/augeas/files/etc/fstab/error", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "too_large", s);
+    r = aug_match(aug, "/augeas/files/etc/hosts/error", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    /* Invalid limits are reported, and do not limit anything */
+    r = aug_set(aug, "/augeas/limits/size", "-1");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/limits/time", "soon");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/augeas/limits/size/error", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_match(aug, "/augeas/limits/time/error", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_match(aug, "/files/etc/fstab/*", NULL);
+    CuAssertPositive(tc, r);
+    r = aug_match(aug, "/augeas/files/etc//error", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    /* A 9MB hosts file can not possibly be parsed in 1ms */
+    r = aug_rm(aug, "/augeas/limits/size");
+    CuAssertPositive(tc, r);
+    r = aug_set(aug, "/augeas/limits/time", "1");
+    CuAssertRetSuccess(tc, r);
+    run(tc, "yes '127.0.0.1 localhost.localdomain localhost' "
+        "| head -n 200000 > %setc/hosts", aug_root);
+    /* Make sure the change is noticed even within the same second */
+    run(tc, "touch -d '1 hour ago' %setc/hosts", aug_root);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/augeas/files/etc/hosts/error", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "parse_timeout", s);
+    /* The error for the invalid limit is gone */
+    r = aug_match(aug, "/augeas/limits/time/error", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    aug_close(aug);
+}
+
+/* Look up the error for /etc/hosts and its details in AUG */
+static void get_hosts_error(CuTest *tc, struct augeas *aug,
+                            const char **pos, const char **message,
+                            const char **last) {
+    int r;
+
+    r = aug_get(aug, "/augeas/files/etc/hosts/error/pos", pos);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_get(aug, "/augeas/files/etc/hosts/error/message", message);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_get(aug, "/augeas/files/etc/hosts/error/lens/last_matched", last);
+    CuAssertIntEquals(tc, 1, r);
+}
+
+/* Load /etc/hosts underneath ROOT with FLAGS */
+static struct augeas *load_hosts(CuTest *tc, const char *root,
+                                 unsigned int flags) {
+    struct augeas *aug;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_MODL_AUTOLOAD|flags);
+    CuAssertPtrNotNull(tc, aug);
+    r = aug_set(aug, "/augeas/load/Hosts/lens", "Hosts.lns");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/load/Hosts/incl", "/etc/hosts");
+    CuAssertRetSuccess(tc, r);
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+    return aug;
+}
+
+/* Test that errors from AUG_DEFER_ERRORS are the same as without it once
+ * they are looked at. Diagnosing an error parses the file again; we fix
+ * the file after loading it to tell which paths made the errors get
+ * diagnosed, since an error diagnosed after that keeps only what the
+ * deferred error says */
+static void testDeferErrors(CuTest *tc) {
+    char *build_root = setup_hosts(tc);
+    augeas *aug = NULL, *deferred = NULL, *untouched = NULL;
+    const char *pos, *message, *last, *dpos, *dmessage, *dlast;
+    int r;
+
+    /* An address without a canonical name */
+    run(tc, "echo 127.0.0.2 >> %s/etc/hosts", build_root);
+
+    aug = load_hosts(tc, build_root, 0);
+    deferred = load_hosts(tc, build_root, AUG_DEFER_ERRORS);
+    untouched = load_hosts(tc, build_root, AUG_DEFER_ERRORS);
+
+    /* Looking at /files does not need the errors */
+    r = aug_match(untouched, "/files/etc/hosts", NULL);
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_match(untouched, "/files/etc/hosts[. = '/augeas']", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    /* An absolute path in a predicate can look at the errors */
+    r = aug_match(deferred, "/files/etc/hosts[1 and /augeas/files]", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    run(tc, "sed -i -e 's/^127.0.0.2$/127.0.0.2 fixed/' %s/etc/hosts",
+        build_root);
+
+    r = aug_get(untouched, "/augeas/files/etc/hosts/error", &dmessage);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "parse_failed", dmessage);
+    r = aug_match(untouched,
+                  "/augeas/files/etc/hosts/error/lens/last_matched", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    get_hosts_error(tc, aug, &pos, &message, &last);
+    get_hosts_error(tc, deferred, &dpos, &dmessage, &dlast);
+    CuAssertStrEquals(tc, pos, dpos);
+    CuAssertStrEquals(tc, message, dmessage);
+    CuAssertStrEquals(tc, last, dlast);
+
+    r = aug_get(deferred, "/augeas/files/etc/hosts/error", &dmessage);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "parse_failed", dmessage);
+
+    aug_close(aug);
+    aug_close(deferred);
+    aug_close(untouched);
+    free(build_root);
+}
+
+/* Test that big files that are gotten in chunks on several threads with
+ * AUG_PARALLEL_LOAD come out the same as if they had been gotten in one
+ * piece */
+static void testLoadChunked(CuTest *tc) {
+    char *build_root = setup_hosts(tc);
+    augeas *aug = NULL;
+    int r;
+    const char *s, *aug_root;
+    char path[64];
+
+    run(tc, "chmod -R u+w %s", build_root);
+    aug = aug_init(build_root, loadpath,
+                   AUG_NO_MODL_AUTOLOAD|AUG_PARALLEL_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+    /* Get files in chunks even on machines with a single CPU */
+    aug->chunk_threads = 4;
+    r = aug_set(aug, "/augeas/load/Hosts/lens", "Hosts.lns");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/load/Hosts/incl", "/etc/hosts");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/augeas/root", &aug_root);
+    CuAssertIntEquals(tc, 1, r);
+    /* 13MB, enough for several chunks */
+    run(tc, "yes '127.0.0.1 localhost.localdomain localhost' "
+        "| head -n 300000 > %setc/hosts", aug_root);
+    run(tc, "touch -d '1 hour ago' %setc/hosts", aug_root);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+    CuAssertIntEquals(tc, 1, aug->chunk_stats.files);
+    CuAssertIntEquals(tc, 4, aug->chunk_stats.chunks);
+    CuAssertIntEquals(tc, 0, aug->chunk_stats.fallbacks);
+
+    /* The seqs in later chunks continue where the earlier ones stopped */
+    r = aug_match(aug, "/files/etc/hosts/*", NULL);
+    CuAssertIntEquals(tc, 300000, r);
+    for (int i=1; i <= 300000; i += 999) {
+        snprintf(path, sizeof(path), "/files/etc/hosts/*[%d]", i);
+        r = aug_label(aug, path, &s);
+        CuAssertIntEquals(tc, 1, r);
+        snprintf(path, sizeof(path), "%d", i);
+        CuAssertStrEquals(tc, path, s);
+    }
+    r = aug_label(aug, "/files/etc/hosts/*[last()]", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "300000", s);
+    r = aug_match(aug, "/files/etc/hosts/*[alias = 'localhost']", NULL);
+    CuAssertIntEquals(tc, 300000, r);
+    r = aug_get(aug, "/files/etc/hosts/300000/canonical", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "localhost.localdomain", s);
+    r = aug_match(aug, "/files/etc/hosts/300001", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    /* An error in one of the chunks is reported as usual */
+    run(tc, "sed -i -e '200000s/.*/bogus/' %setc/hosts", aug_root);
+    run(tc, "touch -d '30 minutes ago' %setc/hosts", aug_root);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/augeas/files/etc/hosts/error", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "parse_failed", s);
+    CuAssertIntEquals(tc, 1, aug->chunk_stats.files);
+    CuAssertIntEquals(tc, 1, aug->chunk_stats.fallbacks);
+
+    aug_close(aug);
+    free(build_root);
+}
+
+static struct augeas *setup_passwd_aug(CuTest *tc, const char *build_root,
+                                        unsigned int flags) {
+    struct augeas *aug = NULL;
+    int r;
+
+    aug = aug_init(build_root, loadpath, AUG_NO_MODL_AUTOLOAD|flags);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_set(aug, "/augeas/load/Passwd/lens", "Passwd.lns");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/load/Passwd/incl", "/etc/passwd");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+    return aug;
+}
+
+/* Check that the trees and spans in AUG are the same as those from a
+ * fresh load of the files under BUILD_ROOT */
+static void assert_same_as_fresh_load(CuTest *tc, struct augeas *aug,
+                                      const char *build_root) {
+    struct augeas *fresh = setup_passwd_aug(tc, build_root, AUG_ENABLE_SPAN);
+    char **paths = NULL, **fresh_paths = NULL;
+    int n, fresh_n;
+
+    n = aug_match(aug, "/files/etc/passwd/descendant-or-self::*", &paths);
+    fresh_n = aug_match(fresh, "/files/etc/passwd/descendant-or-self::*",
+                        &fresh_paths);
+    CuAssertIntEquals(tc, fresh_n, n);
+
+    for (int i=0; i < n; i++) {
+        unsigned int sp[6], fresh_sp[6];
+        const char *v, *fresh_v;
+        int r;
+
+        CuAssertStrEquals(tc, fresh_paths[i], paths[i]);
+        r = aug_get(aug, paths[i], &v);
+        CuAssertIntEquals(tc, 1, r);
+        r = aug_get(fresh, fresh_paths[i], &fresh_v);
+        CuAssertIntEquals(tc, 1, r);
+        CuAssertStrEquals(tc, fresh_v, v);
+
+        r = aug_span(aug, paths[i], NULL, sp, sp+1, sp+2, sp+3, sp+4, sp+5);
+        CuAssertRetSuccess(tc, r);
+        r = aug_span(fresh, fresh_paths[i], NULL, fresh_sp, fresh_sp+1,
+                     fresh_sp+2, fresh_sp+3, fresh_sp+4, fresh_sp+5);
+        CuAssertRetSuccess(tc, r);
+        for (int j=0; j < 6; j++)
+            CuAssertIntEquals(tc, fresh_sp[j], sp[j]);
+        free(paths[i]);
+        free(fresh_paths[i]);
+    }
+    free(paths);
+    free(fresh_paths);
+    aug_close(fresh);
+}
+
+/* The uid of USER in /etc/passwd in AUG. Since aug_get hands out the
+ * value stored in the tree, the same pointer means the same node */
+static const char *passwd_uid(CuTest *tc, struct augeas *aug,
+                              const char *user) {
+    const char *uid;
+    char *path = NULL;
+    int r;
+
+    r = asprintf(&path, "/files/etc/passwd/%s/uid", user);
+    CuAssertTrue(tc, r >= 0);
+    r = aug_get(aug, path, &uid);
+    free(path);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrNotNull(tc, uid);
+    return uid;
+}
+
+/* Test that reloading a changed file with spans enabled only gets the
+ * lines that changed, and comes out the same as a fresh load */
+static void testReloadIncremental(CuTest *tc) {
+    augeas *aug = NULL;
+    char *build_root = setup_hosts(tc);
+    const char *root_uid, *adm_uid;
+    const char *s;
+    int r;
+
+    run(tc, "cp -p %s/etc/passwd %s/etc", root, build_root);
+    run(tc, "chmod -R u+w %s", build_root);
+    run(tc, "touch -d '1 hour ago' %s/etc/passwd", build_root);
+
+    aug = setup_passwd_aug(tc, build_root, AUG_ENABLE_SPAN);
+    root_uid = passwd_uid(tc, aug, "root");
+    adm_uid = passwd_uid(tc, aug, "adm");
+
+    /* Change a line in the middle, and make it longer */
+    run(tc, "sed -i -e 's/^daemon:x:2:2:daemon:/daemon:x:2:2:The Daemon:/' "
+        "%s/etc/passwd", build_root);
+    run(tc, "touch -d '50 minutes ago' %s/etc/passwd", build_root);
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/files/etc/passwd/daemon/name", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "The Daemon", s);
+    /* The trees for the lines around it were kept */
+    CuAssertPtrEquals(tc, root_uid, passwd_uid(tc, aug, "root"));
+    CuAssertPtrEquals(tc, adm_uid, passwd_uid(tc, aug, "adm"));
+    assert_same_as_fresh_load(tc, aug, build_root);
+
+    /* Insert a line at the start */
+    run(tc, "sed -i -e '1i first:x:100:100::/:/bin/sh' %s/etc/passwd",
+        build_root);
+    run(tc, "touch -d '45 minutes ago' %s/etc/passwd", build_root);
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/files/etc/passwd/first", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrEquals(tc, root_uid, passwd_uid(tc, aug, "root"));
+    CuAssertPtrEquals(tc, adm_uid, passwd_uid(tc, aug, "adm"));
+    assert_same_as_fresh_load(tc, aug, build_root);
+
+    /* Delete the last line */
+    run(tc, "sed -i -e '$d' %s/etc/passwd", build_root);
+    run(tc, "touch -d '40 minutes ago' %s/etc/passwd", build_root);
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/files/etc/passwd/*", NULL);
+    CuAssertIntEquals(tc, 19, r);
+    CuAssertPtrEquals(tc, root_uid, passwd_uid(tc, aug, "root"));
+    assert_same_as_fresh_load(tc, aug, build_root);
+
+    /* A parse error in a changed line is reported as usual */
+    run(tc, "sed -i -e 's/^adm:.*/bogus/' %s/etc/passwd", build_root);
+    run(tc, "touch -d '30 minutes ago' %s/etc/passwd", build_root);
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/augeas/files/etc/passwd/error", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "parse_failed", s);
+    /* The tree from before the error is kept */
+    CuAssertPtrEquals(tc, adm_uid, passwd_uid(tc, aug, "adm"));
+
+    /* Fixing the error clears it */
+    run(tc, "sed -i -e 's/^bogus$/adm:x:3:4:adm:\\/var\\/adm:\\/sbin\\/nologin/' "
+        "%s/etc/passwd", build_root);
+    run(tc, "touch -d '20 minutes ago' %s/etc/passwd", build_root);
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/augeas/files/etc/passwd/error", NULL);
+    CuAssertIntEquals(tc, 0, r);
+    assert_same_as_fresh_load(tc, aug, build_root);
+
+    aug_close(aug);
+    free(build_root);
+}
+
 /* Test bug #252 - excl patterns have no effect when loading with a root */
 static void testLoadExclWithRoot(CuTest *tc) {
     augeas *aug = NULL;
@@ -665,6 +1176,7 @@ int main(void) {
     SUITE_ADD_TEST(suite, testLoadDefined);
     SUITE_ADD_TEST(suite, testDefvarExpr);
     SUITE_ADD_TEST(suite, testReloadChanged);
+    SUITE_ADD_TEST(suite, testTreeCache);
     SUITE_ADD_TEST(suite, testReloadDirty);
     SUITE_ADD_TEST(suite, testReloadDeleted);
     SUITE_ADD_TEST(suite, testReloadDeletedMeta);
@@ -672,6 +1184,10 @@ int main(void) {
     SUITE_ADD_TEST(suite, testReloadAfterSaveNewfile);
     SUITE_ADD_TEST(suite, testParseErrorReported);
     SUITE_ADD_TEST(suite, testPermsErrorReported);
+    SUITE_ADD_TEST(suite, testLoadLimits);
+    SUITE_ADD_TEST(suite, testDeferErrors);
+    SUITE_ADD_TEST(suite, testLoadChunked);
+    SUITE_ADD_TEST(suite, testReloadIncremental);
     SUITE_ADD_TEST(suite, testLoadExclWithRoot);
     SUITE_ADD_TEST(suite, testLoadTrailingExcl);
     SUITE_ADD_TEST(suite, testMultipleXfm);
@@ -26,13 +26,16 @@
 
 #include "cutest.h"
 #include "internal.h"
+#include "memory.h"
 
+#include <sys/resource.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 static const char *abs_top_srcdir;
 static char *root;
 static char *loadpath;
+static char *modules_loadpath;
 
 #define die(msg)                                                    \
     do {                                                            \
@@ -76,12 +79,248 @@ static void testPerfPredicate(CuTest *tc) {
     aug_close(aug);
 }
 
+/* Test that parsing with a right-recursive lens takes time linear in the
+ * depth of nesting. The lens zsemi from pass_simple_recursion.aug nests
+ * "az;az;...az;" N levels deep */
+static void testPerfRightRecursion(CuTest *tc) {
+    struct timeval stop, start;
+    struct augeas *aug;
+    int r;
+
+    aug = aug_init(root, modules_loadpath,
+                   AUG_NO_STDINC|AUG_NO_LOAD|AUG_NO_MODL_AUTOLOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    for (int n = 1000; n <= 4000; n *= 2) {
+        char *text = NULL;
+
+        if (ALLOC_N(text, 3*n + 1) < 0)
+            die("failed to allocate text");
+        for (int i=0; i < n; i++)
+            memcpy(text + 3*i, "az;", 3);
+
+        r = aug_set(aug, "/text", text);
+        CuAssertIntEquals(tc, 0, r);
+        free(text);
+
+        gettimeofday(&start, NULL);
+        r = aug_text_store(aug, "Pass_simple_recursion.zsemi",
+                           "/text", "/nested");
+        gettimeofday(&stop, NULL);
+        CuAssertIntEquals(tc, 0, r);
+
+        r = aug_match(aug, "/nested//a", NULL);
+        CuAssertIntEquals(tc, n, r);
+        printf("testPerfRightRecursion depth %d = %lums\n",
+               n, time_taken(start, stop));
+
+        r = aug_rm(aug, "/nested");
+        CuAssertTrue(tc, r > 0);
+    }
+
+    aug_close(aug);
+}
+
+/* Copy the jmt statistics of AUG into STATS and reset them */
+static void jmt_stats(struct augeas *aug, struct jmt_stats *stats) {
+    *stats = aug->jmt_stats;
+    MEMZERO(&aug->jmt_stats, 1);
+}
+
+/* A scenario for testPerfRecursiveLenses: get the text
+ * HEAD . UNIT^n . MID . TAIL^n . END with LENS, so that a nonempty TAIL
+ * makes the text nest n levels deep */
+struct rec_scenario {
+    const char *name;
+    const char *lens;
+    int         n;              /* The smallest n we report */
+    const char *head;
+    const char *unit;
+    const char *mid;
+    const char *tail;
+    const char *end;
+};
+
+static const struct rec_scenario rec_scenarios[] = {
+    { "json-flat", "Json.lns", 500,
+      "[\n", "  { \"key\": \"value\", \"list\": [ 1, 2.5, true, null ] },\n",
+      "  { }\n", "", "]\n" },
+    { "json-nested", "Json.lns", 250,
+      "", "[ 1, ", "2", " ]", "\n" },
+    { "xml-flat", "Xml.lns", 500,
+      "<doc>\n", "  <item name=\"x\">text</item>\n", "", "", "</doc>\n" },
+    { "xml-nested", "Xml.lns", 250,
+      "", "<e a=\"1\">", "text", "</e>", "\n" },
+    { "nginx-flat", "Nginx.lns", 500,
+      "http {\n", "  listen 80;\n", "", "", "}\n" },
+    { "nginx-nested", "Nginx.lns", 250,
+      "", "server {\n", "listen 80;\n", "}\n", "" },
+};
+
+static char *rec_scenario_text(const struct rec_scenario *sc, int n) {
+    size_t len = strlen(sc->head) + strlen(sc->mid) + strlen(sc->end)
+        + n * (strlen(sc->unit) + strlen(sc->tail));
+    char *text = NULL, *p;
+
+    if (ALLOC_N(text, len + 1) < 0)
+        die("failed to allocate text");
+    p = stpcpy(text, sc->head);
+    for (int i=0; i < n; i++)
+        p = stpcpy(p, sc->unit);
+    p = stpcpy(p, sc->mid);
+    for (int i=0; i < n; i++)
+        p = stpcpy(p, sc->tail);
+    stpcpy(p, sc->end);
+    return text;
+}
+
+/* Get texts that grow in size or nesting depth with the recursive lenses
+ * that we ship, and report time, the items the jmt parser created, the
+ * memory the parse used, and the peak memory use of the process so
+ * far. Quadrupling the size of the text should at most quadruple the
+ * number of items; timings are only reported since they are too noisy to
+ * assert anything about. The first, smaller, get with each lens also
+ * loads the lens and is not reported */
+static void testPerfRecursiveLenses(CuTest *tc) {
+    struct timeval stop, start;
+    struct augeas *aug;
+    struct jmt_stats stats;
+    struct rusage usage;
+    int r;
+
+    aug = aug_init(root, loadpath,
+                   AUG_NO_STDINC|AUG_NO_LOAD|AUG_NO_MODL_AUTOLOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    for (size_t s=0; s < ARRAY_CARDINALITY(rec_scenarios); s++) {
+        const struct rec_scenario *sc = rec_scenarios + s;
+        unsigned long items[4];
+
+        for (int i=0; i < 4; i++) {
+            int n = (sc->n << i) / 2;
+            char *text = rec_scenario_text(sc, n);
+
+            r = aug_set(aug, "/text", text);
+            CuAssertIntEquals(tc, 0, r);
+            free(text);
+
+            jmt_stats(aug, &stats);
+            gettimeofday(&start, NULL);
+            r = aug_text_store(aug, sc->lens, "/text", "/out");
+            gettimeofday(&stop, NULL);
+            CuAssertIntEquals(tc, 0, r);
+            jmt_stats(aug, &stats);
+            getrusage(RUSAGE_SELF, &usage);
+
+            items[i] = stats.items;
+            if (i > 0)
+                printf("testPerfRecursiveLenses %-12s n = %5d %5lums "
+                       "%8lu items %8lu links %6zukB parse %6ldkB max\n",
+                       sc->name, n, time_taken(start, stop),
+                       stats.items, stats.links, stats.max_bytes / 1024,
+                       usage.ru_maxrss);
+
+            r = aug_rm(aug, "/out");
+            CuAssertTrue(tc, r > 0);
+        }
+        CuAssertTrue(tc, stats.parses > 0);
+        CuAssertTrue(tc, items[3] <= 4 * items[1] + 4 * items[1] / 10);
+    }
+
+    aug_close(aug);
+}
+
+/* Check that getting the text for SC with N units makes the jmt parser
+ * compact its chart, and that we still get the right tree: COUNT nodes
+ * match PATH, all with value VALUE, and putting the tree back gives the
+ * original text. Changing the first match to "changed" must change only
+ * the first occurrence of VALUE after the head of the text */
+static void check_compacted(CuTest *tc, struct augeas *aug,
+                            const struct rec_scenario *sc, int n,
+                            const char *path, int count,
+                            const char *value) {
+    struct jmt_stats stats;
+    char *text = rec_scenario_text(sc, n);
+    char *changed = NULL, *p, **matches = NULL;
+    const char *s;
+    int r;
+
+    r = aug_set(aug, "/text", text);
+    CuAssertIntEquals(tc, 0, r);
+
+    jmt_stats(aug, &stats);
+    r = aug_text_store(aug, sc->lens, "/text", "/out");
+    CuAssertIntEquals(tc, 0, r);
+    jmt_stats(aug, &stats);
+    CuAssertTrue(tc, stats.compactions > 0);
+
+    r = aug_match(aug, path, &matches);
+    CuAssertIntEquals(tc, count, r);
+    r = asprintf(&p, "%s[. = '%s']", path, value);
+    CuAssertTrue(tc, r >= 0);
+    r = aug_match(aug, p, NULL);
+    free(p);
+    CuAssertIntEquals(tc, count, r);
+
+    r = aug_text_retrieve(aug, sc->lens, "/text", "/out", "/put");
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_get(aug, "/put", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertTrue(tc, STREQ(text, s));
+
+    p = strstr(text + strlen(sc->head), value);
+    CuAssertPtrNotNull(tc, p);
+    r = asprintf(&changed, "%.*schanged%s", (int) (p - text), text,
+                 p + strlen(value));
+    CuAssertTrue(tc, r >= 0);
+
+    r = aug_set(aug, matches[0], "changed");
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_text_retrieve(aug, sc->lens, "/text", "/out", "/put");
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_get(aug, "/put", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertTrue(tc, STREQ(changed, s));
+
+    r = aug_rm(aug, "/out");
+    CuAssertTrue(tc, r > 0);
+    for (int i=0; i < count; i++)
+        free(matches[i]);
+    free(matches);
+    free(changed);
+    free(text);
+}
+
+/* Test that the jmt parser still gets the right trees when it compacts
+ * its chart. Texts big enough for the default threshold take too long to
+ * put back, and we lower the threshold instead */
+static void testCompactedParse(CuTest *tc) {
+    struct augeas *aug;
+
+    aug = aug_init(root, loadpath,
+                   AUG_NO_STDINC|AUG_NO_LOAD|AUG_NO_MODL_AUTOLOAD);
+    CuAssertPtrNotNull(tc, aug);
+    aug->jmt_compact_min = 4096;
+
+    /* json-flat and xml-flat from REC_SCENARIOS */
+    check_compacted(tc, aug, rec_scenarios + 0, 1000,
+                    "/out/array/dict/entry[. = 'key']/string", 1000,
+                    "value");
+    check_compacted(tc, aug, rec_scenarios + 2, 1000,
+                    "/out/doc/item/#text", 1000, "text");
+
+    aug_close(aug);
+}
+
 int main(void) {
     char *output = NULL;
     CuSuite* suite = CuSuiteNew();
     CuSuiteSetup(suite, NULL, NULL);
 
     SUITE_ADD_TEST(suite, testPerfPredicate);
+    SUITE_ADD_TEST(suite, testPerfRightRecursion);
+    SUITE_ADD_TEST(suite, testPerfRecursiveLenses);
+    SUITE_ADD_TEST(suite, testCompactedParse);
 
     abs_top_srcdir = getenv("abs_top_srcdir");
     if (abs_top_srcdir == NULL)
@@ -95,6 +334,11 @@ int main(void) {
         die("failed to set loadpath");
     }
 
+    if (asprintf(&modules_loadpath, "%s/lenses:%s/tests/modules",
+                 abs_top_srcdir, abs_top_srcdir) < 0) {
+        die("failed to set loadpath");
+    }
+
     CuSuiteRun(suite);
     CuSuiteSummary(suite, &output);
     CuSuiteDetails(suite, &output);